@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <string>
+#include <fstream>
+#include <vector>
+#include <utility> // std::pair
+#include <stdexcept> // std::runtime_error
+#include <sstream> // std::stringstream
+
+#include "Backtest.h"
+#include "CsvReader.h"
+#include "OutputWriter.h"
+#include "TelemetryFile.h"
+
+void write_csv(std::string filename, const Dataset& dataset){
+    // Make a CSV file with one or more columns of integer values
+    // Each column of data is represented by the pair <column name, column data>
+    //   as std::pair<std::string, std::vector<int>>
+    // The dataset is represented as a vector of these columns
+    // Note that all columns should be the same size
+
+    OutputWriter output(filename, OutputFormat::Csv);
+
+    std::vector<std::string> names;
+    for(size_t j = 0; j < dataset.size(); ++j) names.push_back(dataset[j].first);
+    output.begin(names, 0, 0);
+
+    // Send data to the writer a row at a time
+    std::vector<int32_t> values(dataset.size());
+    size_t rows = dataset.empty() ? 0 : dataset[0].second.size();
+    for(size_t i = 0; i < rows; ++i)
+    {
+        for(size_t j = 0; j < dataset.size(); ++j) values[j] = dataset[j].second[i];
+        output.writeRow(values.data());
+    }
+
+    output.close();
+}
+
+std::pair<int, int> read_node_data(std::string filename){
+
+    // Create pair to store the result
+    std::pair<int, int> result;
+
+    // Create an input filestream
+    std::ifstream myFile(filename);
+
+    // Make sure the file is open
+    if(!myFile.is_open()) throw std::runtime_error("Could not open file");
+
+    // Declare helper vars
+    std::string line, colname;
+    int val;
+
+    if(myFile.good())
+    {
+        // Extract the first line in the file
+        std::getline(myFile, line);
+
+        // Skip and extract the second line in the file to get the values
+        std::getline(myFile, line);
+
+        // Create a stringstream from the line
+        std::stringstream ss(line);
+        
+        // Keep track of colIdx
+        int colIdx = 0;
+
+        // Extract each integer
+        while(ss >> val){
+            // Add the current integer to the result pair
+
+            
+            if (colIdx == 0) {
+                result.first = val;
+            } else {
+                result.second = val;
+            }
+
+            // If the next token is a comma, ignore it and move on
+            if(ss.peek() == ',') ss.ignore();
+
+            colIdx ++;
+        }
+        
+        return result;
+    }
+
+    throw std::runtime_error("Could not read file");
+}
+
+// Keeps every column in memory for the modes that compare whole series
+struct DatasetSink {
+    Dataset dataset;
+    size_t expectedRows;
+
+    DatasetSink(size_t expectedRows) :
+        expectedRows(expectedRows)
+    {}
+
+    void begin(const std::vector<std::string>& names, int32_t, int32_t){
+        for(size_t j = 0; j < names.size(); ++j)
+        {
+            dataset.push_back(std::make_pair(names[j], std::vector<int>()));
+            dataset.back().second.reserve(expectedRows);
+        }
+    }
+
+    void writeRow(const int32_t* values){
+        for(size_t j = 0; j < dataset.size(); ++j) dataset[j].second.push_back(values[j]);
+    }
+};
+
+// Replays a CSV file through the filter, every row goes to the sink as soon as the filter has read it.
+// Sink is a DatasetSink or an OutputWriter. Returns the number of rows.
+template <typename Kalman, typename Sink>
+static size_t replay_csv(std::string nodeFilename, CsvReader& reader, Sink& sink, typename Kalman::TraceRing* trace){
+
+    // Instantiate kalman filter and initialize values
+    Kalman kalman;
+    kalman.setTrace(trace);
+
+    // Get node battery type and voltage
+    std::pair<int, int> batteryInfo = read_node_data(nodeFilename);
+
+    bool isBatteryLithium = (bool)batteryInfo.first;
+    bool isBattery12V = (batteryInfo.second == 12) ? true : false;
+
+    // Read the column names, and add a new column for Kalman SoC
+    std::vector<std::string> colnames;
+    reader.readHeader(colnames, "timestamp");
+    if(colnames.size() != 5) throw std::runtime_error("Expected 5 sensor columns before timestamp");
+    colnames.push_back("kalman_soc");
+    sink.begin(colnames, batteryInfo.first, batteryInfo.second);
+
+    // The five sensor values followed by the soc
+    int32_t values[6];
+    int count;
+    size_t lineIdx = 0;
+    // Read data, row by row, straight from the mapping
+    while((count = reader.readRow(values, 5)) >= 0)
+    {
+        // skip rows that don't carry every sensor column
+        if (count < 5) {
+            continue;
+        }
+
+        values[5] = filter_row(kalman, values, lineIdx == 0, isBattery12V, isBatteryLithium);
+        sink.writeRow(values);
+        lineIdx++;
+    }
+
+    return lineIdx;
+}
+
+// Replays a columnar telemetry file, battery info comes from its header
+template <typename Kalman, typename Sink>
+static size_t replay_binary(TelemetryReader& reader, Sink& sink, typename Kalman::TraceRing* trace){
+
+    Kalman kalman;
+    kalman.setTrace(trace);
+
+    bool isBatteryLithium = (bool)reader.isBatteryLithium();
+    bool isBattery12V = (reader.nominalVoltage() == 12) ? true : false;
+
+    if(reader.names().size() < 5) throw std::runtime_error("Expected 5 sensor columns");
+
+    // Same columns as replay_csv: the five sensor columns followed by kalman_soc
+    std::vector<std::string> colnames(reader.names().begin(), reader.names().begin() + 5);
+    colnames.push_back("kalman_soc");
+    sink.begin(colnames, reader.isBatteryLithium(), reader.nominalVoltage());
+
+    // Further columns are decoded and then overwritten by the soc
+    std::vector<int32_t> values(reader.names().size() > 6 ? reader.names().size() : 6);
+    size_t rows = 0;
+    while(reader.readRow(values.data()))
+    {
+        values[5] = filter_row(kalman, values.data(), rows == 0, isBattery12V, isBatteryLithium);
+        sink.writeRow(values.data());
+        rows++;
+    }
+
+    return rows;
+}
+
+template <typename Kalman>
+Dataset process_csv(std::string nodeFilename, std::string filename, typename Kalman::TraceRing* trace){
+    // Map the input file, rows are parsed in place
+    CsvReader reader(filename);
+
+    // Reserve roughly one row per 32 bytes of input so columns don't keep reallocating
+    DatasetSink sink(reader.size() / 32);
+    replay_csv<Kalman>(nodeFilename, reader, sink, trace);
+    return sink.dataset;
+}
+
+template <typename Kalman>
+Dataset process_binary(std::string filename, typename Kalman::TraceRing* trace){
+    TelemetryReader reader(filename);
+    DatasetSink sink(reader.rows());
+    replay_binary<Kalman>(reader, sink, trace);
+    return sink.dataset;
+}
+
+template <typename Kalman>
+Dataset process_input(std::string nodeFilename, std::string filename, typename Kalman::TraceRing* trace){
+    if(TelemetryFile::isTelemetryFile(filename)) return process_binary<Kalman>(filename, trace);
+    return process_csv<Kalman>(nodeFilename, filename, trace);
+}
+
+// Passes rows on to the output, noting the soc range on the way
+struct StreamSink {
+    OutputWriter& output;
+    SocSummary* summary;
+
+    void begin(const std::vector<std::string>& names, int32_t isBatteryLithium, int32_t nominalVoltage){
+        output.begin(names, isBatteryLithium, nominalVoltage);
+    }
+
+    void writeRow(const int32_t* values){
+        if(summary != NULL) {
+            if(output.rows() == 0 || values[5] < summary->minSoC) summary->minSoC = values[5];
+            if(output.rows() == 0 || values[5] > summary->maxSoC) summary->maxSoC = values[5];
+            summary->finalSoC = values[5];
+        }
+        output.writeRow(values);
+    }
+};
+
+template <typename Kalman>
+size_t stream_input(std::string nodeFilename, std::string filename, OutputWriter& output, SocSummary* summary, typename Kalman::TraceRing* trace){
+    StreamSink sink = { output, summary };
+    size_t rows;
+
+    if(TelemetryFile::isTelemetryFile(filename)) {
+        TelemetryReader reader(filename);
+        rows = replay_binary<Kalman>(reader, sink, trace);
+    } else {
+        CsvReader reader(filename);
+        rows = replay_csv<Kalman>(nodeFilename, reader, sink, trace);
+    }
+    output.close();
+
+    return rows;
+}
+
+size_t convert_csv(std::string nodeFilename, std::string filename, std::string outputFilename){
+    // Copies the sensor columns of a CSV file into a columnar telemetry file
+
+    std::pair<int, int> batteryInfo = read_node_data(nodeFilename);
+    CsvReader reader(filename);
+
+    std::vector<std::string> colnames;
+    reader.readHeader(colnames, "timestamp");
+    if(colnames.size() != 5) throw std::runtime_error("Expected 5 sensor columns before timestamp");
+
+    TelemetryWriter writer(outputFilename, colnames, batteryInfo.first, batteryInfo.second);
+
+    int32_t values[5];
+    int count;
+    size_t rows = 0;
+    while((count = reader.readRow(values, 5)) >= 0)
+    {
+        // skip rows that don't carry every sensor column, like process_csv
+        if (count < 5) {
+            continue;
+        }
+        writer.writeRow(values);
+        rows++;
+    }
+    writer.close();
+
+    return rows;
+}
+
+// Instantiate for every filter engine the modes use
+template Dataset process_csv<SoCKalmanFloat>(std::string nodeFilename, std::string filename, SoCKalmanFloat::TraceRing* trace);
+template Dataset process_csv<SoCKalmanFixed>(std::string nodeFilename, std::string filename, SoCKalmanFixed::TraceRing* trace);
+template Dataset process_binary<SoCKalmanFloat>(std::string filename, SoCKalmanFloat::TraceRing* trace);
+template Dataset process_binary<SoCKalmanFixed>(std::string filename, SoCKalmanFixed::TraceRing* trace);
+template Dataset process_input<SoCKalmanFloat>(std::string nodeFilename, std::string filename, SoCKalmanFloat::TraceRing* trace);
+template Dataset process_input<SoCKalmanFixed>(std::string nodeFilename, std::string filename, SoCKalmanFixed::TraceRing* trace);
+template size_t stream_input<SoCKalmanFloat>(std::string nodeFilename, std::string filename, OutputWriter& output, SocSummary* summary,
+    SoCKalmanFloat::TraceRing* trace);
+template size_t stream_input<SoCKalmanFixed>(std::string nodeFilename, std::string filename, OutputWriter& output, SocSummary* summary,
+    SoCKalmanFixed::TraceRing* trace);
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <utility> // std::pair
+#include <vector>
+
+#include "SoCKalman.h"
+
+class OutputWriter;
+
+// Each column of data is represented by the pair <column name, column data>
+typedef std::vector<std::pair<std::string, std::vector<int> > > Dataset;
+
+static const uint32_t BATTERY_EFF = 85000;
+static const uint32_t INITIAL_SOC = 0xFFFFFFFF;   // out of range, estimate from voltage
+static const uint32_t BATTERY_CAPACITY = 1200;
+
+// Filter one row of <milliamps, milliwatts, charge state, voltage, sample period>,
+// the first row of a series initializes the filter. Returns the new soc.
+template <typename Kalman>
+inline uint32_t filter_row(Kalman& kalman, const int32_t* values, bool isFirstRow, bool isBattery12V, bool isBatteryLithium,
+    uint32_t batteryEff = BATTERY_EFF, uint32_t batteryCapacity = BATTERY_CAPACITY){
+    if (isFirstRow) {
+        // use battery voltage to initialize kalman filter
+        uint32_t batteryVoltage = values[3];
+        kalman.init(isBattery12V, isBatteryLithium, batteryEff, batteryVoltage, INITIAL_SOC);
+    } else {
+        // use sensor data to do a sample with the kalman filter
+        bool isBatteryInFloat = (values[2] == 3);
+        int32_t batteryMilliAmps = values[0];
+        uint32_t batteryVoltage = values[3];
+        int32_t batteryMilliWatts = values[1];
+        uint32_t samplePeriodMilliSec = values[4];
+        kalman.sample(isBatteryInFloat, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity);
+    }
+    return kalman.read();
+}
+
+// Make a CSV file with one or more columns of integer values
+void write_csv(std::string filename, const Dataset& dataset);
+
+// Read <is lithium, nominal voltage> from a node data file
+std::pair<int, int> read_node_data(std::string filename);
+
+// Run the Kalman filter over a raw sensor data file, returns the sensor
+// columns followed by a kalman_soc column. trace (optional) receives a record per sample.
+template <typename Kalman>
+Dataset process_csv(std::string nodeFilename, std::string filename, typename Kalman::TraceRing* trace = NULL);
+
+// Run the Kalman filter over a columnar telemetry file, same columns as process_csv
+template <typename Kalman>
+Dataset process_binary(std::string filename, typename Kalman::TraceRing* trace = NULL);
+
+// process_binary for telemetry files, process_csv otherwise
+template <typename Kalman>
+Dataset process_input(std::string nodeFilename, std::string filename, typename Kalman::TraceRing* trace = NULL);
+
+// Range of the filter soc over a series, filled in while streaming
+struct SocSummary {
+    int finalSoC;
+    int minSoC;
+    int maxSoC;
+};
+
+// Same as process_input, but each row goes to output as soon as the filter has read it instead of
+// being kept, so memory doesn't grow with the input. summary (optional) receives the soc range.
+// Closes output and returns the number of rows.
+template <typename Kalman>
+size_t stream_input(std::string nodeFilename, std::string filename, OutputWriter& output, SocSummary* summary = NULL,
+    typename Kalman::TraceRing* trace = NULL);
+
+// Convert a node's CSV data into a columnar telemetry file, returns the number of rows
+size_t convert_csv(std::string nodeFilename, std::string filename, std::string outputFilename);
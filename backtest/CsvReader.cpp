@@ -0,0 +1,148 @@
+#include "CsvReader.h"
+
+#include <fcntl.h>
+#include <stdexcept> // std::runtime_error
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+CsvReader::CsvReader(const std::string& filename) :
+    _data(NULL),
+    _cursor(NULL),
+    _end(NULL),
+    _size(0)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Could not open file");
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw std::runtime_error("Could not stat file");
+    }
+
+    _size = info.st_size;
+    if (_size > 0) {
+        void* mapping = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Could not map file");
+        }
+        // rows are consumed front to back exactly once
+        madvise(mapping, _size, MADV_SEQUENTIAL);
+        _data = (const char*)mapping;
+    }
+    close(fd);
+
+    _cursor = _data;
+    _end = _data + _size;
+}
+
+CsvReader::~CsvReader()
+{
+    if (_data != NULL) munmap((void*)_data, _size);
+}
+
+size_t CsvReader::size()
+{
+    return _size;
+}
+
+const char* CsvReader::findLineEnd(const char* start)
+{
+    const char* p = start;
+
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+
+    while (_end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+        if (mask != 0) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+
+    const char* found = (const char*)memchr(p, '\n', _end - p);
+    return (found != NULL) ? found : _end;
+}
+
+bool CsvReader::readHeader(std::vector<std::string>& names, const std::string& stopColumn)
+{
+    if (_cursor >= _end) return false;
+
+    const char* lineEnd = findLineEnd(_cursor);
+    const char* field = _cursor;
+
+    // Extract each column name
+    while (field < lineEnd) {
+        const char* fieldEnd = (const char*)memchr(field, ',', lineEnd - field);
+        if (fieldEnd == NULL) fieldEnd = lineEnd;
+
+        size_t length = fieldEnd - field;
+        if (length > 0 && field[length - 1] == '\r') length--;
+
+        std::string name(field, length);
+        if (name == stopColumn) break;
+        names.push_back(name);
+
+        field = fieldEnd + 1;
+    }
+
+    _cursor = (lineEnd < _end) ? lineEnd + 1 : _end;
+    return true;
+}
+
+int CsvReader::readRow(int32_t* values, int maxValues)
+{
+    const char* lineEnd;
+
+    // skip blank lines
+    do {
+        if (_cursor >= _end) return -1;
+        lineEnd = findLineEnd(_cursor);
+        if (lineEnd > _cursor && !(lineEnd - _cursor == 1 && *_cursor == '\r')) break;
+        _cursor = lineEnd + 1;
+    } while (true);
+
+    const char* p = _cursor;
+    int count = 0;
+
+    // Extract each integer in place, stop at the first field that is not one or is out of int32 range,
+    // like operator>> which also skips leading blanks and takes a plus sign
+    while (count < maxValues && p < lineEnd) {
+        while (p < lineEnd && (*p == ' ' || *p == '\t')) p++;
+
+        bool negative = false;
+        if (p < lineEnd && (*p == '-' || *p == '+')) {
+            negative = (*p == '-');
+            p++;
+        }
+
+        const char* digits = p;
+        int64_t value = 0;
+        int64_t limit = negative ? 2147483648LL : 2147483647LL;
+        while (p < lineEnd && (unsigned)(*p - '0') < 10 && value <= limit) {
+            value = value * 10 + (*p - '0');
+            p++;
+        }
+        if (p == digits || value > limit) break;
+
+        values[count++] = (int32_t)(negative ? -value : value);
+
+        // If the next token is a comma, skip it and move on
+        if (p < lineEnd && *p == ',') {
+            p++;
+        } else {
+            break;
+        }
+    }
+
+    _cursor = (lineEnd < _end) ? lineEnd + 1 : _end;
+    return count;
+}
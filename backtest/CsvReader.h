@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Read only, memory mapped CSV file of integer columns. Rows are parsed in place from the
+ * mapping without copying or allocating, line ends are located 16 bytes at a time with SSE2 where
+ * available.
+ */
+class CsvReader
+{
+  public:
+    /**
+     * @brief map a file, throws std::runtime_error if it cannot be opened or mapped
+     *
+     * @param filename
+     */
+    CsvReader(const std::string& filename);
+
+    ~CsvReader();
+
+    /**
+     * @brief read the next line as column names, stopping before the column named stopColumn
+     *
+     * @param names, stopColumn
+     *
+     * @return bool false at end of file
+     */
+    bool readHeader(std::vector<std::string>& names, const std::string& stopColumn);
+
+    /**
+     * @brief parse up to maxValues leading integers of the next non-empty line. A field may start with
+     * blanks and a sign, parsing stops at the first field that is not an integer in int32 range.
+     *
+     * @param values, maxValues
+     *
+     * @return int number of values parsed, -1 at end of file
+     */
+    int readRow(int32_t* values, int maxValues);
+
+    /**
+     * @brief return the size of the mapped file
+     *
+     * @return size_t bytes
+     */
+    size_t size();
+
+  private:
+    const char* _data;
+    const char* _cursor;
+    const char* _end;
+    size_t _size;
+
+    CsvReader(const CsvReader&);
+    CsvReader& operator=(const CsvReader&);
+
+    /**
+     * @brief return a pointer to the next '\n' at or after start, or _end
+     */
+    const char* findLineEnd(const char* start);
+};
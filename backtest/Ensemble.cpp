@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <string>
+#include <fstream>
+#include <vector>
+#include <cstdlib> // strtod, strtoul
+#include <memory> // std::unique_ptr
+#include <stdexcept> // std::runtime_error
+
+#include "CsvReader.h"
+#include "Ensemble.h"
+#include "OutputWriter.h"
+#include "SoCKalmanFleet.h"
+#include "TelemetryFile.h"
+
+static const int SENSOR_COLUMNS = 5;
+
+// The fleet and its per-configuration input arrays, every configuration sees the same row
+struct Ensemble {
+    SoCKalmanFleet fleet;
+    const std::vector<TuneConfig>& configs;
+    bool isBattery12V;
+    bool isBatteryLithium;
+    std::unique_ptr<bool[]> isBatteryInFloat;   // std::vector<bool> has no data()
+    std::vector<int32_t> batteryMilliAmps;
+    std::vector<uint32_t> batteryVoltage;
+    std::vector<int32_t> batteryMilliWatts;
+    std::vector<uint32_t> samplePeriodMilliSec;
+    std::vector<uint32_t> batteryCapacity;
+    std::vector<int32_t> row;   // sensor values followed by a soc per configuration
+    size_t rows;
+
+    Ensemble(const std::vector<TuneConfig>& configs, bool isBattery12V, bool isBatteryLithium) :
+        fleet(configs.size()),
+        configs(configs),
+        isBattery12V(isBattery12V),
+        isBatteryLithium(isBatteryLithium),
+        isBatteryInFloat(new bool[configs.size()]),
+        batteryMilliAmps(configs.size()),
+        batteryVoltage(configs.size()),
+        batteryMilliWatts(configs.size()),
+        samplePeriodMilliSec(configs.size()),
+        batteryCapacity(configs.size()),
+        row(SENSOR_COLUMNS + configs.size()),
+        rows(0)
+    {
+        for(size_t k = 0; k < configs.size(); ++k)
+        {
+            fleet.configure(k, configs[k].pval, configs[k].qval, configs[k].rval);
+            batteryCapacity[k] = configs[k].batteryCapacity;
+        }
+    }
+
+    // filter_row() for every configuration at once, writes the sensor values and socs to output
+    void filterRow(const int32_t* values, OutputWriter& output){
+        size_t k;
+
+        if(rows == 0) {
+            for(k = 0; k < configs.size(); ++k)
+                fleet.init(k, isBattery12V, isBatteryLithium, configs[k].batteryEff, values[3], INITIAL_SOC);
+        } else {
+            for(k = 0; k < configs.size(); ++k)
+            {
+                isBatteryInFloat[k] = (values[2] == 3);
+                batteryMilliAmps[k] = values[0];
+                batteryVoltage[k] = values[3];
+                batteryMilliWatts[k] = values[1];
+                samplePeriodMilliSec[k] = values[4];
+            }
+            fleet.sampleAll(isBatteryInFloat.get(), batteryMilliAmps.data(), batteryVoltage.data(), batteryMilliWatts.data(),
+                samplePeriodMilliSec.data(), batteryCapacity.data());
+        }
+
+        for(int colIdx = 0; colIdx < SENSOR_COLUMNS; ++colIdx) row[colIdx] = values[colIdx];
+        for(k = 0; k < configs.size(); ++k) row[SENSOR_COLUMNS + k] = fleet.read(k);
+        output.writeRow(row.data());
+        rows++;
+    }
+};
+
+std::vector<TuneConfig> read_configs(std::string filename){
+
+    std::ifstream myFile(filename);
+    if(!myFile.is_open()) throw std::runtime_error("Could not open configurations");
+
+    std::vector<TuneConfig> configs;
+    std::string line;
+
+    // Skip the header
+    std::getline(myFile, line);
+
+    while(std::getline(myFile, line))
+    {
+        if(!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+        if(line.empty() || line[0] == '#') continue;
+
+        const char* p = line.c_str();
+        char* end;
+        TuneConfig config;
+
+        config.pval = strtod(p, &end);
+        if(*end++ != ',') throw std::runtime_error("Configuration needs five values: " + line);
+        config.qval = strtod(end, &end);
+        if(*end++ != ',') throw std::runtime_error("Configuration needs five values: " + line);
+        config.rval = strtod(end, &end);
+        if(*end++ != ',') throw std::runtime_error("Configuration needs five values: " + line);
+        config.batteryEff = strtoul(end, &end, 10);
+        if(*end++ != ',') throw std::runtime_error("Configuration needs five values: " + line);
+        config.batteryCapacity = strtoul(end, &end, 10);
+        if(config.batteryCapacity == 0) throw std::runtime_error("Battery capacity must not be zero: " + line);
+
+        configs.push_back(config);
+    }
+
+    if(configs.empty()) throw std::runtime_error("No configurations in " + filename);
+    return configs;
+}
+
+size_t process_ensemble(std::string nodeFilename, std::string filename, const std::vector<TuneConfig>& configs, OutputWriter& output){
+
+    std::vector<std::string> colnames;
+    bool isTelemetry = TelemetryFile::isTelemetryFile(filename);
+    std::pair<int, int> batteryInfo;
+    std::unique_ptr<TelemetryReader> telemetry;
+    std::unique_ptr<CsvReader> csv;
+
+    // Battery info comes from the telemetry header or the node data file, like process_input
+    if(isTelemetry) {
+        telemetry.reset(new TelemetryReader(filename));
+        batteryInfo = std::make_pair(telemetry->isBatteryLithium(), telemetry->nominalVoltage());
+        colnames = telemetry->names();
+    } else {
+        batteryInfo = read_node_data(nodeFilename);
+        csv.reset(new CsvReader(filename));
+        csv->readHeader(colnames, "timestamp");
+    }
+    if(colnames.size() < (size_t)SENSOR_COLUMNS) throw std::runtime_error("Expected 5 sensor columns");
+
+    colnames.resize(SENSOR_COLUMNS);
+    for(size_t k = 0; k < configs.size(); ++k) colnames.push_back("kalman_soc_" + std::to_string(k));
+    output.begin(colnames, batteryInfo.first, batteryInfo.second);
+
+    Ensemble ensemble(configs, batteryInfo.second == 12, (bool)batteryInfo.first);
+
+    if(isTelemetry) {
+        // readRow fills every column of the input, which may have more than the output
+        std::vector<int32_t> values(telemetry->names().size());
+        while(telemetry->readRow(values.data())) ensemble.filterRow(values.data(), output);
+    } else {
+        int32_t values[SENSOR_COLUMNS];
+        int count;
+        while((count = csv->readRow(values, SENSOR_COLUMNS)) >= 0)
+        {
+            // skip rows that don't carry every sensor column, like process_csv
+            if(count < SENSOR_COLUMNS) continue;
+            ensemble.filterRow(values, output);
+        }
+    }
+    output.close();
+
+    return ensemble.rows;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Backtest.h"
+#include "Tuner.h"
+
+class OutputWriter;
+
+// Read filter configurations from a csv with one "pval,qval,rval,battery_eff,battery_capacity" line
+// per configuration after the header, the format --tune writes. Further columns are ignored.
+std::vector<TuneConfig> read_configs(std::string filename);
+
+// Run every configuration over a single pass of a node's input, csv or telemetry file. The filters
+// advance in lockstep as the nodes of one SoCKalmanFleet, so each configuration is a lane of the
+// vectorised kernels rather than a rerun. Results match SoCKalmanFloat configuration for
+// configuration. Streams the sensor columns followed by a kalman_soc_<k> column per configuration
+// into output, closes it and returns the number of rows.
+size_t process_ensemble(std::string nodeFilename, std::string filename, const std::vector<TuneConfig>& configs, OutputWriter& output);
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <string>
+#include <fstream>
+#include <vector>
+#include <algorithm> // std::sort
+#include <chrono> // std::chrono::steady_clock
+#include <stdexcept> // std::runtime_error
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "Backtest.h"
+#include "FleetBacktest.h"
+#include "OutputWriter.h"
+#include "ThreadPool.h"
+
+struct NodeTask : NodeFiles {
+    // filled in by the worker that runs the node
+    size_t rows;
+    int finalSoC;
+    int minSoC;
+    int maxSoC;
+    double seconds;
+    std::string error;
+};
+
+static bool is_directory(std::string path){
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+static bool is_file(std::string path){
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode);
+}
+
+static bool compare_name(const NodeFiles& a, const NodeFiles& b){
+    return a.name < b.name;
+}
+
+static std::vector<NodeFiles> list_directory(std::string directory){
+    // Every sub directory holding both input files is a node
+    std::vector<NodeFiles> tasks;
+
+    DIR* dir = opendir(directory.c_str());
+    if(dir == NULL) throw std::runtime_error("Could not open directory");
+
+    struct dirent* entry;
+    while((entry = readdir(dir)) != NULL)
+    {
+        std::string name(entry->d_name);
+        if(name == "." || name == "..") continue;
+
+        std::string path = directory + "/" + name;
+        if(!is_file(path + "/node_data.csv") || !is_file(path + "/raw_sensor_data.csv")) continue;
+
+        NodeFiles task;
+        task.name = name;
+        task.nodeFilename = path + "/node_data.csv";
+        task.inputFilename = path + "/raw_sensor_data.csv";
+        task.outputFilename = path + "/processed_sensor_data.csv";
+        tasks.push_back(task);
+    }
+    closedir(dir);
+
+    // readdir order is arbitrary, keep the summary stable between runs
+    std::sort(tasks.begin(), tasks.end(), compare_name);
+
+    return tasks;
+}
+
+// Relative manifest paths are relative to the manifest, so a fleet can be replayed from any directory
+static std::string resolve_path(std::string directory, std::string path){
+    if(directory.empty() || path.empty() || path[0] == '/') return path;
+    return directory + path;
+}
+
+static std::vector<NodeFiles> read_manifest(std::string filename){
+    // One "node_data,raw_sensor_data[,output]" line per node
+    std::vector<NodeFiles> tasks;
+    size_t slash = filename.rfind('/');
+    std::string directory = slash == std::string::npos ? "" : filename.substr(0, slash + 1);
+
+    std::ifstream myFile(filename);
+    if(!myFile.is_open()) throw std::runtime_error("Could not open manifest");
+
+    std::string line;
+    while(std::getline(myFile, line))
+    {
+        if(!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+        if(line.empty() || line[0] == '#') continue;
+
+        size_t first = line.find(',');
+        if(first == std::string::npos) throw std::runtime_error("Manifest line needs node and sensor files: " + line);
+        size_t second = line.find(',', first + 1);
+
+        NodeFiles task;
+        task.name = line.substr(first + 1, second == std::string::npos ? std::string::npos : second - first - 1);
+        task.nodeFilename = resolve_path(directory, line.substr(0, first));
+        task.inputFilename = resolve_path(directory, task.name);
+        if(second != std::string::npos) {
+            task.outputFilename = resolve_path(directory, line.substr(second + 1));
+        } else {
+            // default to <input>_processed.csv next to the input
+            std::string base = task.inputFilename;
+            if(base.size() > 4 && base.compare(base.size() - 4, 4, ".csv") == 0) base.erase(base.size() - 4);
+            task.outputFilename = base + "_processed.csv";
+        }
+        tasks.push_back(task);
+    }
+
+    return tasks;
+}
+
+std::vector<NodeFiles> list_nodes(std::string source){
+    return is_directory(source) ? list_directory(source) : read_manifest(source);
+}
+
+static void run_node(NodeTask* task){
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    try {
+        // rows go straight to the node's output, only the soc range is kept
+        OutputWriter output(task->outputFilename, OutputFormat::Csv);
+        SocSummary summary = { 0, 0, 0 };
+        task->rows = stream_input<SoCKalman>(task->nodeFilename, task->inputFilename, output, &summary);
+        task->finalSoC = summary.finalSoC;
+        task->minSoC = summary.minSoC;
+        task->maxSoC = summary.maxSoC;
+    } catch(const std::exception& e) {
+        task->error = e.what();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    task->seconds = elapsed.count();
+}
+
+int run_fleet(std::string source, size_t threads){
+
+    bool isDirectory = is_directory(source);
+    std::vector<NodeFiles> nodes = list_nodes(source);
+    std::string summaryFilename = isDirectory ? source + "/fleet_summary.csv" : source + ".summary.csv";
+
+    // One task per node, each with its own filter instance
+    std::vector<NodeTask> tasks(nodes.size());
+    for(size_t i = 0; i < nodes.size(); ++i) static_cast<NodeFiles&>(tasks[i]) = nodes[i];
+
+    ThreadPool pool(threads);
+    for(size_t i = 0; i < tasks.size(); ++i) pool.submit(std::bind(run_node, &tasks[i]));
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    pool.run();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    // Merge every node into a single summary, in input order
+    std::ofstream summary(summaryFilename);
+    summary << "node,rows,final_soc,min_soc,max_soc,seconds,error\n";
+
+    size_t rows = 0;
+    int failures = 0;
+    for(size_t i = 0; i < tasks.size(); ++i)
+    {
+        const NodeTask& task = tasks[i];
+        summary << task.name << "," << task.rows << "," << task.finalSoC << "," << task.minSoC << ","
+                << task.maxSoC << "," << task.seconds << "," << task.error << "\n";
+        rows += task.rows;
+        if(!task.error.empty()) {
+            fprintf(stderr, "%s: %s\n", task.name.c_str(), task.error.c_str());
+            failures++;
+        }
+    }
+    summary.close();
+
+    printf("Processed %zu nodes (%d failed), %zu rows in %.3f s on %zu threads (%.0f rows/s).\n", tasks.size(), failures, rows,
+        elapsed.count(), pool.size(), elapsed.count() > 0 ? rows / elapsed.count() : 0.0);
+    printf("Summary written to %s\n", summaryFilename.c_str());
+
+    return failures;
+}
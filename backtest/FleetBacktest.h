@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Input and output files of one node
+struct NodeFiles {
+    std::string name;
+    std::string nodeFilename;
+    std::string inputFilename;
+    std::string outputFilename;
+};
+
+// List the nodes of a fleet directory or manifest, see run_fleet
+std::vector<NodeFiles> list_nodes(std::string source);
+
+// Replay every node listed by source on a work stealing thread pool, one filter per node.
+// source is either a directory with one sub directory per node, each holding node_data.csv
+// and raw_sensor_data.csv, or a manifest file with one "node_data,raw_sensor_data[,output]"
+// line per node where relative paths are relative to the manifest's directory. Writes each
+// node's processed csv plus a merged fleet summary csv. Returns the number of nodes that failed.
+int run_fleet(std::string source, size_t threads);
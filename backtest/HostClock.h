@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono> // std::chrono::steady_clock
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> // __rdtsc
+#endif
+
+// Host tick sources for SoCKalmanClock, truncated to 32 bits since the filter only uses differences
+
+// Cycle counter where the architecture has one readable from user space, steady_clock otherwise
+inline uint32_t host_cycles(){
+#if defined(__x86_64__) || defined(__i386__)
+    return (uint32_t)__rdtsc();
+#elif defined(__aarch64__)
+    uint64_t value;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+    return (uint32_t)value;
+#else
+    return (uint32_t)std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// Nanoseconds of steady_clock
+inline uint32_t host_nanoseconds(){
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,95 @@
+#include "OutputWriter.h"
+
+#include <charconv> // std::to_chars
+#include <stdexcept> // std::runtime_error
+#include <string.h>
+
+static const size_t MAX_VALUE_SIZE = 12;   // "-2147483648,"
+
+OutputWriter::OutputWriter(const std::string& filename, OutputFormat format) :
+    _filename(filename),
+    _format(format),
+    _file(NULL),
+    _used(0),
+    _columns(0),
+    _rows(0),
+    _failed(false)
+{}
+
+OutputWriter::~OutputWriter()
+{
+    // errors can't be thrown from here, call close() to see them
+    try {
+        close();
+    } catch (const std::exception&) {
+    }
+}
+
+void OutputWriter::begin(const std::vector<std::string>& names, int32_t isBatteryLithium, int32_t nominalVoltage)
+{
+    _columns = names.size();
+
+    if (_format == OutputFormat::Telemetry) {
+        _telemetry.reset(new TelemetryWriter(_filename, names, isBatteryLithium, nominalVoltage));
+        return;
+    }
+
+    _file = fopen(_filename.c_str(), "wb");
+    if (_file == NULL) throw std::runtime_error("Could not create file " + _filename);
+    _buffer.resize(BUFFER_SIZE > _columns * MAX_VALUE_SIZE ? BUFFER_SIZE : _columns * MAX_VALUE_SIZE);
+
+    for (size_t j = 0; j < names.size(); j++) {
+        if (_used + names[j].size() + 1 > _buffer.size()) flush();
+        memcpy(&_buffer[_used], names[j].data(), names[j].size());
+        _used += names[j].size();
+        _buffer[_used++] = (j + 1 < names.size()) ? ',' : '\n';
+    }
+}
+
+void OutputWriter::writeRow(const int32_t* values)
+{
+    _rows++;
+
+    if (_telemetry) {
+        _telemetry->writeRow(values);
+        return;
+    }
+
+    // room for the widest row, so the values themselves need no bounds checks
+    if (_used + _columns * MAX_VALUE_SIZE > _buffer.size()) flush();
+
+    char* p = &_buffer[_used];
+    char* end = &_buffer[0] + _buffer.size();
+    for (size_t j = 0; j < _columns; j++) {
+        p = std::to_chars(p, end, values[j]).ptr;
+        *p++ = ',';
+    }
+    p[-1] = '\n';   // no comma at end of line
+    _used = p - &_buffer[0];
+}
+
+void OutputWriter::flush()
+{
+    if (_used > 0 && fwrite(&_buffer[0], 1, _used, _file) != _used) _failed = true;
+    _used = 0;
+}
+
+void OutputWriter::close()
+{
+    if (_telemetry) {
+        _telemetry->close();
+        _telemetry.reset();
+    }
+
+    if (_file == NULL) return;
+
+    flush();
+    if (fclose(_file) != 0) _failed = true;
+    _file = NULL;
+    if (_failed) throw std::runtime_error("Could not write file " + _filename);
+}
+
+uint64_t OutputWriter::rows()
+{
+    return _rows;
+}
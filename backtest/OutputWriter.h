@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "TelemetryFile.h"
+
+enum class OutputFormat {
+    Csv,
+    Telemetry
+};
+
+/**
+ * @brief Streams result rows into a csv or telemetry file as they are produced, so memory stays the
+ * same whatever the length of the input. Csv rows are formatted with std::to_chars into a buffer of
+ * BUFFER_SIZE bytes that is written out in one piece when full. Telemetry output can be replayed
+ * with --input like a converted file, its battery info comes from begin().
+ */
+class OutputWriter
+{
+  public:
+    static const size_t BUFFER_SIZE = 1 << 20;
+
+    /**
+     * @brief nothing is created until begin()
+     *
+     * @param filename, format
+     */
+    OutputWriter(const std::string& filename, OutputFormat format);
+
+    ~OutputWriter();
+
+    /**
+     * @brief create the file and write the column names, throws std::runtime_error if it cannot be written
+     *
+     * @param names, isBatteryLithium, nominalVoltage
+     */
+    void begin(const std::vector<std::string>& names, int32_t isBatteryLithium, int32_t nominalVoltage);
+
+    /**
+     * @brief append a row holding one value per column
+     *
+     * @param values
+     */
+    void writeRow(const int32_t* values);
+
+    /**
+     * @brief flush and close the file, called by the destructor if needed. Throws std::runtime_error
+     * if the output could not be written completely
+     */
+    void close();
+
+    uint64_t rows();
+
+  private:
+    std::string _filename;
+    OutputFormat _format;
+    FILE* _file;
+    std::unique_ptr<TelemetryWriter> _telemetry;
+    std::vector<char> _buffer;
+    size_t _used;
+    size_t _columns;
+    uint64_t _rows;
+    bool _failed;
+
+    OutputWriter(const OutputWriter&);
+    OutputWriter& operator=(const OutputWriter&);
+
+    void flush();
+};
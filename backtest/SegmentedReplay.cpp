@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <chrono> // std::chrono::steady_clock
+#include <cstdlib> // std::abs
+#include <functional> // std::bind
+#include <stdexcept> // std::runtime_error
+
+#include "Backtest.h"
+#include "CsvReader.h"
+#include "SegmentedReplay.h"
+#include "TelemetryFile.h"
+#include "ThreadPool.h"
+
+static const int SENSOR_COLUMNS = 5;
+
+// One node's rows in memory, segments need random access to them
+struct Series {
+    std::vector<std::string> names;
+    int32_t isBatteryLithium;
+    int32_t nominalVoltage;
+    std::vector<int32_t> sensors;   // SENSOR_COLUMNS values per row
+    size_t rows;
+};
+
+// Seam statistics of one warm-up length
+struct SeamReport {
+    size_t warmup;
+    int maxError;
+    double meanError;
+    size_t settleRows;   // rows past a seam until the error stays within threshold, worst seam
+    double seconds;
+};
+
+// Only the sensor columns are loaded, the soc is computed by the timed sequential pass
+static void load_series(std::string nodeFilename, std::string filename, Series& series){
+
+    if(TelemetryFile::isTelemetryFile(filename)) {
+        TelemetryReader reader(filename);
+        series.isBatteryLithium = reader.isBatteryLithium();
+        series.nominalVoltage = reader.nominalVoltage();
+        series.names = reader.names();
+        if(series.names.size() < (size_t)SENSOR_COLUMNS) throw std::runtime_error("Expected 5 sensor columns");
+
+        std::vector<int32_t> values(series.names.size());
+        series.sensors.reserve(reader.rows() * SENSOR_COLUMNS);
+        while(reader.readRow(values.data())) series.sensors.insert(series.sensors.end(), values.begin(), values.begin() + SENSOR_COLUMNS);
+    } else {
+        std::pair<int, int> batteryInfo = read_node_data(nodeFilename);
+        series.isBatteryLithium = batteryInfo.first;
+        series.nominalVoltage = batteryInfo.second;
+
+        CsvReader reader(filename);
+        reader.readHeader(series.names, "timestamp");
+        if(series.names.size() != (size_t)SENSOR_COLUMNS) throw std::runtime_error("Expected 5 sensor columns before timestamp");
+
+        int32_t values[SENSOR_COLUMNS];
+        int count;
+        while((count = reader.readRow(values, SENSOR_COLUMNS)) >= 0)
+        {
+            // skip rows that don't carry every sensor column, like process_csv
+            if(count < SENSOR_COLUMNS) continue;
+            series.sensors.insert(series.sensors.end(), values, values + SENSOR_COLUMNS);
+        }
+    }
+
+    series.rows = series.sensors.size() / SENSOR_COLUMNS;
+    series.names.resize(SENSOR_COLUMNS);
+    series.names.push_back("kalman_soc");
+}
+
+// Filter rows [first, end) of a series with a fresh filter, keeping the soc of rows from keep on
+static void replay_range(const Series* series, size_t first, size_t keep, size_t end, int32_t* soc){
+    SoCKalman kalman;
+    bool isBattery12V = (series->nominalVoltage == 12);
+
+    for(size_t i = first; i < end; ++i)
+    {
+        int32_t value = filter_row(kalman, &series->sensors[i * SENSOR_COLUMNS], i == first, isBattery12V, (bool)series->isBatteryLithium);
+        if(i >= keep) soc[i] = value;
+    }
+}
+
+static SeamReport replay_segments(const Series& series, const std::vector<int32_t>& reference, size_t segments, size_t warmup,
+    uint32_t threshold, size_t threads, std::vector<int32_t>& soc){
+
+    SeamReport report = { warmup, 0, 0, 0, 0 };
+    std::vector<size_t> bounds;
+
+    for(size_t s = 0; s <= segments; ++s) bounds.push_back(series.rows * s / segments);
+    soc.assign(series.rows, 0);
+
+    ThreadPool pool(threads);
+    for(size_t s = 0; s < segments; ++s)
+    {
+        size_t first = bounds[s] > warmup ? bounds[s] - warmup : 0;
+        pool.submit(std::bind(replay_range, &series, first, bounds[s], bounds[s + 1], soc.data()));
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    pool.run();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    report.seconds = elapsed.count();
+
+    // The first segment starts where the sequential replay does, every other one starts at a seam, so
+    // the error statistics only cover the rows from the first seam on
+    double sumErrors = 0;
+    for(size_t s = 1; s < segments; ++s)
+    {
+        size_t settled = bounds[s];
+        for(size_t i = bounds[s]; i < bounds[s + 1]; ++i)
+        {
+            int error = std::abs(soc[i] - reference[i]);
+            if(error > report.maxError) report.maxError = error;
+            if((uint32_t)error > threshold) settled = i + 1;
+            sumErrors += error;
+        }
+        if(settled - bounds[s] > report.settleRows) report.settleRows = settled - bounds[s];
+    }
+    report.meanError = series.rows > bounds[1] ? sumErrors / (series.rows - bounds[1]) : 0;
+
+    return report;
+}
+
+int run_segmented(std::string nodeFilename, std::string filename, const SegmentOptions& options){
+
+    Series series;
+    load_series(nodeFilename, filename, series);
+
+    size_t threads = ThreadPool(options.threads).size();
+    size_t segments = options.segments > 0 ? options.segments : threads;
+    if(segments > series.rows) segments = series.rows > 0 ? series.rows : 1;
+
+    // The sequential replay is both the reference and the time to beat
+    std::vector<int32_t> reference(series.rows);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    replay_range(&series, 0, 0, series.rows, reference.data());
+    std::chrono::duration<double> sequential = std::chrono::steady_clock::now() - start;
+
+    printf("Replaying %zu rows in %zu segments on %zu threads, sequential replay %.3f s.\n", series.rows, segments, threads, sequential.count());
+    printf("  warm-up rows   max error   mean error   settle rows   seconds   speedup\n");
+
+    std::vector<int32_t> soc;
+    std::vector<int32_t> best;
+    size_t bestWarmup = 0;
+    bool found = false;
+
+    for(size_t w = 0; w < options.warmups.size(); ++w)
+    {
+        SeamReport report = replay_segments(series, reference, segments, options.warmups[w], options.threshold, options.threads, soc);
+        printf("  %12zu   %9d   %10.1f   %11zu   %7.3f   %6.2fx\n", report.warmup, report.maxError, report.meanError, report.settleRows,
+            report.seconds, report.seconds > 0 ? sequential.count() / report.seconds : 0.0);
+
+        // keep the shortest warm-up within threshold, or the longest while none is
+        bool within = (uint32_t)report.maxError <= options.threshold;
+        if(within && (!found || report.warmup < bestWarmup)) {
+            best.swap(soc);
+            bestWarmup = report.warmup;
+            found = true;
+        } else if(!found && (best.empty() || report.warmup > bestWarmup)) {
+            best.swap(soc);
+            bestWarmup = report.warmup;
+        }
+    }
+
+    if(found) {
+        printf("Shortest warm-up within %u: %zu rows.\n", options.threshold, bestWarmup);
+    } else {
+        printf("No warm-up kept the error within %u, the longest is %zu rows.\n", options.threshold, bestWarmup);
+    }
+
+    if(!options.outputFilename.empty() && !best.empty()) {
+        OutputWriter output(options.outputFilename, options.outputFormat);
+        int32_t values[SENSOR_COLUMNS + 1];
+
+        output.begin(series.names, series.isBatteryLithium, series.nominalVoltage);
+        for(size_t i = 0; i < series.rows; ++i)
+        {
+            for(int colIdx = 0; colIdx < SENSOR_COLUMNS; ++colIdx) values[colIdx] = series.sensors[i * SENSOR_COLUMNS + colIdx];
+            values[SENSOR_COLUMNS] = best[i];
+            output.writeRow(values);
+        }
+        output.close();
+        printf("Stitched result with %zu warm-up rows written to %s\n", bestWarmup, options.outputFilename.c_str());
+    }
+
+    return found ? 0 : 1;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "OutputWriter.h"
+
+// Options of a segmented replay
+struct SegmentOptions {
+    size_t segments;               // zero means one per worker thread
+    std::vector<size_t> warmups;   // warm-up lengths in rows to measure, each a full parallel replay
+    uint32_t threshold;            // largest acceptable soc error at the seams, 100% = 100000
+    size_t threads;                // zero means one per hardware thread
+    std::string outputFilename;    // stitched result, skipped when empty
+    OutputFormat outputFormat;
+};
+
+// Replay one long series in parallel by splitting it into segments of consecutive rows. Each segment
+// starts a fresh filter, initialised with init() from the voltage of the row warm-up rows ahead of its
+// boundary, and only its rows from the boundary on are kept. The true state at a boundary is only
+// known after a sequential replay up to it, which is why segments warm up rather than take it over.
+// For every warm-up length the stitched soc is compared against a sequential replay: the largest and
+// mean error after the seams, and how many rows past a seam the error stays above threshold. The
+// shortest warm-up whose error stays within threshold is recommended and, with outputFilename, its
+// stitched result written out like the default mode. Returns 0 on success.
+int run_segmented(std::string nodeFilename, std::string filename, const SegmentOptions& options);
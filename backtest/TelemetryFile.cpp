@@ -0,0 +1,274 @@
+#include "TelemetryFile.h"
+
+#include <fcntl.h>
+#include <stdexcept> // std::runtime_error
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char MAGIC[8] = { 'K', 'S', 'O', 'C', 'T', 'E', 'L', '1' };
+static const size_t FIXED_HEADER_SIZE = 8 + 2 + 2 + 4 + 4 + 8;
+static const size_t ROWS_OFFSET = 8 + 2 + 2 + 4 + 4;
+
+static void put16(uint8_t* p, uint16_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static void put32(uint8_t* p, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = value >> (8 * i);
+}
+
+static void put64(uint8_t* p, uint64_t value)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = value >> (8 * i);
+}
+
+static uint16_t get16(const uint8_t* p)
+{
+    return p[0] | (uint16_t)p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get64(const uint8_t* p)
+{
+    return get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+bool TelemetryFile::isTelemetryFile(const std::string& filename)
+{
+    char magic[sizeof(MAGIC)];
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == NULL) return false;
+
+    bool matches = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+    fclose(file);
+    return matches;
+}
+
+TelemetryWriter::TelemetryWriter(const std::string& filename, const std::vector<std::string>& names, int32_t isBatteryLithium, int32_t nominalVoltage) :
+    _filename(filename),
+    _file(fopen(filename.c_str(), "wb")),
+    _columns(names.size()),
+    _rows(0),
+    _blockRows(0),
+    _previous(names.size(), 0),
+    _encoded(names.size()),
+    _failed(false)
+{
+    if (_file == NULL) throw std::runtime_error("Could not create file");
+
+    std::vector<uint8_t> header(FIXED_HEADER_SIZE + _columns * TelemetryFile::NAME_SIZE, 0);
+    memcpy(&header[0], MAGIC, sizeof(MAGIC));
+    put16(&header[8], TelemetryFile::VERSION);
+    put16(&header[10], _columns);
+    put32(&header[12], isBatteryLithium);
+    put32(&header[16], nominalVoltage);
+    // rows are patched in by close()
+    for (size_t i = 0; i < names.size(); i++)
+        strncpy((char*)&header[FIXED_HEADER_SIZE + i * TelemetryFile::NAME_SIZE], names[i].c_str(), TelemetryFile::NAME_SIZE - 1);
+
+    if (fwrite(&header[0], 1, header.size(), _file) != header.size()) {
+        fclose(_file);
+        _file = NULL;
+        throw std::runtime_error("Could not write file " + filename);
+    }
+
+    for (size_t i = 0; i < _encoded.size(); i++)
+        _encoded[i].reserve(TelemetryFile::BLOCK_ROWS * 2);
+}
+
+TelemetryWriter::~TelemetryWriter()
+{
+    // errors can't be thrown from here, call close() to see them
+    try {
+        close();
+    } catch (const std::exception&) {
+    }
+}
+
+void TelemetryWriter::writeRow(const int32_t* values)
+{
+    for (uint16_t i = 0; i < _columns; i++) {
+        // zigzag maps small negative and positive deltas to small unsigned values
+        int32_t delta = (int32_t)((uint32_t)values[i] - (uint32_t)_previous[i]);
+        uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+        _previous[i] = values[i];
+
+        std::vector<uint8_t>& out = _encoded[i];
+        while (zigzag >= 0x80) {
+            out.push_back((uint8_t)(zigzag | 0x80));
+            zigzag >>= 7;
+        }
+        out.push_back((uint8_t)zigzag);
+    }
+
+    _rows++;
+    if (++_blockRows == TelemetryFile::BLOCK_ROWS) flushBlock();
+}
+
+void TelemetryWriter::flushBlock()
+{
+    uint8_t length[4];
+
+    if (_blockRows == 0) return;
+
+    put32(length, _blockRows);
+    if (fwrite(length, 1, sizeof(length), _file) != sizeof(length)) _failed = true;
+
+    for (uint16_t i = 0; i < _columns; i++) {
+        put32(length, _encoded[i].size());
+        if (fwrite(length, 1, sizeof(length), _file) != sizeof(length)) _failed = true;
+        if (fwrite(_encoded[i].data(), 1, _encoded[i].size(), _file) != _encoded[i].size()) _failed = true;
+        _encoded[i].clear();
+        _previous[i] = 0;
+    }
+
+    _blockRows = 0;
+}
+
+void TelemetryWriter::close()
+{
+    uint8_t rows[8];
+
+    if (_file == NULL) return;
+
+    flushBlock();
+
+    put64(rows, _rows);
+    if (fseek(_file, ROWS_OFFSET, SEEK_SET) != 0 || fwrite(rows, 1, sizeof(rows), _file) != sizeof(rows)) _failed = true;
+
+    if (fclose(_file) != 0) _failed = true;
+    _file = NULL;
+    if (_failed) throw std::runtime_error("Could not write file " + _filename);
+}
+
+TelemetryReader::TelemetryReader(const std::string& filename) :
+    _data(NULL),
+    _size(0),
+    _next(NULL),
+    _rows(0),
+    _isBatteryLithium(0),
+    _nominalVoltage(0),
+    _blockRowsLeft(0)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Could not open file");
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < FIXED_HEADER_SIZE) {
+        close(fd);
+        throw std::runtime_error("Not a telemetry file");
+    }
+
+    _size = info.st_size;
+    void* mapping = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) throw std::runtime_error("Could not map file");
+    madvise(mapping, _size, MADV_SEQUENTIAL);
+    _data = (const uint8_t*)mapping;
+
+    uint16_t columns = get16(_data + 10);
+    size_t headerSize = FIXED_HEADER_SIZE + columns * TelemetryFile::NAME_SIZE;
+    if (memcmp(_data, MAGIC, sizeof(MAGIC)) != 0 || get16(_data + 8) != TelemetryFile::VERSION || _size < headerSize) {
+        munmap(mapping, _size);
+        throw std::runtime_error("Not a telemetry file");
+    }
+
+    _isBatteryLithium = (int32_t)get32(_data + 12);
+    _nominalVoltage = (int32_t)get32(_data + 16);
+    _rows = get64(_data + ROWS_OFFSET);
+
+    for (uint16_t i = 0; i < columns; i++) {
+        const char* name = (const char*)_data + FIXED_HEADER_SIZE + i * TelemetryFile::NAME_SIZE;
+        _names.push_back(std::string(name, strnlen(name, TelemetryFile::NAME_SIZE)));
+    }
+
+    _next = _data + headerSize;
+    _cursor.resize(columns);
+    _end.resize(columns);
+    _previous.resize(columns);
+}
+
+TelemetryReader::~TelemetryReader()
+{
+    munmap((void*)_data, _size);
+}
+
+const std::vector<std::string>& TelemetryReader::names()
+{
+    return _names;
+}
+
+uint64_t TelemetryReader::rows()
+{
+    return _rows;
+}
+
+int32_t TelemetryReader::isBatteryLithium()
+{
+    return _isBatteryLithium;
+}
+
+int32_t TelemetryReader::nominalVoltage()
+{
+    return _nominalVoltage;
+}
+
+bool TelemetryReader::nextBlock()
+{
+    const uint8_t* end = _data + _size;
+
+    if (end - _next < 4) return false;
+    _blockRowsLeft = get32(_next);
+    _next += 4;
+
+    for (size_t i = 0; i < _cursor.size(); i++) {
+        if (end - _next < 4) throw std::runtime_error("Truncated telemetry block");
+        uint32_t bytes = get32(_next);
+        _next += 4;
+        if ((size_t)(end - _next) < bytes) throw std::runtime_error("Truncated telemetry block");
+
+        _cursor[i] = _next;
+        _end[i] = _next + bytes;
+        _previous[i] = 0;
+        _next += bytes;
+    }
+
+    return true;
+}
+
+bool TelemetryReader::readRow(int32_t* values)
+{
+    while (_blockRowsLeft == 0)
+        if (!nextBlock()) return false;
+
+    for (size_t i = 0; i < _cursor.size(); i++) {
+        const uint8_t* p = _cursor[i];
+        uint32_t zigzag = 0;
+        int shift = 0;
+
+        do {
+            if (p >= _end[i] || shift > 28) throw std::runtime_error("Corrupt telemetry column");
+            zigzag |= (uint32_t)(*p & 0x7F) << shift;
+            shift += 7;
+        } while (*p++ & 0x80);
+
+        int32_t delta = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+        _previous[i] = (int32_t)((uint32_t)_previous[i] + (uint32_t)delta);
+        values[i] = _previous[i];
+        _cursor[i] = p;
+    }
+
+    _blockRowsLeft--;
+    return true;
+}
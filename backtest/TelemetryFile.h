@@ -0,0 +1,130 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/**
+ * Columnar binary telemetry file, all integers little endian:
+ *
+ *   header   magic "KSOCTEL1", uint16 version, uint16 columns, int32 isBatteryLithium,
+ *            int32 nominalVoltage, uint64 rows, then a 32 byte zero padded name per column
+ *   blocks   uint32 rows, then for every column uint32 bytes followed by the column's values
+ *
+ * Within a block each column stores the difference to the previous value (the first value of a
+ * block is relative to zero) as a zigzag varint, so slowly changing sensor readings take one or
+ * two bytes. Blocks decode independently of each other.
+ */
+class TelemetryFile
+{
+  public:
+    static const uint16_t VERSION = 1;
+    static const uint32_t NAME_SIZE = 32;
+    static const uint32_t BLOCK_ROWS = 65536;
+
+    /**
+     * @brief check whether a file starts with the telemetry magic
+     *
+     * @param filename
+     *
+     * @return bool
+     */
+    static bool isTelemetryFile(const std::string& filename);
+};
+
+/**
+ * @brief Streams rows into a telemetry file, one block of encoded columns is held in memory
+ */
+class TelemetryWriter
+{
+  public:
+    /**
+     * @brief create a file, throws std::runtime_error if it cannot be written
+     *
+     * @param filename, names, isBatteryLithium, nominalVoltage
+     */
+    TelemetryWriter(const std::string& filename, const std::vector<std::string>& names, int32_t isBatteryLithium, int32_t nominalVoltage);
+
+    ~TelemetryWriter();
+
+    /**
+     * @brief append a row holding one value per column
+     *
+     * @param values
+     */
+    void writeRow(const int32_t* values);
+
+    /**
+     * @brief flush the last block and finalise the header, called by the destructor if needed. Throws
+     * std::runtime_error if the file could not be written completely
+     */
+    void close();
+
+  private:
+    std::string _filename;
+    FILE* _file;
+    uint16_t _columns;
+    uint64_t _rows;
+    uint32_t _blockRows;
+    std::vector<int32_t> _previous;
+    std::vector<std::vector<uint8_t> > _encoded;
+    bool _failed;
+
+    TelemetryWriter(const TelemetryWriter&);
+    TelemetryWriter& operator=(const TelemetryWriter&);
+
+    void flushBlock();
+};
+
+/**
+ * @brief Memory maps a telemetry file and decodes rows straight from the mapping
+ */
+class TelemetryReader
+{
+  public:
+    /**
+     * @brief map a file, throws std::runtime_error if it cannot be opened or is not a telemetry file
+     *
+     * @param filename
+     */
+    TelemetryReader(const std::string& filename);
+
+    ~TelemetryReader();
+
+    const std::vector<std::string>& names();
+
+    uint64_t rows();
+
+    int32_t isBatteryLithium();
+
+    int32_t nominalVoltage();
+
+    /**
+     * @brief decode the next row, values must hold one entry per column
+     *
+     * @param values
+     *
+     * @return bool false after the last row
+     */
+    bool readRow(int32_t* values);
+
+  private:
+    const uint8_t* _data;
+    size_t _size;
+    const uint8_t* _next;   // start of the next block
+    std::vector<std::string> _names;
+    uint64_t _rows;
+    int32_t _isBatteryLithium;
+    int32_t _nominalVoltage;
+    uint32_t _blockRowsLeft;
+    std::vector<const uint8_t*> _cursor;
+    std::vector<const uint8_t*> _end;
+    std::vector<int32_t> _previous;
+
+    TelemetryReader(const TelemetryReader&);
+    TelemetryReader& operator=(const TelemetryReader&);
+
+    bool nextBlock();
+};
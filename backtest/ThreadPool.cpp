@@ -0,0 +1,71 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(size_t threads) :
+    _queues(threads > 0 ? threads : (std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1)),
+    _next(0)
+{}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    Queue& queue = _queues[_next];
+    _next = (_next + 1) % _queues.size();
+
+    std::lock_guard<std::mutex> guard(queue.lock);
+    queue.tasks.push_back(task);
+}
+
+void ThreadPool::run()
+{
+    std::vector<std::thread> workers;
+    size_t i;
+
+    // the calling thread is worker 0
+    for (i = 1; i < _queues.size(); i++)
+        workers.push_back(std::thread(&ThreadPool::work, this, i));
+
+    work(0);
+
+    for (i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
+
+size_t ThreadPool::size()
+{
+    return _queues.size();
+}
+
+bool ThreadPool::take(size_t worker, std::function<void()>& task)
+{
+    size_t i;
+
+    {
+        Queue& own = _queues[worker];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    // no tasks are added while running, so once a full sweep finds nothing we are done
+    for (i = 1; i < _queues.size(); i++) {
+        Queue& victim = _queues[(worker + i) % _queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::work(size_t worker)
+{
+    std::function<void()> task;
+
+    while (take(worker, task))
+        task();
+}
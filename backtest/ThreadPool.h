@@ -0,0 +1,61 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stddef.h>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Work stealing pool for a known batch of independent tasks. Tasks are dealt round robin onto
+ * one queue per worker, each worker drains its own queue from the back and, once empty, steals from
+ * the front of the others, so uneven task lengths still keep every core busy.
+ */
+class ThreadPool
+{
+  public:
+    /**
+     * @brief create a pool, zero threads means one per hardware thread
+     *
+     * @param threads
+     */
+    ThreadPool(size_t threads);
+
+    /**
+     * @brief queue a task, tasks only start running in run()
+     *
+     * @param task
+     */
+    void submit(std::function<void()> task);
+
+    /**
+     * @brief run every queued task and block until all have finished
+     */
+    void run();
+
+    /**
+     * @brief return the number of worker threads
+     *
+     * @return size_t threads
+     */
+    size_t size();
+
+  private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<std::function<void()> > tasks;
+    };
+
+    std::vector<Queue> _queues;
+    size_t _next;
+
+    /**
+     * @brief take a task from worker's own queue, or steal one from another worker
+     *
+     * @return bool false once every queue is empty
+     */
+    bool take(size_t worker, std::function<void()>& task);
+
+    void work(size_t worker);
+};
@@ -0,0 +1,141 @@
+#include "TraceFile.h"
+
+#include <chrono> // std::chrono::microseconds
+#include <stdexcept> // std::runtime_error
+#include <string.h>
+
+static const char MAGIC[8] = { 'K', 'S', 'O', 'C', 'T', 'R', 'C', '1' };
+static const size_t HEADER_SIZE = 8 + 2 + 1 + 1 + 8 + 4;
+static const size_t RECORDS_OFFSET = 8 + 2 + 1 + 1;
+static const size_t BUFFER_SIZE = 1 << 20;
+
+static uint8_t* put32(uint8_t* p, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = value >> (8 * i);
+    return p + 4;
+}
+
+static void put64(uint8_t* p, uint64_t value)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = value >> (8 * i);
+}
+
+TraceWriter::TraceWriter(const std::string& filename, uint8_t scalarFormat, uint32_t ringSize) :
+    _filename(filename),
+    _file(fopen(filename.c_str(), "wb")),
+    _storage(ringSize),
+    _ring(_storage.data(), ringSize),
+    _records(0),
+    _stopping(false),
+    _failed(false)
+{
+    if (_file == NULL) throw std::runtime_error("Could not create file");
+    if (ringSize == 0 || (ringSize & (ringSize - 1)) != 0) {
+        fclose(_file);
+        throw std::runtime_error("Trace ring size must be a power of two");
+    }
+
+    uint8_t header[HEADER_SIZE] = {};
+    memcpy(header, MAGIC, sizeof(MAGIC));
+    header[8] = TraceFile::VERSION;
+    header[9] = TraceFile::VERSION >> 8;
+    header[10] = 3;
+    header[11] = scalarFormat;
+    // records and dropped are patched in by close()
+    if (fwrite(header, 1, sizeof(header), _file) != sizeof(header)) {
+        fclose(_file);
+        _file = NULL;
+        throw std::runtime_error("Could not write file " + filename);
+    }
+
+    _buffer.reserve(BUFFER_SIZE);
+    _thread = std::thread(&TraceWriter::drain, this);
+}
+
+TraceWriter::~TraceWriter()
+{
+    // errors can't be thrown from here, call close() to see them
+    try {
+        close();
+    } catch (const std::exception&) {
+    }
+}
+
+SoCKalmanTraceRing<TraceWriter::Record>& TraceWriter::ring()
+{
+    return _ring;
+}
+
+uint64_t TraceWriter::records() const
+{
+    return _records;
+}
+
+uint32_t TraceWriter::dropped() const
+{
+    return _ring.dropped();
+}
+
+void TraceWriter::drain()
+{
+    Record record;
+
+    for (;;) {
+        // read the flag before emptying the ring, so records pushed before close() are never missed
+        bool stopping = _stopping.load(std::memory_order_acquire);
+        bool any = false;
+
+        while (_ring.pop(record)) {
+            write(record);
+            any = true;
+        }
+        if (stopping) break;
+        if (!any) std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    flush();
+}
+
+void TraceWriter::write(const Record& record)
+{
+    uint8_t bytes[sizeof(Record)];
+    uint8_t* p = put32(bytes, record.sample);
+
+    p = put32(p, record.flags);
+    p = put32(p, record.batteryEff);
+    for (int i = 0; i < 3; i++)
+        p = put32(p, (uint32_t)record.x[i]);
+    p = put32(p, record.h);
+    for (int i = 0; i < 3; i++)
+        p = put32(p, record.H[i]);
+    for (int i = 0; i < 3; i++)
+        p = put32(p, record.G[i]);
+
+    if (_buffer.size() + (p - bytes) > BUFFER_SIZE) flush();
+    _buffer.insert(_buffer.end(), bytes, p);
+    _records++;
+}
+
+void TraceWriter::flush()
+{
+    if (!_buffer.empty() && fwrite(_buffer.data(), 1, _buffer.size(), _file) != _buffer.size()) _failed = true;
+    _buffer.clear();
+}
+
+void TraceWriter::close()
+{
+    uint8_t counts[12];
+
+    if (_file == NULL) return;
+
+    _stopping.store(true, std::memory_order_release);
+    _thread.join();
+
+    put64(counts, _records);
+    put32(counts + 8, _ring.dropped());
+    if (fseek(_file, RECORDS_OFFSET, SEEK_SET) != 0 || fwrite(counts, 1, sizeof(counts), _file) != sizeof(counts)) _failed = true;
+    if (fclose(_file) != 0) _failed = true;
+    _file = NULL;
+    if (_failed) throw std::runtime_error("Could not write file " + _filename);
+}
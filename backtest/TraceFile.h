@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SoCKalman.h"
+
+/**
+ * Binary per-sample trace of one filter, all integers little endian:
+ *
+ *   header   magic "KSOCTRC1", uint16 version, uint8 states, uint8 scalar format (0 float, otherwise
+ *            the Q format fraction bits), uint64 records, uint32 dropped records
+ *   records  uint32 sample, uint32 flags, uint32 batteryEff, int32 x[states], then h, H[states] and
+ *            G[states] as 32 bit scalar patterns, see SoCKalmanTraceRecord
+ */
+class TraceFile
+{
+  public:
+    static const uint16_t VERSION = 1;
+};
+
+inline uint8_t trace_scalar_format(float){
+    return 0;
+}
+
+template <uint8_t FracBits>
+inline uint8_t trace_scalar_format(FixedPoint<FracBits>){
+    return FracBits;
+}
+
+/**
+ * @brief Owns a trace ring for a filter to push into and drains it into a trace file on a background
+ * thread, so the replay loop only pays for copying a record into the ring
+ */
+class TraceWriter
+{
+  public:
+    typedef SoCKalmanTraceRecord<3, 1> Record;
+
+    /**
+     * @brief create the file and start draining, throws std::runtime_error if it cannot be written
+     *
+     * @param filename, scalarFormat from trace_scalar_format, ringSize records, a power of two
+     */
+    TraceWriter(const std::string& filename, uint8_t scalarFormat, uint32_t ringSize = 65536);
+
+    ~TraceWriter();
+
+    /**
+     * @brief ring to hand to SoCKalman::setTrace
+     */
+    SoCKalmanTraceRing<Record>& ring();
+
+    /**
+     * @brief drain what is left, stop the thread and finalise the header, called by the destructor if
+     * needed. Throws std::runtime_error if the file could not be written completely
+     */
+    void close();
+
+    uint64_t records() const;
+
+    uint32_t dropped() const;
+
+  private:
+    std::string _filename;
+    FILE* _file;
+    std::vector<Record> _storage;
+    SoCKalmanTraceRing<Record> _ring;
+    std::vector<uint8_t> _buffer;
+    uint64_t _records;
+    std::atomic<bool> _stopping;
+    bool _failed;   // set by the drain thread, read after joining it
+    std::thread _thread;
+
+    TraceWriter(const TraceWriter&);
+    TraceWriter& operator=(const TraceWriter&);
+
+    void drain();
+    void write(const Record& record);
+    void flush();
+};
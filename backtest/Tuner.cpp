@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <string>
+#include <fstream>
+#include <vector>
+#include <cmath> // std::log10, std::pow, std::sqrt
+#include <chrono> // std::chrono::steady_clock
+#include <functional> // std::bind
+#include <stdexcept> // std::runtime_error
+
+#include "Backtest.h"
+#include "CsvReader.h"
+#include "FleetBacktest.h"
+#include "TelemetryFile.h"
+#include "ThreadPool.h"
+#include "Tuner.h"
+
+static const int SENSOR_COLUMNS = 5;
+static const int PARAMETERS = 5;
+
+// One node's rows, loaded once and replayed for every candidate
+struct TuneDataset {
+    bool isBattery12V;
+    bool isBatteryLithium;
+    std::vector<int32_t> sensors;     // SENSOR_COLUMNS values per row
+    std::vector<int32_t> reference;   // reference soc per row
+    std::string error;
+};
+
+// A point of the search space. Every parameter is searched on [0, 1] and mapped onto its range,
+// noise parameters and capacity on a log scale since sensible values span orders of magnitude.
+struct Candidate {
+    double position[PARAMETERS];
+    TuneConfig config;
+    double error;
+};
+
+// <low, high> per parameter, log10 of the value for log scaled parameters
+static const double RANGES[PARAMETERS][2] = {
+    { -4, 1 },           // pval
+    { -8, -1 },          // qval
+    { -4, 1 },           // rval
+    { 50000, 100000 },   // batteryEff
+    { 2, 4.3 },          // batteryCapacity, 100 Wh to 20 kWh
+};
+static const bool LOG_SCALE[PARAMETERS] = { true, true, true, false, true };
+
+static double clamp_unit(double value){
+    return value < 0 ? 0 : (value > 1 ? 1 : value);
+}
+
+static Candidate make_candidate(const double* position){
+    Candidate candidate;
+    double values[PARAMETERS];
+
+    for(int i = 0; i < PARAMETERS; ++i)
+    {
+        candidate.position[i] = clamp_unit(position[i]);
+        double value = RANGES[i][0] + candidate.position[i] * (RANGES[i][1] - RANGES[i][0]);
+        values[i] = LOG_SCALE[i] ? std::pow(10.0, value) : value;
+    }
+
+    candidate.config.pval = values[0];
+    candidate.config.qval = values[1];
+    candidate.config.rval = values[2];
+    candidate.config.batteryEff = (uint32_t)(values[3] + 0.5);
+    candidate.config.batteryCapacity = (uint32_t)(values[4] + 0.5);
+    candidate.error = 0;
+    return candidate;
+}
+
+static int find_column(const std::vector<std::string>& names, const std::string& column){
+    for(size_t i = 0; i < names.size(); ++i)
+        if(names[i] == column) return (int)i;
+    throw std::runtime_error("Missing reference column " + column);
+}
+
+static void load_csv(const NodeFiles& files, const std::string& referenceColumn, TuneDataset* dataset){
+    std::pair<int, int> batteryInfo = read_node_data(files.nodeFilename);
+    dataset->isBatteryLithium = (bool)batteryInfo.first;
+    dataset->isBattery12V = (batteryInfo.second == 12);
+
+    CsvReader reader(files.inputFilename);
+
+    // keep every column so the reference can sit after the timestamp
+    std::vector<std::string> colnames;
+    reader.readHeader(colnames, "");
+    int referenceIdx = find_column(colnames, referenceColumn);
+    int needed = (referenceIdx >= SENSOR_COLUMNS ? referenceIdx : SENSOR_COLUMNS - 1) + 1;
+
+    std::vector<int32_t> values(colnames.size());
+    int count;
+    while((count = reader.readRow(values.data(), (int)values.size())) >= 0)
+    {
+        // skip rows that don't carry every sensor column, like process_csv
+        if(count < needed) continue;
+
+        dataset->sensors.insert(dataset->sensors.end(), values.begin(), values.begin() + SENSOR_COLUMNS);
+        dataset->reference.push_back(values[referenceIdx]);
+    }
+}
+
+static void load_binary(const NodeFiles& files, const std::string& referenceColumn, TuneDataset* dataset){
+    TelemetryReader reader(files.inputFilename);
+    dataset->isBatteryLithium = (bool)reader.isBatteryLithium();
+    dataset->isBattery12V = (reader.nominalVoltage() == 12);
+
+    int referenceIdx = find_column(reader.names(), referenceColumn);
+    if(reader.names().size() < (size_t)SENSOR_COLUMNS) throw std::runtime_error("Expected 5 sensor columns");
+
+    dataset->sensors.reserve(reader.rows() * SENSOR_COLUMNS);
+    dataset->reference.reserve(reader.rows());
+
+    std::vector<int32_t> values(reader.names().size());
+    while(reader.readRow(values.data()))
+    {
+        dataset->sensors.insert(dataset->sensors.end(), values.begin(), values.begin() + SENSOR_COLUMNS);
+        dataset->reference.push_back(values[referenceIdx]);
+    }
+}
+
+static void load_node(const NodeFiles* files, std::string referenceColumn, TuneDataset* dataset){
+    try {
+        if(TelemetryFile::isTelemetryFile(files->inputFilename)) {
+            load_binary(*files, referenceColumn, dataset);
+        } else {
+            load_csv(*files, referenceColumn, dataset);
+        }
+    } catch(const std::exception& e) {
+        dataset->error = e.what();
+    }
+}
+
+static void score(Candidate* candidate, const std::vector<TuneDataset>* datasets){
+    double sumSquares = 0;
+    size_t rows = 0;
+
+    for(size_t d = 0; d < datasets->size(); ++d)
+    {
+        const TuneDataset& dataset = (*datasets)[d];
+        const TuneConfig& config = candidate->config;
+        SoCKalman kalman(config.pval, config.qval, config.rval);
+
+        for(size_t i = 0; i < dataset.reference.size(); ++i)
+        {
+            int32_t soc = filter_row(kalman, &dataset.sensors[i * SENSOR_COLUMNS], i == 0, dataset.isBattery12V,
+                dataset.isBatteryLithium, config.batteryEff, config.batteryCapacity);
+            double deviation = (double)soc - dataset.reference[i];
+            sumSquares += deviation * deviation;
+        }
+        rows += dataset.reference.size();
+    }
+
+    candidate->error = rows > 0 ? std::sqrt(sumSquares / rows) : 0;
+}
+
+// Score every candidate in parallel, returns the index of the best one
+static size_t score_all(std::vector<Candidate>& candidates, const std::vector<TuneDataset>& datasets, size_t threads){
+    ThreadPool pool(threads);
+    for(size_t i = 0; i < candidates.size(); ++i) pool.submit(std::bind(score, &candidates[i], &datasets));
+    pool.run();
+
+    size_t best = 0;
+    for(size_t i = 1; i < candidates.size(); ++i)
+        if(candidates[i].error < candidates[best].error) best = i;
+    return best;
+}
+
+static void print_config(const char* label, const Candidate& candidate){
+    printf("%s pval=%g qval=%g rval=%g battery_eff=%u battery_capacity=%u rms_error=%.1f\n", label, candidate.config.pval,
+        candidate.config.qval, candidate.config.rval, candidate.config.batteryEff, candidate.config.batteryCapacity, candidate.error);
+}
+
+int run_tune(const TuneOptions& options){
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Load every node once, in parallel
+    std::vector<NodeFiles> nodes = list_nodes(options.source);
+    std::vector<TuneDataset> datasets(nodes.size());
+    {
+        ThreadPool pool(options.threads);
+        for(size_t i = 0; i < nodes.size(); ++i) pool.submit(std::bind(load_node, &nodes[i], options.referenceColumn, &datasets[i]));
+        pool.run();
+    }
+
+    size_t rows = 0;
+    for(size_t i = 0; i < datasets.size(); ++i)
+    {
+        if(!datasets[i].error.empty()) {
+            fprintf(stderr, "%s: %s\n", nodes[i].name.c_str(), datasets[i].error.c_str());
+            return 1;
+        }
+        rows += datasets[i].reference.size();
+    }
+    if(rows == 0) {
+        fprintf(stderr, "No rows to tune against\n");
+        return 1;
+    }
+    printf("Loaded %zu nodes, %zu rows.\n", datasets.size(), rows);
+
+    // Score the built in defaults as a baseline, then every grid point
+    std::vector<Candidate> candidates;
+    const double DEFAULTS[PARAMETERS] = { 0.1, 0.0001, 0.1, BATTERY_EFF, BATTERY_CAPACITY };
+    double position[PARAMETERS];
+    for(int i = 0; i < PARAMETERS; ++i)
+    {
+        double value = LOG_SCALE[i] ? std::log10(DEFAULTS[i]) : DEFAULTS[i];
+        position[i] = (value - RANGES[i][0]) / (RANGES[i][1] - RANGES[i][0]);
+    }
+    Candidate defaults = make_candidate(position);
+    // exact values rather than the round trip through the search space
+    defaults.config.pval = DEFAULTS[0];
+    defaults.config.qval = DEFAULTS[1];
+    defaults.config.rval = DEFAULTS[2];
+    candidates.push_back(defaults);
+
+    uint32_t points = options.gridPoints > 0 ? options.gridPoints : 1;
+    size_t gridSize = 1;
+    for(int i = 0; i < PARAMETERS; ++i) gridSize *= points;
+    for(size_t index = 0; index < gridSize; ++index)
+    {
+        size_t rest = index;
+        for(int i = 0; i < PARAMETERS; ++i)
+        {
+            uint32_t step = rest % points;
+            rest /= points;
+            position[i] = (points > 1) ? (double)step / (points - 1) : 0.5;
+        }
+        candidates.push_back(make_candidate(position));
+    }
+
+    Candidate best = candidates[score_all(candidates, datasets, options.threads)];
+    print_config("Defaults:", candidates[0]);
+    print_config("Grid:    ", best);
+
+    // Compass search: try a step either way along every parameter, move to the best improvement
+    // or halve the step when none of them improve
+    double stepSize = (points > 1) ? 0.5 / (points - 1) : 0.25;
+    uint32_t iteration;
+    for(iteration = 0; iteration < options.maxIterations && stepSize > 1e-3; ++iteration)
+    {
+        candidates.clear();
+        for(int i = 0; i < PARAMETERS; ++i)
+        {
+            for(int direction = -1; direction <= 1; direction += 2)
+            {
+                for(int j = 0; j < PARAMETERS; ++j) position[j] = best.position[j];
+                position[i] += direction * stepSize;
+                candidates.push_back(make_candidate(position));
+            }
+        }
+
+        const Candidate& next = candidates[score_all(candidates, datasets, options.threads)];
+        if(next.error < best.error) {
+            best = next;
+        } else {
+            stepSize /= 2;
+        }
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    print_config("Best:    ", best);
+    printf("Tuned over %zu grid points and %u refinements in %.3f s.\n", gridSize, iteration, elapsed.count());
+
+    if(!options.outputFilename.empty()) {
+        std::ofstream myFile(options.outputFilename);
+        if(!myFile.is_open()) throw std::runtime_error("Could not create file");
+        myFile << "pval,qval,rval,battery_eff,battery_capacity,rms_error\n";
+        myFile << best.config.pval << "," << best.config.qval << "," << best.config.rval << "," << best.config.batteryEff << ","
+               << best.config.batteryCapacity << "," << best.error << "\n";
+        printf("Configuration written to %s\n", options.outputFilename.c_str());
+    }
+
+    return 0;
+}
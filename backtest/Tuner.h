@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Filter parameters searched by the tuner
+struct TuneConfig {
+    double pval;                // initial state covariance
+    double qval;                // process noise
+    double rval;                // measurement noise
+    uint32_t batteryEff;        // 100% = 100000
+    uint32_t batteryCapacity;   // watt hours
+};
+
+// Options of a tuning run
+struct TuneOptions {
+    std::string source;             // fleet directory or manifest, see run_fleet
+    std::string referenceColumn;    // column holding the reference soc, 100% = 100000
+    std::string outputFilename;     // best configuration csv, skipped when empty
+    size_t threads;                 // zero means one per hardware thread
+    uint32_t gridPoints;            // grid points per parameter before refining
+    uint32_t maxIterations;         // pattern search iterations after the grid
+};
+
+// Load every node of the source into memory once, then search filter parameters that minimise
+// the RMS error between the filter soc and the reference soc column across all nodes. A coarse
+// grid over log scaled noise parameters, efficiency and capacity is scored first, then the best
+// point is refined with a compass pattern search. Candidates of each round are scored in parallel,
+// one task per candidate. Prints the best configuration and writes it to outputFilename.
+// Returns 0 on success.
+int run_tune(const TuneOptions& options);
@@ -1,12 +1,22 @@
 #include <stdio.h>
 #include <string>
-#include <fstream>
 #include <vector>
-#include <utility> // std::pair
-#include <stdexcept> // std::runtime_error
-#include <sstream> // std::stringstream
-
+#include <cmath> // std::sqrt
+#include <cstdlib> // std::abs
+#include <chrono> // std::chrono::steady_clock
+#include <cstring> // strcmp
+#include <memory> // std::unique_ptr
+
+#include "Backtest.h"
+#include "Ensemble.h"
+#include "FleetBacktest.h"
+#include "HostClock.h"
+#include "OutputWriter.h"
+#include "SegmentedReplay.h"
 #include "SoCKalman.h"
+#include "TelemetryFile.h"
+#include "TraceFile.h"
+#include "Tuner.h"
 
 
 std::string NODE_FILEPATH = "../data/node_data.csv";
@@ -14,208 +24,265 @@ std::string INPUT_FILEPATH = "../data/raw_sensor_data.csv";
 std::string OUTPUT_FILEPATH = "../data/processed_sensor_data.csv";
 
 
-void write_csv(std::string filename, std::vector<std::pair<std::string, std::vector<int> > > dataset){
-    // Make a CSV file with one or more columns of integer values
-    // Each column of data is represented by the pair <column name, column data>
-    //   as std::pair<std::string, std::vector<int>>
-    // The dataset is represented as a vector of these columns
-    // Note that all columns should be the same size
-    
-    // Create an output filestream object
-    std::ofstream myFile(filename);
-    
-    // Send column names to the stream
-    for(int j = 0; j < dataset.size(); ++j)
-    {
-        myFile << dataset.at(j).first;
-        if(j != dataset.size() - 1) myFile << ","; // No comma at end of line
-    }
-    myFile << "\n";
-    
-    // Send data to the stream
-    for(int i = 0; i < dataset.at(0).second.size(); ++i)
-    {
-        for(int j = 0; j < dataset.size(); ++j)
-        {
-            myFile << dataset.at(j).second.at(i);
-            if(j != dataset.size() - 1) myFile << ","; // No comma at end of line
-        }
-        myFile << "\n";
-    }
-    
-    // Close the file
-    myFile.close();
-}
-
-std::pair<int, int> read_node_data(std::string filename){
-
-    // Create pair to store the result
-    std::pair<int, int> result;
-
-    // Create an input filestream
-    std::ifstream myFile(filename);
+void compare_fixed(std::string filename){
+    // Runs the float and fixed point filters over the same input and reports
+    // how far the fixed point soc strays from the float soc
 
-    // Make sure the file is open
-    if(!myFile.is_open()) throw std::runtime_error("Could not open file");
+    std::vector<int> reference = process_input<SoCKalmanFloat>(NODE_FILEPATH, filename).back().second;
+    std::vector<int> fixed = process_input<SoCKalmanFixed>(NODE_FILEPATH, filename).back().second;
 
-    // Declare helper vars
-    std::string line, colname;
-    int val;
+    int maxDeviation = 0;
+    double sumSquares = 0;
 
-    if(myFile.good())
+    for(size_t i = 0; i < reference.size(); ++i)
     {
-        // Extract the first line in the file
-        std::getline(myFile, line);
-
-        // Skip and extract the second line in the file to get the values
-        std::getline(myFile, line);
-
-        // Create a stringstream from the line
-        std::stringstream ss(line);
-        
-        // Keep track of colIdx
-        int colIdx = 0;
-
-        // Extract each integer
-        while(ss >> val){
-            // Add the current integer to the result pair
-
-            
-            if (colIdx == 0) {
-                result.first = val;
-            } else {
-                result.second = val;
-            }
+        int deviation = std::abs(fixed[i] - reference[i]);
+        if(deviation > maxDeviation) maxDeviation = deviation;
+        sumSquares += (double)deviation * deviation;
+    }
 
-            // If the next token is a comma, ignore it and move on
-            if(ss.peek() == ',') ss.ignore();
+    double rms = reference.empty() ? 0 : std::sqrt(sumSquares / reference.size());
 
-            colIdx ++;
-        }
-        
-        return result;
-    }
+    // soc is scaled so 100% = 100000
+    printf("Compared %zu samples.\n", reference.size());
+    printf("Max SoC deviation: %d (%.3f %%)\n", maxDeviation, maxDeviation / 1000.0);
+    printf("RMS SoC deviation: %.1f (%.3f %%)\n", rms, rms / 1000.0);
+}
 
+#ifdef SOC_KALMAN_INSTRUMENT
+static inline double to_double(float value){
+    return value;
 }
 
-std::vector<std::pair<std::string, std::vector<int> > > process_csv(std::string filename){
-    // Reads a CSV file into a vector of <string, vector<int>> pairs where
-    // each pair represents <column name, column values>
+template <uint8_t FracBits>
+static inline double to_double(FixedPoint<FracBits> value){
+    return (double)value.raw() / FixedPoint<FracBits>::ONE;
+}
+#endif
+
+int profile(std::string filename){
+    // Replays the input through a filter with its stages timed by the host cycle counter and reports
+    // where sample() spends its time, needs a build with the instrument option
+
+#ifdef SOC_KALMAN_INSTRUMENT
+    static const char* STAGE_NAMES[SOC_KALMAN_STAGES] = { "f", "predict", "h", "gain", "update state", "update covariance" };
+
+    Dataset dataset = process_input<SoCKalman>(NODE_FILEPATH, filename);
+    std::pair<int, int> batteryInfo;
+    if(TelemetryFile::isTelemetryFile(filename)) {
+        TelemetryReader reader(filename);
+        batteryInfo = std::make_pair(reader.isBatteryLithium(), reader.nominalVoltage());
+    } else {
+        batteryInfo = read_node_data(NODE_FILEPATH);
+    }
 
-    // Instantiate kalman filter and initialize values
     SoCKalman kalman;
+    kalman.setClock(host_cycles);
 
-    // Get node battery type and voltage
-    std::pair<int, int> batteryInfo = read_node_data(NODE_FILEPATH);
-
-    bool isBatteryLithium = (bool)batteryInfo.first;
-    bool isBattery12V = (batteryInfo.second == 12) ? true : false;
+    double sumNis = 0;
+    uint32_t nisSamples = 0;
+    size_t rows = dataset.back().second.size();
+    for(size_t i = 0; i < rows; ++i)
+    {
+        int32_t values[5];
+        for(int colIdx = 0; colIdx < 5; ++colIdx) values[colIdx] = dataset[colIdx].second[i];
+        uint32_t corrections = kalman.counters().corrections;
+        filter_row(kalman, values, i == 0, batteryInfo.second == 12, (bool)batteryInfo.first);
+        // the nis only changes with a measurement update
+        if(i > 0 && kalman.counters().corrections != corrections)
+        {
+            sumNis += to_double(kalman.counters().nis);
+            nisSamples++;
+        }
+    }
 
-    uint32_t batteryEff = 85000;
-    uint32_t initialSoC = 0xFFFFFFFF;
-    uint32_t batteryCapacity = 1200;
+    const auto& counters = kalman.counters();
+    uint64_t totalCycles = 0;
+    for(int stage = 0; stage < SOC_KALMAN_STAGES; ++stage) totalCycles += counters.totalCycles[stage];
 
-    // Create a vector of <string, int vector> pairs to store the result
-    std::vector<std::pair<std::string, std::vector<int> > > result;
+    printf("Profiled %u samples, %u with a measurement update.\n", counters.samples, counters.corrections);
+    for(int stage = 0; stage < SOC_KALMAN_STAGES; ++stage)
+    {
+        printf("  %-18s %8.1f cycles/sample %5.1f %%\n", STAGE_NAMES[stage],
+            counters.samples ? (double)counters.totalCycles[stage] / counters.samples : 0.0,
+            totalCycles ? 100.0 * counters.totalCycles[stage] / totalCycles : 0.0);
+    }
+    printf("Mean NIS: %.3f\n", nisSamples ? sumNis / nisSamples : 0.0);
+    printf("Final P diagonal: %g %g %g\n", to_double(counters.pDiagonal[0]), to_double(counters.pDiagonal[1]),
+        to_double(counters.pDiagonal[2]));
+    return 0;
+#else
+    (void)filename;
+    printf("Profiling needs a build with instrumentation, meson configure -Dinstrument=true\n");
+    return 1;
+#endif
+}
 
-    // Create an input filestream
-    std::ifstream myFile(filename);
+void print_usage(){
+    printf("Usage: backtest [option]\n");
+    printf("  (no option)            filter ../data/raw_sensor_data.csv into ../data/processed_sensor_data.csv\n");
+    printf("  --node <file>          node data csv, default ../data/node_data.csv\n");
+    printf("  --input <file>         sensor data csv or telemetry file, default ../data/raw_sensor_data.csv\n");
+    printf("  --output <file>        processed csv, default ../data/processed_sensor_data.csv\n");
+    printf("  --binary-output        write the output as a columnar telemetry file instead of csv\n");
+    printf("  --convert <file>       convert node and sensor csv into a columnar telemetry file\n");
+    printf("  --compare-fixed        report fixed point soc deviation from floating point\n");
+    printf("  --profile              report cycles per sample() stage, needs -Dinstrument=true\n");
+    printf("  --trace <file>         write a binary per-sample filter trace alongside the output, see TraceFile.h\n");
+    printf("  --fleet <dir|manifest> replay every node in parallel, see FleetBacktest.h\n");
+    printf("  --tune <dir|manifest>  search filter parameters against a reference soc column, --output saves the best\n");
+    printf("  --reference <column>   reference soc column for --tune, default reference_soc\n");
+    printf("  --grid <n>             grid points per parameter for --tune, default 3\n");
+    printf("  --iterations <n>       pattern search iterations for --tune, default 100\n");
+    printf("  --ensemble <file>      filter the input once with every configuration in a --tune style csv, one soc column each\n");
+    printf("  --segments <n>         replay the input as n parallel segments and report the seam error, 0 for one per thread\n");
+    printf("  --warmup <rows,...>    warm-up lengths for --segments, default 0,60,1440,10080\n");
+    printf("  --threshold <soc>      acceptable seam error for --segments, default 1000 (1 %%)\n");
+    printf("  --threads <n>          worker threads for parallel modes, default one per core\n");
+}
 
-    // Make sure the file is open
-    if(!myFile.is_open()) throw std::runtime_error("Could not open file");
+int main(int argc, char** argv) {
+
+    bool compareFixed = false;
+    bool profileStages = false;
+    std::string convertFilename;
+    std::string traceFilename;
+    std::string fleetSource;
+    std::string ensembleFilename;
+    bool segmented = false;
+    SegmentOptions segments = SegmentOptions();
+    segments.threshold = 1000;
+    std::string warmups = "0,60,1440,10080";
+    size_t threads = 0;
+    bool outputGiven = false;
+    OutputFormat outputFormat = OutputFormat::Csv;
+    TuneOptions tune = TuneOptions();
+    tune.referenceColumn = "reference_soc";
+    tune.gridPoints = 3;
+    tune.maxIterations = 100;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--node") == 0 && i + 1 < argc) {
+            NODE_FILEPATH = argv[++i];
+        } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            INPUT_FILEPATH = argv[++i];
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            OUTPUT_FILEPATH = argv[++i];
+            outputGiven = true;
+        } else if (strcmp(argv[i], "--binary-output") == 0) {
+            outputFormat = OutputFormat::Telemetry;
+        } else if (strcmp(argv[i], "--convert") == 0 && i + 1 < argc) {
+            convertFilename = argv[++i];
+        } else if (strcmp(argv[i], "--compare-fixed") == 0) {
+            compareFixed = true;
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            traceFilename = argv[++i];
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            profileStages = true;
+        } else if (strcmp(argv[i], "--fleet") == 0 && i + 1 < argc) {
+            fleetSource = argv[++i];
+        } else if (strcmp(argv[i], "--tune") == 0 && i + 1 < argc) {
+            tune.source = argv[++i];
+        } else if (strcmp(argv[i], "--reference") == 0 && i + 1 < argc) {
+            tune.referenceColumn = argv[++i];
+        } else if (strcmp(argv[i], "--grid") == 0 && i + 1 < argc) {
+            tune.gridPoints = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            tune.maxIterations = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--ensemble") == 0 && i + 1 < argc) {
+            ensembleFilename = argv[++i];
+        } else if (strcmp(argv[i], "--segments") == 0 && i + 1 < argc) {
+            segmented = true;
+            segments.segments = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+            warmups = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            segments.threshold = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = strtoul(argv[++i], NULL, 10);
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
 
-    // Helper vars
-    std::string line, colname;
-    int val;
+    // Convert csv input into a columnar telemetry file for fast reruns
+    if (!convertFilename.empty()) {
+        size_t rows = convert_csv(NODE_FILEPATH, INPUT_FILEPATH, convertFilename);
+        printf("Converted %zu rows into %s\n", rows, convertFilename.c_str());
+        return 0;
+    }
 
-    // Read the column names
-    if(myFile.good())
-    {
-        // Extract the first line in the file
-        std::getline(myFile, line);
+    // Compare fixed point against floating point instead of writing results
+    if (compareFixed) {
+        compare_fixed(INPUT_FILEPATH);
+        return 0;
+    }
 
-        // Create a stringstream from line
-        std::stringstream ss(line);
+    // Time the stages of the filter instead of writing results
+    if (profileStages) {
+        return profile(INPUT_FILEPATH);
+    }
 
-        // Extract each column name
-        while(std::getline(ss, colname, ',')){
+    // Replay a whole fleet of nodes in parallel
+    if (!fleetSource.empty()) {
+        return run_fleet(fleetSource, threads) == 0 ? 0 : 1;
+    }
 
-            if (colname == std::string("timestamp")) {
-                break;
-            }
+    // Search filter parameters over every node in memory
+    if (!tune.source.empty()) {
+        tune.threads = threads;
+        if (outputGiven) tune.outputFilename = OUTPUT_FILEPATH;
+        return run_tune(tune);
+    }
 
-            // Initialize and add <colname, int vector> pairs to result
-            std::pair<std::string, std::vector<int> > column;
-            column.first = colname;
-            result.push_back(column);
-        }
-        // Add new column for Kalman SoC
-        std::pair<std::string, std::vector<int> > column;
-        std::string colname("kalman_soc");
-        column.first = colname;
-        result.push_back(column);
+    // Evaluate many configurations over a single pass of the input
+    if (!ensembleFilename.empty()) {
+        std::vector<TuneConfig> configs = read_configs(ensembleFilename);
+        OutputWriter output(OUTPUT_FILEPATH, outputFormat);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        size_t rows = process_ensemble(NODE_FILEPATH, INPUT_FILEPATH, configs, output);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        printf("Processed %zu rows with %zu configurations in %.3f s (%.0f filter samples/s).\n", rows, configs.size(), elapsed.count(),
+            elapsed.count() > 0 ? rows * configs.size() / elapsed.count() : 0.0);
+        printf("Finished writing.\n");
+        return 0;
     }
 
-    int lineIdx = 0;
-    // Read data, line by line
-    while(std::getline(myFile, line))
-    {
-        // Create a stringstream of the current line
-        std::stringstream ss(line);
-        
-        // Keep track of the current column index
-        int colIdx = 0;
-        
-        // Extract each integer
-        while(ss >> val){
-            if (colIdx == 5) {
-                break;
+    // Replay a single long series in parallel segments
+    if (segmented) {
+        for (const char* p = warmups.c_str(); *p != '\0';) {
+            char* end;
+            segments.warmups.push_back(strtoul(p, &end, 10));
+            if (end == p) {
+                print_usage();
+                return 1;
             }
-            // Add the current integer to the 'colIdx' column's values vector
-            result.at(colIdx).second.push_back(val);
-            
-            // If the next token is a comma, ignore it and move on
-            if(ss.peek() == ',') ss.ignore();
-            
-            // Increment the column index
-            colIdx++;
-        }
-        if (lineIdx == 0) {
-            // use battery voltage to initialize kalman filter
-            uint32_t batteryVoltage = result.at(3).second.back();
-            kalman.init(isBattery12V, isBatteryLithium, batteryEff, batteryVoltage, initialSoC);
-            uint32_t soc = kalman.read();
-            result.at(colIdx).second.push_back(soc);
-        } else {
-            // use sensor data to do a sample with the kalman filter
-            bool isBatteryInFloat = (result.at(2).second.back() == 3);
-            int32_t batteryMilliAmps = result.at(0).second.back();
-            uint32_t batteryVoltage = result.at(3).second.back();
-            int32_t batteryMilliWatts = result.at(1).second.back();
-            uint32_t samplePeriodMilliSec = result.at(4).second.back();
-            kalman.sample(isBatteryInFloat, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity);
-            uint32_t soc = kalman.read();
-            result.at(colIdx).second.push_back(soc);
-
+            p = (*end == ',') ? end + 1 : end;
         }
-        lineIdx++;
+        segments.threads = threads;
+        if (outputGiven) segments.outputFilename = OUTPUT_FILEPATH;
+        segments.outputFormat = outputFormat;
+        return run_segmented(NODE_FILEPATH, INPUT_FILEPATH, segments);
     }
 
-    // Close file
-    myFile.close();
-
-    return result;
-}
-
-int main() {
+    // Per-sample diagnostics are drained into the trace file on a background thread
+    std::unique_ptr<TraceWriter> trace;
+    if (!traceFilename.empty()) trace.reset(new TraceWriter(traceFilename, trace_scalar_format(SoCKalman::ScalarType())));
 
-    // Read and process sensor data using kalman filter
-    std::vector<std::pair<std::string, std::vector<int> > > result = process_csv(INPUT_FILEPATH);
+    // Read and process sensor data using kalman filter, every row is written out as soon as it is filtered
+    OutputWriter output(OUTPUT_FILEPATH, outputFormat);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    size_t rows = stream_input<SoCKalman>(NODE_FILEPATH, INPUT_FILEPATH, output, NULL, trace ? &trace->ring() : NULL);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
 
-    printf("Finished reading.\n");
+    printf("Processed %zu rows in %.3f s (%.0f rows/s).\n", rows, elapsed.count(), elapsed.count() > 0 ? rows / elapsed.count() : 0.0);
 
-    // Write to another file to check that this was successful
-    write_csv(OUTPUT_FILEPATH, result);
+    if (trace) {
+        trace->close();
+        printf("Traced %llu samples into %s, %u dropped.\n", (unsigned long long)trace->records(), traceFilename.c_str(), trace->dropped());
+    }
 
     printf("Finished writing.\n");
     
@@ -0,0 +1,349 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <chrono> // std::chrono::steady_clock
+#include <cstdlib> // strtoull
+#include <cstring> // strcmp
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> // __rdtsc
+#endif
+
+#include "SoCKalman.h"
+#include "SoCKalmanCompact.h"
+#include "SoCKalmanFleet.h"
+
+// Microbenchmarks for the filter hot path. Every case is timed over a fixed number of
+// operations after a short warm up and reported as JSON, one object per case.
+
+#if defined(__x86_64__) || defined(__i386__)
+static const char* CYCLE_CLOCK = "rdtsc";
+#elif defined(__aarch64__)
+static const char* CYCLE_CLOCK = "cntvct";
+#else
+static const char* CYCLE_CLOCK = "none";
+#endif
+
+static inline uint64_t read_cycles(){
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t value;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+    return value;
+#else
+    return 0;
+#endif
+}
+
+// keeps results alive so the measured work isn't optimised away
+static volatile uint32_t sink;
+
+struct Result {
+    std::string name;
+    std::string engine;
+    std::string config;
+    uint64_t ops;
+    double nsPerOp;
+    double cyclesPerOp;
+};
+
+struct Config {
+    const char* name;
+    bool isBattery12V;
+    bool isBatteryLithium;
+};
+
+static const Config CONFIGS[] = {
+    { "lead-acid-12v", true, false },
+    { "lead-acid-24v", false, false },
+    { "lithium-12v", true, true },
+    { "lithium-24v", false, true },
+};
+
+// One hour samples alternating between charge and discharge so the soc stays in range
+struct Row {
+    bool isBatteryInFloat;
+    int32_t batteryMilliAmps;
+    uint32_t batteryVoltage;
+    int32_t batteryMilliWatts;
+    uint32_t samplePeriodMilliSec;
+};
+
+static const uint32_t ROWS = 64;
+
+static std::vector<Row> make_rows(bool isBattery12V){
+    std::vector<Row> rows(ROWS);
+    uint32_t multiplier = isBattery12V ? 1 : 2;
+
+    for(uint32_t i = 0; i < ROWS; ++i)
+    {
+        bool charging = (i % 16) < 8;
+        rows[i].isBatteryInFloat = false;
+        rows[i].batteryMilliAmps = charging ? 2000 + (int32_t)i * 10 : -1500 - (int32_t)i * 10;
+        rows[i].batteryVoltage = ((charging ? 12500 : 12050) + i * 3) * multiplier;
+        rows[i].batteryMilliWatts = rows[i].batteryMilliAmps * (int32_t)rows[i].batteryVoltage / 1000;
+        rows[i].samplePeriodMilliSec = 3600000;
+    }
+
+    return rows;
+}
+
+template <typename Body>
+static Result measure(const char* name, const char* engine, const char* config, uint64_t ops, Body body){
+    // warm caches and branch predictors first
+    body(ops / 10 + 1);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint64_t startCycles = read_cycles();
+    body(ops);
+    uint64_t cycles = read_cycles() - startCycles;
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+    Result result;
+    result.name = name;
+    result.engine = engine;
+    result.config = config;
+    result.ops = ops;
+    result.nsPerOp = elapsed.count() / ops;
+    result.cyclesPerOp = (double)cycles / ops;
+    return result;
+}
+
+#ifdef SOC_KALMAN_INSTRUMENT
+// tick sources for the stage probes, both wrap at 32 bits which the probes allow for
+static uint32_t cycle_clock(){
+    return (uint32_t)read_cycles();
+}
+
+static uint32_t nano_clock(){
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static const char* STAGE_NAMES[SOC_KALMAN_STAGES] = { "f", "predict", "h", "gain", "updateState", "updateCovariance" };
+
+template <typename Kalman>
+static void stages(const char* engine, const Config& config, const std::vector<Row>& rows, uint32_t batteryCapacity, uint64_t ops,
+    std::vector<Result>& results){
+    // the stages of sample() as timed by the probes, once with each clock, so each includes a clock read
+    Kalman kalman;
+    double nanos[SOC_KALMAN_STAGES];
+    double cycles[SOC_KALMAN_STAGES];
+
+    for (int pass = 0; pass < 2; pass++) {
+        kalman.init(config.isBattery12V, config.isBatteryLithium, 85000, rows[0].batteryVoltage, 50000);
+        kalman.setClock(pass == 0 ? nano_clock : cycle_clock);
+        for (uint64_t i = 0; i < ops / 10 + 1; i++) {
+            const Row& row = rows[i % ROWS];
+            kalman.sample(row.isBatteryInFloat, row.batteryMilliAmps, row.batteryVoltage, row.batteryMilliWatts, row.samplePeriodMilliSec,
+                batteryCapacity);
+        }
+        kalman.resetCounters();
+        for (uint64_t i = 0; i < ops; i++) {
+            const Row& row = rows[i % ROWS];
+            kalman.sample(row.isBatteryInFloat, row.batteryMilliAmps, row.batteryVoltage, row.batteryMilliWatts, row.samplePeriodMilliSec,
+                batteryCapacity);
+        }
+        for (int stage = 0; stage < SOC_KALMAN_STAGES; stage++)
+            (pass == 0 ? nanos : cycles)[stage] = (double)kalman.counters().totalCycles[stage] / ops;
+    }
+    sink = kalman.read();
+
+    for (int stage = 0; stage < SOC_KALMAN_STAGES; stage++) {
+        Result result;
+        result.name = STAGE_NAMES[stage];
+        result.engine = engine;
+        result.config = config.name;
+        result.ops = ops;
+        result.nsPerOp = nanos[stage];
+        result.cyclesPerOp = cycles[stage];
+        results.push_back(result);
+    }
+}
+#endif
+
+template <typename Kalman>
+static void filter(const char* engine, const Config& config, uint64_t ops, std::vector<Result>& results){
+    // the public api of one filter engine for one battery config, and with the instrument option the
+    // stages of sample()
+    const std::vector<Row> rows = make_rows(config.isBattery12V);
+    const uint32_t batteryCapacity = config.isBattery12V ? 50 * 12 : 50 * 24;
+    Kalman kalman;
+
+    results.push_back(measure("init", engine, config.name, ops, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++)
+            kalman.init(config.isBattery12V, config.isBatteryLithium, 85000, rows[i % ROWS].batteryVoltage, 0xFFFFFFFF);
+        sink = kalman.read();
+    }));
+
+    kalman.init(config.isBattery12V, config.isBatteryLithium, 85000, rows[0].batteryVoltage, 50000);
+    results.push_back(measure("sample", engine, config.name, ops, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            const Row& row = rows[i % ROWS];
+            kalman.sample(row.isBatteryInFloat, row.batteryMilliAmps, row.batteryVoltage, row.batteryMilliWatts, row.samplePeriodMilliSec,
+                batteryCapacity);
+        }
+        sink = kalman.read();
+    }));
+
+    // the same rows once the covariance has settled and is frozen
+    kalman.init(config.isBattery12V, config.isBatteryLithium, 85000, rows[0].batteryVoltage, 50000);
+    kalman.setSteadyStateGain(true);
+    results.push_back(measure("sampleSteady", engine, config.name, ops, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            const Row& row = rows[i % ROWS];
+            kalman.sample(row.isBatteryInFloat, row.batteryMilliAmps, row.batteryVoltage, row.batteryMilliWatts, row.samplePeriodMilliSec,
+                batteryCapacity);
+        }
+        sink = kalman.read();
+    }));
+    kalman.setSteadyStateGain(false);
+
+    // the same rows with the measurement update on every eighth only
+    kalman.init(config.isBattery12V, config.isBatteryLithium, 85000, rows[0].batteryVoltage, 50000);
+    kalman.setCorrectionInterval(8, 0);
+    results.push_back(measure("sampleDecimated", engine, config.name, ops, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            const Row& row = rows[i % ROWS];
+            kalman.sample(row.isBatteryInFloat, row.batteryMilliAmps, row.batteryVoltage, row.batteryMilliWatts, row.samplePeriodMilliSec,
+                batteryCapacity);
+        }
+        sink = kalman.read();
+    }));
+    kalman.setCorrectionInterval(0, 0);
+
+    // the same rows as columns, sampled a whole buffer per call
+    bool isBatteryInFloat[ROWS];
+    int32_t batteryMilliAmps[ROWS];
+    uint32_t batteryVoltage[ROWS];
+    int32_t batteryMilliWatts[ROWS];
+    uint32_t samplePeriodMilliSec[ROWS];
+    uint32_t soc[ROWS];
+    for (uint32_t i = 0; i < ROWS; i++) {
+        isBatteryInFloat[i] = rows[i].isBatteryInFloat;
+        batteryMilliAmps[i] = rows[i].batteryMilliAmps;
+        batteryVoltage[i] = rows[i].batteryVoltage;
+        batteryMilliWatts[i] = rows[i].batteryMilliWatts;
+        samplePeriodMilliSec[i] = rows[i].samplePeriodMilliSec;
+    }
+
+    kalman.init(config.isBattery12V, config.isBatteryLithium, 85000, rows[0].batteryVoltage, 50000);
+    results.push_back(measure("sampleBatch", engine, config.name, (ops / ROWS + 1) * ROWS, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n / ROWS; i++)
+            kalman.sampleBatch(ROWS, isBatteryInFloat, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec,
+                batteryCapacity, soc);
+        sink = soc[ROWS - 1];
+    }));
+
+#ifdef SOC_KALMAN_INSTRUMENT
+    stages<Kalman>(engine, config, rows, batteryCapacity, ops, results);
+#endif
+}
+
+static void fleet(const Config& config, uint64_t ops, std::vector<Result>& results){
+    // one op is one node sample, nodes are advanced a whole fleet at a time
+    const uint32_t NODES = 1024;
+    const std::vector<Row> rows = make_rows(config.isBattery12V);
+    SoCKalmanFleet kalman(NODES);
+
+    bool isBatteryInFloat[NODES];
+    int32_t batteryMilliAmps[NODES];
+    uint32_t batteryVoltage[NODES];
+    int32_t batteryMilliWatts[NODES];
+    uint32_t samplePeriodMilliSec[NODES];
+    uint32_t batteryCapacity[NODES];
+
+    for(uint32_t node = 0; node < NODES; ++node)
+    {
+        kalman.init(node, config.isBattery12V, config.isBatteryLithium, 85000, rows[0].batteryVoltage, 50000);
+        batteryCapacity[node] = config.isBattery12V ? 50 * 12 : 50 * 24;
+    }
+
+    results.push_back(measure("sample", "fleet", config.name, (ops / NODES + 1) * NODES, [&](uint64_t n) {
+        for (uint64_t step = 0; step < n / NODES; step++) {
+            for (uint32_t node = 0; node < NODES; node++) {
+                const Row& row = rows[(step + node) % ROWS];
+                isBatteryInFloat[node] = row.isBatteryInFloat;
+                batteryMilliAmps[node] = row.batteryMilliAmps;
+                batteryVoltage[node] = row.batteryVoltage;
+                batteryMilliWatts[node] = row.batteryMilliWatts;
+                samplePeriodMilliSec[node] = row.samplePeriodMilliSec;
+            }
+            kalman.sampleAll(isBatteryInFloat, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity);
+        }
+        sink = kalman.read(0);
+    }));
+}
+
+static void compact(const Config& config, uint64_t ops, std::vector<Result>& results){
+    // one op is one node sample, the states of every node stay resident like on the server
+    const uint32_t NODES = 65536;
+    const std::vector<Row> rows = make_rows(config.isBattery12V);
+    const uint32_t batteryCapacity = config.isBattery12V ? 50 * 12 : 50 * 24;
+    SoCKalmanCompact kalman;
+    std::vector<SoCKalmanState> states(NODES);
+
+    for(uint32_t node = 0; node < NODES; ++node)
+        kalman.init(states[node], config.isBattery12V, config.isBatteryLithium, 85000, rows[0].batteryVoltage, 50000);
+
+    results.push_back(measure("sample", "compact", config.name, ops, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            const Row& row = rows[(i / NODES) % ROWS];
+            kalman.sample(states[i % NODES], row.isBatteryInFloat, row.batteryMilliAmps, row.batteryVoltage, row.batteryMilliWatts,
+                row.samplePeriodMilliSec, batteryCapacity);
+        }
+        sink = kalman.read(states[0]);
+    }));
+}
+
+static void write_json(FILE* out, const std::vector<Result>& results, uint64_t ops){
+    fprintf(out, "{\n  \"cycle_clock\": \"%s\",\n  \"ops\": %llu,\n  \"results\": [\n", CYCLE_CLOCK, (unsigned long long)ops);
+    for(size_t i = 0; i < results.size(); ++i)
+    {
+        const Result& result = results[i];
+        fprintf(out, "    { \"name\": \"%s\", \"engine\": \"%s\", \"config\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.2f, \"cycles_per_op\": %.2f }%s\n",
+            result.name.c_str(), result.engine.c_str(), result.config.c_str(), (unsigned long long)result.ops, result.nsPerOp,
+            result.cyclesPerOp, (i + 1 < results.size()) ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char** argv) {
+
+    uint64_t ops = 200000;
+    const char* outputFilename = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+            ops = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            outputFilename = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: bench [--ops <n>] [--output <file.json>]\n");
+            return 1;
+        }
+    }
+    if (ops == 0) ops = 1;
+
+    std::vector<Result> results;
+
+    for (size_t c = 0; c < sizeof(CONFIGS) / sizeof(CONFIGS[0]); c++) {
+        filter<SoCKalmanFloat>("float", CONFIGS[c], ops, results);
+        filter<SoCKalmanFixed>("fixed", CONFIGS[c], ops, results);
+        filter<SoCKalmanT<3, 1, float, SoCKalmanUpdate::Symmetric> >("float-symmetric", CONFIGS[c], ops, results);
+        filter<SoCKalmanT<3, 1, float, SoCKalmanUpdate::Joseph> >("float-joseph", CONFIGS[c], ops, results);
+        filter<SoCKalmanT<3, 1, Fixed16, SoCKalmanUpdate::Symmetric> >("fixed-symmetric", CONFIGS[c], ops, results);
+        fleet(CONFIGS[c], ops, results);
+        compact(CONFIGS[c], ops, results);
+    }
+
+    FILE* out = (outputFilename != NULL) ? fopen(outputFilename, "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "Could not open %s\n", outputFilename);
+        return 1;
+    }
+    write_json(out, results, ops);
+    if (out != stdout) fclose(out);
+
+    return 0;
+}
@@ -0,0 +1,231 @@
+#include "NodeShards.h"
+
+#include <chrono> // std::chrono::microseconds
+#include <unistd.h>
+
+static const uint32_t BATTERY_EFF = 85000;
+static const uint32_t IDLE_SPINS = 64;   // empty polls a worker yields for before it starts sleeping
+
+NodeShards::NodeShards(size_t shards, uint32_t queueSize, uint32_t nodes, int wakeup, StateArena* arena) :
+    _next(0),
+    _wakeup(wakeup),
+    _arena(arena),
+    _stopping(false)
+{
+    size_t count = shards > 0 ? shards : (std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1);
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        _shards.push_back(std::unique_ptr<Shard>(new Shard(queueSize)));
+        if (arena == NULL) _shards[i]->nodes.reserve(nodes / count + 1);
+    }
+    for (i = 0; i < count; i++)
+        _shards[i]->worker = std::thread(&NodeShards::work, this, std::ref(*_shards[i]));
+}
+
+NodeShards::~NodeShards()
+{
+    _stopping.store(true, std::memory_order_release);
+    for (size_t i = 0; i < _shards.size(); i++)
+        _shards[i]->worker.join();
+}
+
+size_t NodeShards::size()
+{
+    return _shards.size();
+}
+
+size_t NodeShards::shard(uint32_t node)
+{
+    // node ids are often sequential, mix them so neighbours spread over the shards
+    return (uint32_t)(node * 2654435761u) % _shards.size();
+}
+
+bool NodeShards::push(size_t shard, const Message& message)
+{
+    return _shards[shard]->inbox.push(message);
+}
+
+bool NodeShards::pop(Response& response)
+{
+    for (size_t i = 0; i < _shards.size(); i++) {
+        Shard& shard = *_shards[_next];
+        _next = (_next + 1) % _shards.size();
+        if (shard.outbox.pop(response))
+            return true;
+    }
+    return false;
+}
+
+uint64_t NodeShards::samples()
+{
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < _shards.size(); i++)
+        total += _shards[i]->samples.load(std::memory_order_relaxed);
+    return total;
+}
+
+uint64_t NodeShards::unknownSamples()
+{
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < _shards.size(); i++)
+        total += _shards[i]->unknownSamples.load(std::memory_order_relaxed);
+    return total;
+}
+
+uint64_t NodeShards::rejectedInits()
+{
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < _shards.size(); i++)
+        total += _shards[i]->rejectedInits.load(std::memory_order_relaxed);
+    return total;
+}
+
+uint64_t NodeShards::nodes()
+{
+    uint64_t total = 0;
+
+    // resumed nodes are never initialised again, the arena counts them as they are touched
+    if (_arena != NULL)
+        return _arena->nodes();
+
+    for (size_t i = 0; i < _shards.size(); i++)
+        total += _shards[i]->nodeCount.load(std::memory_order_relaxed);
+    return total;
+}
+
+void NodeShards::work(Shard& shard)
+{
+    Message message;
+    uint32_t idle = 0;
+
+    while (!_stopping.load(std::memory_order_acquire)) {
+        if (shard.inbox.pop(message)) {
+            if (_arena != NULL)
+                applyArena(shard, message);
+            else
+                apply(shard, message);
+            idle = 0;
+        } else if (++idle < IDLE_SPINS) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(20));
+        }
+    }
+}
+
+void NodeShards::apply(Shard& shard, const Message& message)
+{
+    Response response;
+
+    switch (message.type) {
+    case MessageType::Init: {
+        Node& node = shard.nodes[message.node];
+        node.batteryCapacity = message.batteryCapacity;
+        shard.kalman.init(node.state, message.isBattery12V, message.isBatteryLithium, BATTERY_EFF, message.batteryVoltage, message.initialSoC);
+        shard.nodeCount.store(shard.nodes.size(), std::memory_order_relaxed);
+        break;
+    }
+    case MessageType::Sample: {
+        std::unordered_map<uint32_t, Node>::iterator it = shard.nodes.find(message.node);
+        if (it == shard.nodes.end()) {
+            shard.unknownSamples.store(shard.unknownSamples.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            break;
+        }
+        shard.kalman.sample(it->second.state, message.isBatteryInFloat, message.batteryMilliAmps, message.batteryVoltage, message.batteryMilliWatts,
+            message.samplePeriodMilliSec, it->second.batteryCapacity);
+        shard.samples.store(shard.samples.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        break;
+    }
+    case MessageType::Query: {
+        std::unordered_map<uint32_t, Node>::iterator it = shard.nodes.find(message.node);
+        response.type = MessageType::Query;
+        response.client = message.client;
+        response.node = message.node;
+        response.known = (it != shard.nodes.end());
+        response.soc = response.known ? shard.kalman.read(it->second.state) : 0;
+        response.efficiency = response.known ? shard.kalman.efficiency(it->second.state) : 0;
+        response.samples = 0;
+        answer(shard, response);
+        break;
+    }
+    case MessageType::Flush:
+        response.type = MessageType::Flush;
+        response.client = message.client;
+        response.node = message.initialSoC;
+        response.known = true;
+        response.soc = 0;
+        response.efficiency = 0;
+        response.samples = shard.samples.load(std::memory_order_relaxed);
+        answer(shard, response);
+        break;
+    }
+}
+
+void NodeShards::applyArena(Shard& shard, const Message& message)
+{
+    const ArenaRecord* record = (message.type != MessageType::Flush) ? _arena->read(message.node) : NULL;
+    SoCKalmanState state;
+    Response response;
+
+    switch (message.type) {
+    case MessageType::Init:
+        // node ids beyond the arena's capacity are never stored, their samples count as unknown
+        shard.kalman.init(state, message.isBattery12V, message.isBatteryLithium, BATTERY_EFF, message.batteryVoltage, message.initialSoC);
+        if (!_arena->write(message.node, state, message.batteryCapacity)) {
+            response.type = MessageType::Init;
+            response.client = message.client;
+            response.node = message.node;
+            response.known = false;
+            response.soc = 0;
+            response.efficiency = 0;
+            response.samples = 0;
+            answer(shard, response);
+            shard.rejectedInits.store(shard.rejectedInits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+        break;
+    case MessageType::Sample:
+        if (record == NULL) {
+            shard.unknownSamples.store(shard.unknownSamples.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            break;
+        }
+        // the current record stays intact until the next one is complete
+        state = record->state;
+        shard.kalman.sample(state, message.isBatteryInFloat, message.batteryMilliAmps, message.batteryVoltage, message.batteryMilliWatts,
+            message.samplePeriodMilliSec, record->batteryCapacity);
+        _arena->write(message.node, state, record->batteryCapacity);
+        shard.samples.store(shard.samples.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        break;
+    case MessageType::Query:
+        response.type = MessageType::Query;
+        response.client = message.client;
+        response.node = message.node;
+        response.known = (record != NULL);
+        response.soc = response.known ? shard.kalman.read(record->state) : 0;
+        response.efficiency = response.known ? shard.kalman.efficiency(record->state) : 0;
+        response.samples = 0;
+        answer(shard, response);
+        break;
+    case MessageType::Flush:
+        apply(shard, message);
+        break;
+    }
+}
+
+void NodeShards::answer(Shard& shard, const Response& response)
+{
+    // the ingestion thread drains outboxes while it waits on a full inbox, so this cannot deadlock
+    while (!shard.outbox.push(response)) {
+        if (_stopping.load(std::memory_order_acquire)) return;
+        std::this_thread::yield();
+    }
+
+    if (_wakeup >= 0) {
+        char byte = 1;
+        // a full pipe already has a wakeup pending
+        if (write(_wakeup, &byte, 1) < 0) {}
+    }
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Protocol.h"
+#include "SoCKalmanCompact.h"
+#include "SpscQueue.h"
+#include "StateArena.h"
+
+/**
+ * @brief Filter state of every node, split into shards by a hash of the node id. Each shard owns its
+ * hash map and is only touched by its worker thread, so nodes need no locks. Messages reach a worker
+ * through its own single producer single consumer inbox and answers come back through its outbox,
+ * the ingestion thread is the only producer of every inbox and the only consumer of every outbox.
+ * Nodes are SoCKalmanState records advanced by one SoCKalmanCompact per shard, kept in the shard's map
+ * or, given a StateArena, in the arena where they outlive the process. The shard of a node is the only
+ * writer of its arena slot.
+ */
+class NodeShards
+{
+  public:
+    /**
+     * @brief start the workers, zero shards means one per hardware thread
+     *
+     * @param shards, queueSize messages per inbox and outbox, nodes expected in total to reserve for
+     * @param wakeup file descriptor (optional, -1 for none) a byte is written to when answers are queued
+     * @param arena persistent node states (optional, NULL keeps them in memory)
+     */
+    NodeShards(size_t shards, uint32_t queueSize, uint32_t nodes, int wakeup, StateArena* arena = NULL);
+
+    /**
+     * @brief stop the workers, messages still queued are dropped
+     */
+    ~NodeShards();
+
+    size_t size();
+
+    /**
+     * @brief return the shard that owns a node
+     */
+    size_t shard(uint32_t node);
+
+    /**
+     * @brief ingestion side, queue a message for a shard
+     *
+     * @return bool false if its inbox is full
+     */
+    bool push(size_t shard, const Message& message);
+
+    /**
+     * @brief ingestion side, take the next answer of any shard
+     *
+     * @return bool false if every outbox is empty
+     */
+    bool pop(Response& response);
+
+    /**
+     * @brief return samples applied and dropped for unknown nodes, inits rejected for node ids beyond
+     * the arena's capacity, and nodes known, summed over shards. With an arena the nodes known are
+     * those initialised or resumed since start.
+     */
+    uint64_t samples();
+    uint64_t unknownSamples();
+    uint64_t rejectedInits();
+    uint64_t nodes();
+
+  private:
+    struct Node {
+        SoCKalmanState state;
+        uint32_t batteryCapacity;
+    };
+
+    struct Shard {
+        SpscQueue<Message> inbox;
+        SpscQueue<Response> outbox;
+        std::unordered_map<uint32_t, Node> nodes;
+        SoCKalmanCompact kalman;
+        std::atomic<uint64_t> samples;
+        std::atomic<uint64_t> unknownSamples;
+        std::atomic<uint64_t> rejectedInits;
+        std::atomic<uint64_t> nodeCount;
+        std::thread worker;
+
+        Shard(uint32_t queueSize) :
+            inbox(queueSize),
+            outbox(queueSize),
+            samples(0),
+            unknownSamples(0),
+            rejectedInits(0),
+            nodeCount(0)
+        {}
+    };
+
+    std::vector<std::unique_ptr<Shard> > _shards;
+    size_t _next;   // outbox pop() looks at first
+    int _wakeup;
+    StateArena* _arena;
+    std::atomic<bool> _stopping;
+
+    NodeShards(const NodeShards&);
+    NodeShards& operator=(const NodeShards&);
+
+    void work(Shard& shard);
+    void apply(Shard& shard, const Message& message);
+    void applyArena(Shard& shard, const Message& message);
+    void answer(Shard& shard, const Response& response);
+};
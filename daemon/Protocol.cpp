@@ -0,0 +1,106 @@
+#include "Protocol.h"
+
+#include <stdio.h>
+
+// parse the next space separated integer, advancing p, the hot path so no strtol and no locale
+static bool next_integer(const char*& p, const char* end, int64_t& value)
+{
+    bool negative = false;
+    int64_t result = 0;
+
+    if (p >= end || *p != ' ') return false;
+    p++;
+    if (p < end && *p == '-') {
+        negative = true;
+        p++;
+    }
+    if (p >= end || *p < '0' || *p > '9') return false;
+    while (p < end && *p >= '0' && *p <= '9') {
+        result = result * 10 + (*p - '0');
+        if (result > 0xFFFFFFFFLL) return false;
+        p++;
+    }
+    value = negative ? -result : result;
+    return true;
+}
+
+static bool next_unsigned(const char*& p, const char* end, uint32_t& value)
+{
+    int64_t result;
+
+    if (!next_integer(p, end, result) || result < 0) return false;
+    value = (uint32_t)result;
+    return true;
+}
+
+static bool next_signed(const char*& p, const char* end, int32_t& value)
+{
+    int64_t result;
+
+    if (!next_integer(p, end, result) || result < INT32_MIN || result > INT32_MAX) return false;
+    value = (int32_t)result;
+    return true;
+}
+
+bool parse_message(const char* line, size_t length, Message& message)
+{
+    const char* p = line + 1;
+    const char* end = line + length;
+    uint32_t value;
+
+    // tolerate \r\n line endings
+    if (length > 0 && line[length - 1] == '\r') end--;
+    if (p > end) return false;
+
+    switch (line[0]) {
+    case 'I':
+        message.type = MessageType::Init;
+        if (!next_unsigned(p, end, message.node)) return false;
+        if (!next_unsigned(p, end, value) || value > 1) return false;
+        message.isBatteryLithium = value;
+        if (!next_unsigned(p, end, value) || (value != 12 && value != 24)) return false;
+        message.isBattery12V = (value == 12);
+        if (!next_unsigned(p, end, message.batteryCapacity) || message.batteryCapacity == 0) return false;
+        if (!next_unsigned(p, end, message.batteryVoltage)) return false;
+        message.initialSoC = 0xFFFFFFFF;   // out of range, estimate from voltage
+        if (p < end && !next_unsigned(p, end, message.initialSoC)) return false;
+        break;
+    case 'S':
+        message.type = MessageType::Sample;
+        if (!next_unsigned(p, end, message.node)) return false;
+        if (!next_signed(p, end, message.batteryMilliAmps)) return false;
+        if (!next_signed(p, end, message.batteryMilliWatts)) return false;
+        if (!next_unsigned(p, end, value)) return false;
+        message.isBatteryInFloat = (value == 3);
+        if (!next_unsigned(p, end, message.batteryVoltage)) return false;
+        if (!next_unsigned(p, end, message.samplePeriodMilliSec)) return false;
+        break;
+    case 'Q':
+        message.type = MessageType::Query;
+        if (!next_unsigned(p, end, message.node)) return false;
+        break;
+    case 'F':
+        message.type = MessageType::Flush;
+        break;
+    default:
+        return false;
+    }
+
+    return p == end;
+}
+
+size_t format_response(const Response& response, char* buffer)
+{
+    int length;
+
+    if (response.type == MessageType::Init)
+        length = snprintf(buffer, RESPONSE_SIZE, "E %u out of range\n", response.node);
+    else if (response.type == MessageType::Flush)
+        length = snprintf(buffer, RESPONSE_SIZE, "F %llu\n", (unsigned long long)response.samples);
+    else if (response.known)
+        length = snprintf(buffer, RESPONSE_SIZE, "Q %u %u %u\n", response.node, response.soc, response.efficiency);
+    else
+        length = snprintf(buffer, RESPONSE_SIZE, "Q %u ?\n", response.node);
+
+    return length > 0 ? (size_t)length : 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Line protocol of the daemon, one message per line, fields separated by single spaces. Sample fields
+ * are in the column order of the backtest's raw sensor csv.
+ *
+ *   I <node> <is_lithium> <nominal_voltage> <battery_capacity> <battery_voltage> [soc]
+ *       initialise (or reinitialise) a node, soc is estimated from the voltage when left out. With a
+ *       state arena (--state) node ids must be below its capacity (--nodes when it was created),
+ *       inits of other nodes are answered with "E <node> out of range" and their samples count as
+ *       unknown
+ *   S <node> <battery_milliamps> <battery_milliwatts> <charge_state> <battery_voltage> <sample_period>
+ *       sample a node, samples of unknown nodes are counted and dropped
+ *   Q <node>
+ *       query a node, answered with "Q <node> <soc> <efficiency>" or "Q <node> ?" if unknown
+ *   F
+ *       barrier, answered with "F <samples>" once every message sent before it has been applied
+ *
+ * Only queries, barriers, rejected inits and malformed lines ("E malformed") are answered. Answers to
+ * queries of nodes on different shards may overtake each other. Like a barrier, a malformed line is
+ * answered after the answers to every line before it, though answers to later lines may come first.
+ */
+
+enum class MessageType : uint8_t
+{
+    Init,
+    Sample,
+    Query,
+    Flush
+};
+
+struct Message {
+    MessageType type;
+    bool isBattery12V;           // init
+    bool isBatteryLithium;       // init
+    bool isBatteryInFloat;       // sample
+    uint32_t client;
+    uint32_t node;
+    int32_t batteryMilliAmps;    // sample
+    int32_t batteryMilliWatts;   // sample
+    uint32_t batteryVoltage;     // init and sample
+    uint32_t samplePeriodMilliSec;   // sample
+    uint32_t batteryCapacity;    // init
+    uint32_t initialSoC;         // init, flush id of a barrier
+};
+
+struct Response {
+    MessageType type;        // Init only for an init that was rejected
+    bool known;
+    uint32_t client;
+    uint32_t node;           // flush id of a barrier
+    uint32_t soc;
+    uint32_t efficiency;
+    uint64_t samples;        // barrier, samples applied by the shard
+};
+
+static const size_t RESPONSE_SIZE = 64;   // longest formatted response line
+
+// Parse one line without its newline, returns false if it is malformed
+bool parse_message(const char* line, size_t length, Message& message);
+
+// Format a query, barrier or rejected init response line including its newline, buffer holds RESPONSE_SIZE.
+// Returns the length.
+size_t format_response(const Response& response, char* buffer);
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * @brief Bounded lock free queue between exactly one producer and one consumer thread. A full queue
+ * refuses the push instead of dropping, so the producer decides how to wait. Each side caches the
+ * other side's index and only reloads it when the cache says full or empty, which keeps the shared
+ * cache lines quiet while the queue is neither.
+ */
+template <typename T>
+class SpscQueue
+{
+  public:
+    /**
+     * @param size items, rounded up to a power of two
+     */
+    SpscQueue(uint32_t size) :
+        _items(capacity(size)),
+        _mask(capacity(size) - 1),
+        _head(0),
+        _cachedTail(0),
+        _tail(0),
+        _cachedHead(0)
+    {}
+
+    /**
+     * @brief producer side, copy an item in
+     *
+     * @return bool false if the queue is full
+     */
+    bool push(const T& item)
+    {
+        uint32_t head = _head.load(std::memory_order_relaxed);
+
+        if (head - _cachedTail > _mask) {
+            _cachedTail = _tail.load(std::memory_order_acquire);
+            if (head - _cachedTail > _mask)
+                return false;
+        }
+        _items[head & _mask] = item;
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief consumer side, copy the oldest item out
+     *
+     * @return bool false if the queue is empty
+     */
+    bool pop(T& item)
+    {
+        uint32_t tail = _tail.load(std::memory_order_relaxed);
+
+        if (tail == _cachedHead) {
+            _cachedHead = _head.load(std::memory_order_acquire);
+            if (tail == _cachedHead)
+                return false;
+        }
+        item = _items[tail & _mask];
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+  private:
+    static uint32_t capacity(uint32_t size)
+    {
+        uint32_t result = 1;
+
+        while (result < size)
+            result <<= 1;
+        return result;
+    }
+
+    std::vector<T> _items;
+    uint32_t _mask;
+    // producer and consumer indices on their own cache lines
+    alignas(64) std::atomic<uint32_t> _head;
+    uint32_t _cachedTail;
+    alignas(64) std::atomic<uint32_t> _tail;
+    uint32_t _cachedHead;
+
+    SpscQueue(const SpscQueue&);
+    SpscQueue& operator=(const SpscQueue&);
+};
@@ -0,0 +1,213 @@
+#include "StateArena.h"
+
+#include <stdexcept> // std::runtime_error
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char MAGIC[8] = { 'K', 'S', 'O', 'C', 'A', 'R', 'N', '1' };
+
+static_assert(sizeof(ArenaRecord) == 64, "ArenaRecord should fill one cache line");
+
+// crc32 (IEEE 802.3) as in SoCKalman snapshots, but table driven since every write checksums a record
+struct CrcTable {
+    uint32_t entries[256];
+
+    CrcTable()
+    {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+            entries[i] = crc;
+        }
+    }
+};
+
+static const CrcTable CRC_TABLE;
+
+static uint32_t crc32(const uint8_t* buffer, size_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (size_t i = 0; i < length; i++)
+        crc = (crc >> 8) ^ CRC_TABLE.entries[(crc ^ buffer[i]) & 0xFF];
+
+    return ~crc;
+}
+
+static uint32_t record_crc(const ArenaRecord& record)
+{
+    return crc32((const uint8_t*)&record, offsetof(ArenaRecord, crc));
+}
+
+static void put16(uint8_t* p, uint16_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static void put32(uint8_t* p, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = value >> (8 * i);
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+StateArena::StateArena(const std::string& filename, uint32_t capacity) :
+    _file(-1),
+    _map(NULL),
+    _size(0),
+    _capacity(0),
+    _records(NULL),
+    _recovered(0),
+    _nodes(0)
+{
+    struct stat info;
+    bool created;
+
+    _file = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if (_file < 0 || fstat(_file, &info) < 0) throw std::runtime_error("Could not open state arena " + filename);
+
+    created = (info.st_size == 0);
+    if (created) {
+        uint8_t header[HEADER_SIZE] = {};
+
+        if (capacity == 0) {
+            close(_file);
+            throw std::runtime_error("State arena capacity must not be zero");
+        }
+        memcpy(header, MAGIC, sizeof(MAGIC));
+        put16(header + 8, VERSION);
+        put16(header + 10, sizeof(ArenaRecord));
+        put32(header + 12, capacity);
+        // records are left as holes of zeros, which read as never written
+        if (ftruncate(_file, HEADER_SIZE + (off_t)capacity * 2 * sizeof(ArenaRecord)) < 0
+            || pwrite(_file, header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+            close(_file);
+            throw std::runtime_error("Could not create state arena " + filename);
+        }
+        info.st_size = HEADER_SIZE + (off_t)capacity * 2 * sizeof(ArenaRecord);
+    }
+
+    _size = info.st_size;
+    _map = (uint8_t*)mmap(NULL, _size, PROT_READ | PROT_WRITE, MAP_SHARED, _file, 0);
+    if (_map == MAP_FAILED) {
+        close(_file);
+        throw std::runtime_error("Could not map state arena " + filename);
+    }
+
+    _capacity = get32(_map + 12);
+    if (_size < HEADER_SIZE || memcmp(_map, MAGIC, sizeof(MAGIC)) != 0 || (_map[8] | _map[9] << 8) != VERSION
+        || (_map[10] | _map[11] << 8) != sizeof(ArenaRecord) || _size < HEADER_SIZE + (size_t)_capacity * 2 * sizeof(ArenaRecord)) {
+        munmap(_map, _size);
+        close(_file);
+        throw std::runtime_error("Not a state arena of this version: " + filename);
+    }
+
+    _records = (ArenaRecord*)(_map + HEADER_SIZE);
+    _status.assign(_capacity, SLOT_UNCHECKED);
+}
+
+StateArena::~StateArena()
+{
+    sync();
+    munmap(_map, _size);
+    close(_file);
+}
+
+uint32_t StateArena::capacity()
+{
+    return _capacity;
+}
+
+uint32_t StateArena::recovered()
+{
+    return _recovered.load(std::memory_order_relaxed);
+}
+
+uint32_t StateArena::nodes()
+{
+    return _nodes.load(std::memory_order_relaxed);
+}
+
+void StateArena::sync()
+{
+    msync(_map, _size, MS_SYNC);
+}
+
+uint8_t StateArena::check(uint32_t node)
+{
+    const ArenaRecord& first = _records[2 * node];
+    const ArenaRecord& second = _records[2 * node + 1];
+    bool firstValid = first.sequence != 0 && first.node == node && first.crc == record_crc(first);
+    bool secondValid = second.sequence != 0 && second.node == node && second.crc == record_crc(second);
+    // the record written last has the next sequence, compared so that wrapping around is harmless
+    bool secondNewer = (int32_t)(second.sequence - first.sequence) > 0;
+
+    // a damaged record that claims to be newer than the intact one is a write that didn't finish
+    if ((firstValid && !secondValid && second.sequence != 0 && secondNewer)
+        || (secondValid && !firstValid && first.sequence != 0 && !secondNewer))
+        _recovered.fetch_add(1, std::memory_order_relaxed);
+
+    if (firstValid && secondValid)
+        return secondNewer ? SLOT_SECOND : SLOT_FIRST;
+    if (firstValid)
+        return SLOT_FIRST;
+    if (secondValid)
+        return SLOT_SECOND;
+    return SLOT_EMPTY;
+}
+
+const ArenaRecord* StateArena::read(uint32_t node)
+{
+    if (node >= _capacity)
+        return NULL;
+
+    if (_status[node] == SLOT_UNCHECKED) {
+        _status[node] = check(node);
+        if (_status[node] != SLOT_EMPTY)
+            _nodes.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    switch (_status[node]) {
+    case SLOT_FIRST:
+        return &_records[2 * node];
+    case SLOT_SECOND:
+        return &_records[2 * node + 1];
+    default:
+        return NULL;
+    }
+}
+
+bool StateArena::write(uint32_t node, const SoCKalmanState& state, uint32_t batteryCapacity)
+{
+    const ArenaRecord* current;
+    uint8_t target;
+    ArenaRecord record;
+
+    if (node >= _capacity)
+        return false;
+
+    current = read(node);
+    if (current == NULL)
+        _nodes.fetch_add(1, std::memory_order_relaxed);
+    target = (_status[node] == SLOT_FIRST) ? SLOT_SECOND : SLOT_FIRST;
+    memset(&record, 0, sizeof(record));   // padding is checksummed too
+    record.state = state;
+    record.batteryCapacity = batteryCapacity;
+    record.node = node;
+    record.sequence = current ? current->sequence + 1 : 1;
+    if (record.sequence == 0) record.sequence = 1;
+    record.crc = record_crc(record);
+
+    _records[2 * node + (target == SLOT_SECOND ? 1 : 0)] = record;
+    _status[node] = target;
+    return true;
+}
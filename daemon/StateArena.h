@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "SoCKalmanCompact.h"
+
+/**
+ * @brief One version of a node's filter state as stored in the arena, used in place
+ */
+struct ArenaRecord {
+    SoCKalmanState state;
+    uint32_t batteryCapacity;
+    uint32_t node;       // slot owner, guards against a record landing in the wrong slot
+    uint32_t sequence;   // version, 0 is never written
+    uint32_t crc;        // crc32 of every field above
+};
+
+/**
+ * Persistent arena of filter states, a fixed size file mapped into memory:
+ *
+ *   header   magic "KSOCARN1", uint16 version, uint16 record size, uint32 capacity, little endian,
+ *            52 bytes reserved
+ *   slots    capacity slots of two ArenaRecords in the host's own layout, slot i belongs to node id i,
+ *            so an arena only moves between hosts of the same ABI
+ *
+ * A write goes to the older record of the slot with the next sequence number and the crc last, the
+ * newer record is never touched. A process killed mid write leaves a record whose crc doesn't match,
+ * and the slot falls back to the record before. Slots are checked the first time a node is read
+ * after opening, so opening costs the same for a thousand nodes as for millions.
+ */
+class StateArena
+{
+  public:
+    static const uint16_t VERSION = 1;
+    static const size_t HEADER_SIZE = 64;
+
+    /**
+     * @brief open an arena, creating it with capacity slots if the file doesn't exist. An existing
+     * arena keeps its own capacity. Throws std::runtime_error if the file cannot be mapped or is not
+     * an arena of this version and record layout.
+     *
+     * @param filename, capacity node ids 0 to capacity - 1
+     */
+    StateArena(const std::string& filename, uint32_t capacity);
+
+    /**
+     * @brief flush and unmap
+     */
+    ~StateArena();
+
+    uint32_t capacity();
+
+    /**
+     * @brief return the latest intact record of a node, NULL for node ids out of range, nodes never
+     * written and slots where both records are damaged. Threads may read and write different nodes
+     * concurrently.
+     *
+     * @param node
+     *
+     * @return const ArenaRecord*
+     */
+    const ArenaRecord* read(uint32_t node);
+
+    /**
+     * @brief write the next version of a node
+     *
+     * @param node, state, batteryCapacity
+     *
+     * @return bool false if node is out of range
+     */
+    bool write(uint32_t node, const SoCKalmanState& state, uint32_t batteryCapacity);
+
+    /**
+     * @brief return the number of slots whose newest record was damaged and fell back to the one before
+     */
+    uint32_t recovered();
+
+    /**
+     * @brief return the number of nodes with a state that were read or written since opening. Slots
+     * are checked on first use, so nodes resumed from the arena count once they are touched.
+     */
+    uint32_t nodes();
+
+    /**
+     * @brief write dirty pages back to the file, records are already safe from a process crash
+     * without it but not from a power loss
+     */
+    void sync();
+
+  private:
+    // what read() found in a slot, kept so a slot is only checked once
+    enum SlotStatus : uint8_t {
+        SLOT_UNCHECKED,
+        SLOT_EMPTY,
+        SLOT_FIRST,
+        SLOT_SECOND
+    };
+
+    int _file;
+    uint8_t* _map;
+    size_t _size;
+    uint32_t _capacity;
+    ArenaRecord* _records;
+    std::vector<uint8_t> _status;
+    std::atomic<uint32_t> _recovered;
+    std::atomic<uint32_t> _nodes;
+
+    StateArena(const StateArena&);
+    StateArena& operator=(const StateArena&);
+
+    /**
+     * @brief decide which record of a slot is current
+     */
+    uint8_t check(uint32_t node);
+};
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm> // std::sort
+#include <atomic>
+#include <chrono> // std::chrono::steady_clock
+#include <cstdlib> // strtoul
+#include <cstring> // strcmp
+#include <thread>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Load test for the daemon: registers simulated nodes, streams rounds of hourly samples for every
+// node with a query mixed in at a fixed interval, then waits on a barrier. Reports the samples per
+// second the daemon applied and the round trip latency of the queries.
+
+static const size_t FLUSH_SIZE = 1 << 16;
+
+static uint64_t now_nanoseconds(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool write_all(int fd, std::string& buffer){
+    size_t written = 0;
+
+    while (written < buffer.size()) {
+        ssize_t n = write(fd, buffer.data() + written, buffer.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        written += n;
+    }
+    buffer.clear();
+    return true;
+}
+
+static int connect_to(const std::string& path){
+    struct sockaddr_un address;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0 || path.size() >= sizeof(address.sun_path)) return -1;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.size());
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// answers arrive on their own thread so the writer never stalls on them
+struct Reader {
+    int fd;
+    std::vector<std::atomic<uint64_t> >* sent;   // send time of the outstanding query per node
+    std::vector<uint64_t> latencies;
+    std::atomic<uint32_t> barriers;   // barrier answers so far, one after the inits and one at the end
+    std::atomic<bool> done;           // the connection ended or both barriers were answered
+    uint64_t barrierAt[2];
+    uint64_t barrierSamples[2];
+    uint64_t unknown;
+    uint64_t malformed;
+};
+
+static void read_answers(Reader& reader){
+    std::vector<char> buffer(FLUSH_SIZE);
+    std::string line;
+
+    while (reader.barriers.load() < 2) {
+        ssize_t n = read(reader.fd, buffer.data(), buffer.size());
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        uint64_t now = now_nanoseconds();
+
+        for (ssize_t i = 0; i < n; i++) {
+            if (buffer[i] != '\n') {
+                line.push_back(buffer[i]);
+                continue;
+            }
+            if (line[0] == 'Q') {
+                unsigned long node = strtoul(line.c_str() + 2, NULL, 10);
+                if (line.back() == '?') reader.unknown++;
+                uint64_t sent = (node < reader.sent->size()) ? (*reader.sent)[node].exchange(0) : 0;
+                if (sent != 0) reader.latencies.push_back(now - sent);
+            } else if (line[0] == 'F' && reader.barriers.load() < 2) {
+                uint32_t barrier = reader.barriers.load();
+                reader.barrierSamples[barrier] = strtoull(line.c_str() + 2, NULL, 10);
+                reader.barrierAt[barrier] = now;
+                reader.barriers.store(barrier + 1);
+            } else {
+                reader.malformed++;
+            }
+            line.clear();
+        }
+    }
+    reader.done.store(true);
+}
+
+static double percentile(const std::vector<uint64_t>& sorted, double fraction){
+    if (sorted.empty()) return 0;
+    return sorted[(size_t)(fraction * (sorted.size() - 1))] / 1000.0;
+}
+
+void print_usage(){
+    printf("Usage: loadtest [option]\n");
+    printf("  --socket <path>     daemon socket, default /tmp/kalman-soc.sock\n");
+    printf("  --nodes <n>         simulated nodes, default 1000000\n");
+    printf("  --rounds <n>        samples per node, default 10\n");
+    printf("  --query-every <n>   samples between queries, default 1000\n");
+}
+
+int main(int argc, char** argv) {
+
+    std::string socketPath = "/tmp/kalman-soc.sock";
+    uint32_t nodes = 1000000;
+    uint32_t rounds = 10;
+    uint32_t queryEvery = 1000;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            socketPath = argv[++i];
+        } else if (strcmp(argv[i], "--nodes") == 0 && i + 1 < argc) {
+            nodes = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) {
+            rounds = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--query-every") == 0 && i + 1 < argc) {
+            queryEvery = strtoul(argv[++i], NULL, 10);
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    if (nodes == 0 || queryEvery == 0) {
+        print_usage();
+        return 1;
+    }
+
+    int fd = connect_to(socketPath);
+    if (fd < 0) {
+        fprintf(stderr, "Could not connect to %s\n", socketPath.c_str());
+        return 1;
+    }
+
+    std::vector<std::atomic<uint64_t> > sent(nodes);
+    Reader reader;
+    reader.fd = fd;
+    reader.sent = &sent;
+    reader.barriers = 0;
+    reader.done = false;
+    reader.unknown = 0;
+    reader.malformed = 0;
+    for (uint32_t node = 0; node < nodes; node++) sent[node] = 0;
+    std::thread answers(read_answers, std::ref(reader));
+
+    std::string out;
+    char line[128];
+    bool ok = true;
+
+    // a quarter of the nodes are 24 V and a third are lithium
+    for (uint32_t node = 0; node < nodes && ok; node++) {
+        bool isBattery12V = (node % 4) != 0;
+        out.append(line, snprintf(line, sizeof(line), "I %u %u %u %u %u\n", node, (node % 3) == 0 ? 1 : 0, isBattery12V ? 12 : 24,
+            isBattery12V ? 600 : 1200, isBattery12V ? 12200 : 24400));
+        if (out.size() >= FLUSH_SIZE) ok = write_all(fd, out);
+    }
+
+    // time from the moment every node is registered
+    out.append("F\n");
+    ok = ok && write_all(fd, out);
+    // the daemon may drop the connection after the write went through, the reader then stops
+    while (ok && reader.barriers.load() < 1 && !reader.done.load()) std::this_thread::yield();
+    ok = ok && reader.barriers.load() >= 1;
+
+    uint64_t start = reader.barrierAt[0];
+    uint64_t samples = 0;
+    uint64_t queries = 0;
+
+    for (uint32_t round = 0; round < rounds && ok; round++) {
+        for (uint32_t node = 0; node < nodes && ok; node++) {
+            // a day of hourly solar cycling, staggered per node
+            uint32_t hour = (round + node) % 24;
+            bool charging = hour >= 8 && hour < 16;
+            uint32_t multiplier = (node % 4) != 0 ? 1 : 2;
+            int32_t milliAmps = charging ? 3000 + (int32_t)(node % 7) * 250 : -1500 - (int32_t)(node % 5) * 100;
+            uint32_t voltage = (charging ? 12900 : 12150) * multiplier + node % 50;
+            int32_t milliWatts = (int32_t)((int64_t)milliAmps * voltage / 1000);
+
+            out.append(line, snprintf(line, sizeof(line), "S %u %d %d %u %u 3600000\n", node, milliAmps, milliWatts, (charging && hour >= 14) ? 3 : 1,
+                voltage));
+            samples++;
+
+            if (samples % queryEvery == 0) {
+                // queries are flushed straight away so their timestamp is when they left
+                uint32_t target = (uint32_t)((queries * 7919) % nodes);
+                out.append(line, snprintf(line, sizeof(line), "Q %u\n", target));
+                sent[target] = now_nanoseconds();
+                queries++;
+                ok = write_all(fd, out);
+            } else if (out.size() >= FLUSH_SIZE) {
+                ok = write_all(fd, out);
+            }
+        }
+    }
+
+    out.append("F\n");
+    ok = ok && write_all(fd, out);
+    if (!ok) fprintf(stderr, "Lost the connection to the daemon\n");
+    answers.join();
+    close(fd);
+
+    if (reader.barriers.load() < 2) return 1;
+
+    double seconds = (reader.barrierAt[1] - start) / 1e9;
+    std::sort(reader.latencies.begin(), reader.latencies.end());
+
+    printf("Nodes:            %u\n", nodes);
+    printf("Samples:          %llu sent, %llu applied in %.3f s (%.0f samples/s)\n", (unsigned long long)samples,
+        (unsigned long long)(reader.barrierSamples[1] - reader.barrierSamples[0]), seconds, seconds > 0 ? samples / seconds : 0.0);
+    printf("Queries:          %llu sent, %zu answered, %llu unknown nodes\n", (unsigned long long)queries, reader.latencies.size(),
+        (unsigned long long)reader.unknown);
+    printf("Query latency:    p50 %.1f us, p99 %.1f us, max %.1f us\n", percentile(reader.latencies, 0.5), percentile(reader.latencies, 0.99),
+        percentile(reader.latencies, 1.0));
+    if (reader.malformed) printf("Malformed answers: %llu\n", (unsigned long long)reader.malformed);
+    return 0;
+}
@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <chrono> // std::chrono::steady_clock
+#include <cstdlib> // strtoul
+#include <cstring> // strcmp
+#include <memory> // std::unique_ptr
+#include <stdexcept> // std::runtime_error
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "NodeShards.h"
+#include "Protocol.h"
+
+// Ingestion daemon: hosts the filter of every node that has no local compute. One thread reads the
+// line protocol (see Protocol.h) from a unix domain socket or stdin and routes each message to the
+// worker of the shard that owns its node, answers are written back by the same thread.
+
+static const size_t READ_SIZE = 1 << 16;
+static const size_t OUTPUT_LIMIT = 1 << 20;   // a client with this many unread answers is not read from until it catches up
+static const uint32_t INTERNAL_CLIENT = 0;   // barriers the daemon sends itself, never answered
+
+static volatile sig_atomic_t stopRequested = 0;
+
+struct Client {
+    int in;
+    int out;
+    std::string input;    // partial line carried to the next read
+    std::string output;   // answers not written yet
+    bool closing;         // input has ended, kept until the answers to its last lines are written
+    bool answered;        // the barrier sent when closing has come back, no answers follow
+    uint32_t closeBarrier;
+};
+
+// a barrier is sent to every shard and answered once all of them have reached it
+struct Barrier {
+    uint32_t client;
+    size_t acks;
+    uint64_t samples;
+    bool malformed;   // answers a malformed line instead, after the answers to every line before it
+};
+
+struct Daemon {
+    NodeShards* shards;
+    std::unordered_map<uint32_t, Client> clients;
+    std::unordered_map<uint32_t, Barrier> barriers;
+    uint32_t nextClient;
+    uint32_t nextBarrier;
+    uint32_t shutdownBarrier;
+    bool shuttingDown;
+    bool drained;
+    uint64_t malformed;
+};
+
+static void on_signal(int){
+    stopRequested = 1;
+}
+
+static void collect_answers(Daemon& daemon){
+    Response response;
+    char line[RESPONSE_SIZE];
+
+    while (daemon.shards->pop(response)) {
+        bool malformed = false;
+
+        if (response.type == MessageType::Flush) {
+            std::unordered_map<uint32_t, Barrier>::iterator it = daemon.barriers.find(response.node);
+            if (it == daemon.barriers.end()) continue;
+            Barrier& barrier = it->second;
+            barrier.samples += response.samples;
+            if (++barrier.acks < daemon.shards->size()) continue;
+
+            response.samples = barrier.samples;
+            malformed = barrier.malformed;
+            if (response.node == daemon.shutdownBarrier && daemon.shuttingDown) daemon.drained = true;
+            daemon.barriers.erase(it);
+        }
+
+        // answers to clients that have gone are dropped
+        std::unordered_map<uint32_t, Client>::iterator client = daemon.clients.find(response.client);
+        if (client == daemon.clients.end()) continue;
+        if (response.type == MessageType::Flush && client->second.closing && response.node == client->second.closeBarrier) {
+            client->second.answered = true;
+            continue;
+        }
+        if (malformed)
+            client->second.output.append("E malformed\n");
+        else
+            client->second.output.append(line, format_response(response, line));
+    }
+}
+
+// client outputs are non-blocking, whatever a client is not ready for stays queued for the next POLLOUT
+static void write_outputs(Daemon& daemon){
+    for (std::unordered_map<uint32_t, Client>::iterator it = daemon.clients.begin(); it != daemon.clients.end(); ++it) {
+        Client& client = it->second;
+        size_t written = 0;
+
+        while (written < client.output.size()) {
+            ssize_t n = write(client.out, client.output.data() + written, client.output.size() - written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (n <= 0) {
+                // the reader has gone, its read side closes the client
+                written = client.output.size();
+                break;
+            }
+            written += n;
+        }
+        client.output.erase(0, written);
+    }
+}
+
+static bool output_pending(const Daemon& daemon){
+    for (std::unordered_map<uint32_t, Client>::const_iterator it = daemon.clients.begin(); it != daemon.clients.end(); ++it) {
+        if (!it->second.output.empty()) return true;
+    }
+    return false;
+}
+
+static void route(Daemon& daemon, const Message& message){
+    size_t shard = daemon.shards->shard(message.node);
+
+    // a full inbox waits for its worker, answering meanwhile so no worker waits on a full outbox
+    while (!daemon.shards->push(shard, message)) {
+        collect_answers(daemon);
+        std::this_thread::yield();
+    }
+}
+
+static uint32_t barrier(Daemon& daemon, uint32_t client, bool malformed = false){
+    Message message = Message();
+    Barrier pending = { client, 0, 0, malformed };
+    uint32_t id = daemon.nextBarrier++;
+
+    message.type = MessageType::Flush;
+    message.client = client;
+    message.initialSoC = id;
+    daemon.barriers[id] = pending;
+    for (size_t shard = 0; shard < daemon.shards->size(); shard++) {
+        while (!daemon.shards->push(shard, message)) {
+            collect_answers(daemon);
+            std::this_thread::yield();
+        }
+    }
+    if (client == INTERNAL_CLIENT) daemon.shutdownBarrier = id;
+    return id;
+}
+
+// apply one line without its newline
+static void handle_line(Daemon& daemon, uint32_t id, const char* line, size_t length){
+    Message message = Message();
+
+    message.client = id;
+    if (length == 0 || !parse_message(line, length, message)) {
+        // answered through a barrier so it can't overtake the answers to earlier lines
+        daemon.malformed++;
+        barrier(daemon, id, true);
+    } else if (message.type == MessageType::Flush) {
+        barrier(daemon, id);
+    } else {
+        route(daemon, message);
+    }
+}
+
+static void consume(Daemon& daemon, uint32_t id, const char* data, size_t length){
+    Client& client = daemon.clients[id];
+    const char* end = data + length;
+    const char* line = data;
+
+    // finish the line left over from the previous read first
+    if (!client.input.empty()) {
+        const char* newline = (const char*)memchr(data, '\n', length);
+        if (newline == NULL) {
+            client.input.append(data, length);
+            return;
+        }
+        client.input.append(data, newline - data);
+        line = newline + 1;
+        handle_line(daemon, id, client.input.data(), client.input.size());
+        client.input.clear();
+    }
+
+    while (line < end) {
+        const char* newline = (const char*)memchr(line, '\n', end - line);
+        if (newline == NULL) {
+            client.input.assign(line, end - line);
+            break;
+        }
+        handle_line(daemon, id, line, newline - line);
+        line = newline + 1;
+    }
+}
+
+static int listen_on(const std::string& path){
+    struct sockaddr_un address;
+    int fd;
+
+    if (path.size() >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path.c_str());
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.size());
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    unlink(path.c_str());
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(fd, 16) < 0) {
+        fprintf(stderr, "Could not listen on %s: %s\n", path.c_str(), strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void close_client(Daemon& daemon, uint32_t id, int listener){
+    Client& client = daemon.clients[id];
+
+    // a last line without its newline still counts
+    if (!client.input.empty()) {
+        std::string line;
+        line.swap(client.input);
+        handle_line(daemon, id, line.data(), line.size());
+    }
+
+    // stdin ending stops the daemon once everything read has been applied
+    if (listener < 0) {
+        barrier(daemon, INTERNAL_CLIENT);
+        daemon.shuttingDown = true;
+        return;
+    }
+    // a socket client that only shut down its writing side still reads the answers to its last lines
+    client.closing = true;
+    client.closeBarrier = barrier(daemon, id);
+}
+
+static void reap_clients(Daemon& daemon){
+    std::unordered_map<uint32_t, Client>::iterator it = daemon.clients.begin();
+
+    while (it != daemon.clients.end()) {
+        if (it->second.answered && it->second.output.empty()) {
+            close(it->second.in);
+            it = daemon.clients.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void print_usage(){
+    printf("Usage: daemon [option]\n");
+    printf("  --socket <path>   listen on a unix domain socket, default /tmp/kalman-soc.sock\n");
+    printf("  --stdin           read messages from stdin and answer on stdout instead\n");
+    printf("  --shards <n>      shards, one worker thread each, default one per core\n");
+    printf("  --queue <n>       messages per shard queue, default 65536\n");
+    printf("  --nodes <n>       nodes to reserve space for, default 1048576\n");
+    printf("  --state <file>    keep node states in a persistent arena, node ids below --nodes, resumed on restart\n");
+}
+
+int main(int argc, char** argv) {
+
+    std::string socketPath = "/tmp/kalman-soc.sock";
+    bool useStdin = false;
+    size_t shardCount = 0;
+    uint32_t queueSize = 65536;
+    uint32_t nodes = 1 << 20;
+    std::string statePath;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            socketPath = argv[++i];
+        } else if (strcmp(argv[i], "--stdin") == 0) {
+            useStdin = true;
+        } else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+            shardCount = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--queue") == 0 && i + 1 < argc) {
+            queueSize = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--nodes") == 0 && i + 1 < argc) {
+            nodes = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--state") == 0 && i + 1 < argc) {
+            statePath = argv[++i];
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    // workers wake the ingestion thread through a pipe when they queue answers
+    int wakeup[2];
+    if (pipe(wakeup) < 0) return 1;
+    fcntl(wakeup[0], F_SETFL, O_NONBLOCK);
+    fcntl(wakeup[1], F_SETFL, O_NONBLOCK);
+
+    int listener = -1;
+    if (!useStdin) {
+        listener = listen_on(socketPath);
+        if (listener < 0) return 1;
+    }
+
+    std::unique_ptr<StateArena> arena;
+    if (!statePath.empty()) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        try {
+            arena.reset(new StateArena(statePath, nodes));
+        } catch (const std::runtime_error& e) {
+            fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+        fprintf(stderr, "Opened %s, %u node slots in %.3f ms\n", statePath.c_str(), arena->capacity(),
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    NodeShards shards(shardCount, queueSize, nodes, wakeup[1], arena.get());
+    Daemon daemon = { &shards, {}, {}, 1, 0, 0, false, false, 0 };
+
+    int stdoutFlags = -1;
+    if (useStdin) {
+        Client client = { 0, 1, std::string(), std::string(), false, false, 0 };
+        stdoutFlags = fcntl(1, F_GETFL);
+        fcntl(1, F_SETFL, stdoutFlags | O_NONBLOCK);
+        daemon.clients[daemon.nextClient++] = client;
+        fprintf(stderr, "Reading stdin with %zu shards\n", shards.size());
+    } else {
+        fprintf(stderr, "Listening on %s with %zu shards\n", socketPath.c_str(), shards.size());
+    }
+
+    std::vector<char> buffer(READ_SIZE);
+    std::vector<struct pollfd> fds;
+    std::vector<uint32_t> ids;
+
+    while (!stopRequested && !daemon.drained) {
+        fds.clear();
+        ids.clear();
+        fds.push_back({ wakeup[0], POLLIN, 0 });
+        if (listener >= 0) fds.push_back({ listener, POLLIN, 0 });
+        if (!daemon.shuttingDown) {
+            for (std::unordered_map<uint32_t, Client>::iterator it = daemon.clients.begin(); it != daemon.clients.end(); ++it) {
+                if (it->second.closing || it->second.output.size() >= OUTPUT_LIMIT) continue;
+                fds.push_back({ it->second.in, POLLIN, 0 });
+                ids.push_back(it->first);
+            }
+        }
+        // after the reads so their indices stay put, write_outputs tries every pending client anyway
+        for (std::unordered_map<uint32_t, Client>::iterator it = daemon.clients.begin(); it != daemon.clients.end(); ++it) {
+            if (!it->second.output.empty()) fds.push_back({ it->second.out, POLLOUT, 0 });
+        }
+
+        if (poll(fds.data(), fds.size(), 100) < 0 && errno != EINTR) break;
+
+        while (read(wakeup[0], buffer.data(), buffer.size()) > 0) {}
+        collect_answers(daemon);
+
+        if (listener >= 0 && (fds[1].revents & POLLIN)) {
+            int fd = accept(listener, NULL, NULL);
+            if (fd >= 0) {
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                Client client = { fd, fd, std::string(), std::string(), false, false, 0 };
+                daemon.clients[daemon.nextClient++] = client;
+            }
+        }
+
+        size_t first = (listener >= 0) ? 2 : 1;
+        for (size_t i = 0; i < ids.size(); i++) {
+            if (!(fds[first + i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            ssize_t n = read(fds[first + i].fd, buffer.data(), buffer.size());
+            if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) continue;
+            if (n <= 0) {
+                close_client(daemon, ids[i], listener);
+                continue;
+            }
+            consume(daemon, ids[i], buffer.data(), n);
+        }
+
+        collect_answers(daemon);
+        write_outputs(daemon);
+        reap_clients(daemon);
+    }
+
+    // the answers to the last lines may still wait for a slow reader
+    while (!stopRequested && output_pending(daemon)) {
+        fds.clear();
+        for (std::unordered_map<uint32_t, Client>::iterator it = daemon.clients.begin(); it != daemon.clients.end(); ++it) {
+            if (!it->second.output.empty()) fds.push_back({ it->second.out, POLLOUT, 0 });
+        }
+        if (poll(fds.data(), fds.size(), 100) < 0 && errno != EINTR) break;
+        write_outputs(daemon);
+    }
+    if (stdoutFlags >= 0) fcntl(1, F_SETFL, stdoutFlags);
+
+    fprintf(stderr, "%llu nodes, %llu samples applied, %llu for unknown nodes, %llu malformed lines\n", (unsigned long long)shards.nodes(),
+        (unsigned long long)shards.samples(), (unsigned long long)shards.unknownSamples(), (unsigned long long)daemon.malformed);
+    if (arena) {
+        fprintf(stderr, "%llu inits rejected beyond %u node slots\n", (unsigned long long)shards.rejectedInits(), arena->capacity());
+        fprintf(stderr, "%u node states recovered from an interrupted write\n", arena->recovered());
+    }
+
+    if (listener >= 0) {
+        close(listener);
+        unlink(socketPath.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,425 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono> // std::chrono::steady_clock
+#include <cmath> // std::sin, std::sqrt, std::log
+#include <cstdlib> // strtoul, strtoull
+#include <cstring> // strcmp
+#include <stdexcept> // std::runtime_error
+#include <thread>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "OutputWriter.h"
+#include "SoCOcvTable.h"
+
+// Synthetic battery telemetry for scale and accuracy testing. Every node is a simulated solar home
+// system: a lead-acid or lithium, 12 V or 24 V battery charged by a panel through daily cycles with
+// clouds, discharged by a load that peaks in the evening, floated once full. Readings carry sensor
+// noise and the stream has gaps where a node went offline. Each node draws from its own random
+// stream seeded from --seed and its id, so any node of any run can be regenerated on its own.
+//
+// csv and binary output is a fleet directory (see FleetBacktest.h) with a manifest, every sensor
+// file carrying the true soc in a reference_soc column after the timestamp for --tune. protocol
+// output is the daemon's line protocol with the nodes interleaved in time, for load tests. Periods
+// under 30 minutes only reach the filter's coulomb counting with setPreciseIntegration() on.
+
+static const double PI = 3.14159265358979323846;
+static const uint32_t SOC_SCALED_HUNDRED_PERCENT = 100000;
+static const uint32_t DAY_MILLISECONDS = 86400000;
+static const int64_t START_TIMESTAMP = 1600000000;   // seconds, same epoch as tests/data
+static const int COLUMNS = 7;
+
+enum class Format {
+    Csv,
+    Binary,
+    Protocol
+};
+
+struct Options {
+    uint32_t nodes;
+    uint32_t days;
+    uint32_t periodMilliSec;
+    uint64_t seed;
+    double voltageNoise;     // millivolts, standard deviation
+    double currentNoise;     // milliamps, standard deviation
+    double gapsPerMonth;     // expected offline gaps per node and 30 days
+    Format format;
+    std::string output;      // directory, or file for protocol where empty means stdout
+    size_t threads;
+};
+
+// splitmix64, small and identical on every platform unlike the std distributions
+struct Random {
+    uint64_t state;
+
+    uint64_t next(){
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    // uniform on [0, 1)
+    double uniform(){
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    // standard normal, Box-Muller
+    double normal(){
+        double u = 1.0 - uniform();
+        return std::sqrt(-2.0 * std::log(u)) * std::cos(2 * PI * uniform());
+    }
+};
+
+// One simulated node, everything a sample depends on
+struct NodeModel {
+    uint32_t id;
+    Random random;
+    bool isBatteryLithium;
+    bool isBattery12V;
+    uint32_t batteryCapacity;   // watt hours
+    double chargeEff;           // fraction of charge energy stored
+    double resistance;          // internal resistance in milliohms
+    double panelMilliAmps;      // panel current at noon under a clear sky
+    double loadMilliAmps;       // average load current
+    double soc;                 // truth, 100% = 100000
+    double cloud;               // today's share of clear sky output
+    double loadScale;           // today's load relative to average
+    uint32_t timezone;          // milliseconds added to the clock for local solar time
+    uint64_t time;              // milliseconds since START_TIMESTAMP
+    uint64_t offlineUntil;
+    uint64_t lastSample;        // time of the last row written, the next row's sample period
+    bool started;
+};
+
+// One row of the sensor csv plus the truth
+struct Sample {
+    int32_t milliAmps;
+    int32_t milliWatts;
+    int32_t chargeState;
+    int32_t voltage;
+    int32_t period;
+    int64_t timestamp;
+    int32_t soc;
+};
+
+static void init_node(NodeModel& node, uint32_t id, const Options& options){
+    node.id = id;
+    node.random.state = options.seed * 0x9E3779B97F4A7C15ull + id;
+
+    // a third of the fleet is lithium, a quarter is 24 V
+    node.isBatteryLithium = node.random.uniform() < 1.0 / 3;
+    node.isBattery12V = node.random.uniform() >= 0.25;
+    uint32_t multiplier = node.isBattery12V ? 1 : 2;
+    static const uint32_t CAPACITIES[] = { 300, 600, 1200, 2400 };
+    node.batteryCapacity = CAPACITIES[node.random.next() % 4] * multiplier;
+
+    node.chargeEff = node.isBatteryLithium ? 0.96 + 0.03 * node.random.uniform() : 0.80 + 0.10 * node.random.uniform();
+    node.resistance = (node.isBatteryLithium ? 10.0 : 25.0) * multiplier * (0.8 + 0.4 * node.random.uniform());
+
+    // a quarter of capacity used per day on average, a panel sized to cover it with a margin
+    double nominal = 12000.0 * multiplier;
+    node.loadMilliAmps = node.batteryCapacity * 1000.0 * 0.25 / 24 / nominal * 1000 * (0.7 + 0.6 * node.random.uniform());
+    node.panelMilliAmps = node.loadMilliAmps * (5.0 + 3.0 * node.random.uniform());
+
+    node.soc = 40000 + 50000 * node.random.uniform();
+    node.cloud = 1;
+    node.loadScale = 1;
+    node.timezone = (uint32_t)(node.random.uniform() * DAY_MILLISECONDS);
+    node.time = 0;
+    node.offlineUntil = 0;
+    node.lastSample = 0;
+    node.started = false;
+}
+
+// open circuit voltage from the filter's own table, interpolated within the 1% segment
+static double ocv(const NodeModel& node, double soc){
+    int32_t point = soc >= SOC_SCALED_HUNDRED_PERCENT ? SOC_SCALED_HUNDRED_PERCENT - 1 : (soc < 0 ? 0 : (int32_t)soc);
+    uint32_t midVoltage = 0;
+    uint32_t gradient = 0;
+
+    SoCOcvTable::lookup(node.isBattery12V, node.isBatteryLithium, point, midVoltage, gradient);
+    double middle = (point / SoCOcvTable::SOC_STEP) * (double)SoCOcvTable::SOC_STEP + SoCOcvTable::SOC_STEP / 2;
+    return midVoltage + gradient * (soc - middle) / 100;
+}
+
+// Advance a node by one sample period, returns false while it is offline
+static bool step(NodeModel& node, const Options& options, Sample& sample){
+    uint32_t multiplier = node.isBattery12V ? 1 : 2;
+    uint64_t local = node.time + node.timezone;
+    double hour = (local % DAY_MILLISECONDS) / 3600000.0;
+    double hours = options.periodMilliSec / 3600000.0;
+
+    // weather and habits change from day to day
+    if (node.time == 0 || (local % DAY_MILLISECONDS) < options.periodMilliSec) {
+        node.cloud = 0.25 + 0.75 * node.random.uniform();
+        node.loadScale = 0.7 + 0.6 * node.random.uniform();
+    }
+
+    double sun = (hour > 6 && hour < 18) ? std::sin(PI * (hour - 6) / 12) : 0;
+    double panel = node.panelMilliAmps * sun * node.cloud;
+    double load = node.loadMilliAmps * node.loadScale * ((hour >= 18 && hour < 23) ? 1.8 : (hour < 6 ? 0.6 : 0.9));
+    if (node.soc < 3000) load = 0;   // low voltage disconnect
+
+    double current = panel - load;
+    int32_t chargeState = 0;
+    double floatVoltage = (node.isBatteryLithium ? 13600 : 13500) * multiplier;
+    double voltage;
+
+    if (panel > 0 && current > 0) {
+        if (node.soc >= 99500) {
+            // the charger holds the battery full and only tops up self discharge
+            chargeState = 3;
+            double floatCurrent = node.batteryCapacity / (12.0 * multiplier) * 1000 * 0.005;   // 0.005 C
+            if (current > floatCurrent) current = floatCurrent;
+        } else if (node.soc >= 90000) {
+            chargeState = 2;   // absorption, current tapers as the battery fills
+            current *= 0.1 + 0.9 * (SOC_SCALED_HUNDRED_PERCENT - node.soc) / 10000;
+        } else {
+            chargeState = 1;
+        }
+    }
+
+    voltage = (chargeState == 3) ? floatVoltage : ocv(node, node.soc) + current * node.resistance / 1000;
+    if (voltage > floatVoltage + 400 * multiplier) voltage = floatVoltage + 400 * multiplier;
+
+    // energy in watt hours, only part of the charge is stored
+    double energy = voltage * current / 1e6 * hours;
+    if (energy > 0) energy *= node.chargeEff;
+    node.soc += energy / node.batteryCapacity * SOC_SCALED_HUNDRED_PERCENT;
+    if (node.soc > SOC_SCALED_HUNDRED_PERCENT) node.soc = SOC_SCALED_HUNDRED_PERCENT;
+    if (node.soc < 0) node.soc = 0;
+
+    node.time += options.periodMilliSec;
+
+    // gaps start at random and last five minutes to six hours
+    if (node.started && node.time >= node.offlineUntil
+        && node.random.uniform() < options.gapsPerMonth * options.periodMilliSec / (30.0 * DAY_MILLISECONDS)) {
+        node.offlineUntil = node.time + 300000 + (uint64_t)(node.random.uniform() * 6 * 3600000);
+    }
+    if (node.time < node.offlineUntil) return false;
+
+    double measuredCurrent = current + options.currentNoise * node.random.normal();
+    double measuredVoltage = voltage + options.voltageNoise * multiplier * node.random.normal();
+
+    sample.milliAmps = (int32_t)std::lround(measuredCurrent);
+    sample.voltage = (int32_t)std::lround(measuredVoltage);
+    sample.milliWatts = (int32_t)((int64_t)sample.milliAmps * sample.voltage / 1000);
+    sample.chargeState = chargeState;
+    sample.period = (int32_t)(node.started ? node.time - node.lastSample : options.periodMilliSec);
+    sample.timestamp = START_TIMESTAMP + node.time / 1000;
+    sample.soc = (int32_t)std::lround(node.soc);
+
+    node.lastSample = node.time;
+    node.started = true;
+    return true;
+}
+
+static std::string node_name(uint32_t id){
+    char name[16];
+    snprintf(name, sizeof(name), "node%08u", id);
+    return name;
+}
+
+static bool make_directory(const std::string& path){
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+// Write one node's directory, returns the rows written
+static uint64_t write_node(uint32_t id, const Options& options){
+    static const char* NAMES[COLUMNS] = { "battery_milliamps", "battery_milliwatts", "charge_state", "battery_voltage", "sample_period",
+        "timestamp", "reference_soc" };
+    NodeModel node;
+    Sample sample;
+    std::string directory = options.output + "/" + node_name(id);
+
+    init_node(node, id, options);
+    if (!make_directory(directory)) throw std::runtime_error("Could not create " + directory);
+
+    FILE* nodeData = fopen((directory + "/node_data.csv").c_str(), "wb");
+    if (nodeData == NULL) throw std::runtime_error("Could not create " + directory + "/node_data.csv");
+    fprintf(nodeData, "is_battery_lithium,nominal_voltage\n%d,%d\n", node.isBatteryLithium ? 1 : 0, node.isBattery12V ? 12 : 24);
+    fclose(nodeData);
+
+    std::vector<std::string> names(NAMES, NAMES + COLUMNS);
+    OutputWriter output(directory + (options.format == Format::Binary ? "/raw_sensor_data.ksoc" : "/raw_sensor_data.csv"),
+        options.format == Format::Binary ? OutputFormat::Telemetry : OutputFormat::Csv);
+    output.begin(names, node.isBatteryLithium ? 1 : 0, node.isBattery12V ? 12 : 24);
+
+    uint64_t steps = (uint64_t)options.days * DAY_MILLISECONDS / options.periodMilliSec;
+    int32_t values[COLUMNS];
+    for (uint64_t i = 0; i < steps; i++) {
+        if (!step(node, options, sample)) continue;
+        values[0] = sample.milliAmps;
+        values[1] = sample.milliWatts;
+        values[2] = sample.chargeState;
+        values[3] = sample.voltage;
+        values[4] = sample.period;
+        values[5] = (int32_t)sample.timestamp;
+        values[6] = sample.soc;
+        output.writeRow(values);
+    }
+    output.close();
+
+    return output.rows();
+}
+
+static int write_fleet(const Options& options){
+    std::atomic<uint32_t> next(0);
+    std::atomic<uint64_t> rows(0);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> workers;
+    size_t threads = options.threads > 0 ? options.threads : (std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1);
+
+    if (!make_directory(options.output)) {
+        fprintf(stderr, "Could not create %s\n", options.output.c_str());
+        return 1;
+    }
+
+    // nodes are independent, workers take the next one until all are written
+    for (size_t t = 0; t < threads; t++) {
+        workers.push_back(std::thread([&]() {
+            uint32_t id;
+            while (!failed.load() && (id = next.fetch_add(1)) < options.nodes) {
+                try {
+                    rows.fetch_add(write_node(id, options));
+                } catch (const std::exception& e) {
+                    fprintf(stderr, "%s\n", e.what());
+                    failed.store(true);
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+    if (failed.load()) return 1;
+
+    // the manifest lets --fleet and --tune find binary nodes too, its paths are relative to itself
+    std::string manifest = options.output + "/manifest.csv";
+    FILE* file = fopen(manifest.c_str(), "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not create %s\n", manifest.c_str());
+        return 1;
+    }
+    for (uint32_t id = 0; id < options.nodes; id++) {
+        std::string directory = node_name(id);
+        fprintf(file, "%s/node_data.csv,%s/raw_sensor_data.%s\n", directory.c_str(), directory.c_str(), options.format == Format::Binary ? "ksoc" : "csv");
+    }
+    fclose(file);
+
+    fprintf(stderr, "Wrote %u nodes, %llu rows into %s\n", options.nodes, (unsigned long long)rows.load(), options.output.c_str());
+    return 0;
+}
+
+static int write_protocol(const Options& options){
+    FILE* file = options.output.empty() ? stdout : fopen(options.output.c_str(), "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not create %s\n", options.output.c_str());
+        return 1;
+    }
+    std::vector<char> buffer(OutputWriter::BUFFER_SIZE);
+    setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+
+    std::vector<NodeModel> nodes(options.nodes);
+    Sample sample;
+    uint64_t rows = 0;
+
+    // nodes register with their resting voltage, the daemon estimates their soc from it
+    for (uint32_t id = 0; id < options.nodes; id++) {
+        NodeModel& node = nodes[id];
+        init_node(node, id, options);
+        fprintf(file, "I %u %d %d %u %u\n", id, node.isBatteryLithium ? 1 : 0, node.isBattery12V ? 12 : 24, node.batteryCapacity,
+            (uint32_t)std::lround(ocv(node, node.soc)));
+    }
+
+    // one sample of every node online per period, in time order
+    uint64_t steps = (uint64_t)options.days * DAY_MILLISECONDS / options.periodMilliSec;
+    for (uint64_t i = 0; i < steps; i++) {
+        for (uint32_t id = 0; id < options.nodes; id++) {
+            if (!step(nodes[id], options, sample)) continue;
+            fprintf(file, "S %u %d %d %d %d %d\n", id, sample.milliAmps, sample.milliWatts, sample.chargeState, sample.voltage, sample.period);
+            rows++;
+        }
+    }
+    fprintf(file, "F\n");
+
+    if (file != stdout) fclose(file);
+    else fflush(file);
+    fprintf(stderr, "Wrote %u nodes, %llu samples\n", options.nodes, (unsigned long long)rows);
+    return 0;
+}
+
+void print_usage(){
+    printf("Usage: generator [option]\n");
+    printf("  --nodes <n>           simulated nodes, default 100\n");
+    printf("  --days <n>            days per node, default 30\n");
+    printf("  --period <ms>         sample period in milliseconds, default 60000\n");
+    printf("  --seed <n>            random seed, the same seed gives the same data, default 1\n");
+    printf("  --voltage-noise <mV>  voltage noise per 12 V, default 10\n");
+    printf("  --current-noise <mA>  current noise, default 20\n");
+    printf("  --gaps <n>            offline gaps per node and 30 days, default 3\n");
+    printf("  --format <format>     csv, binary (telemetry files) or protocol (daemon line protocol), default csv\n");
+    printf("  --output <path>       fleet directory for csv and binary, default synthetic, file for protocol, default stdout\n");
+    printf("  --threads <n>         worker threads for csv and binary, default one per core\n");
+}
+
+int main(int argc, char** argv) {
+
+    Options options = { 100, 30, 60000, 1, 10, 20, 3, Format::Csv, "", 0 };
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--nodes") == 0 && i + 1 < argc) {
+            options.nodes = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--days") == 0 && i + 1 < argc) {
+            options.days = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--period") == 0 && i + 1 < argc) {
+            options.periodMilliSec = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            options.seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--voltage-noise") == 0 && i + 1 < argc) {
+            options.voltageNoise = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--current-noise") == 0 && i + 1 < argc) {
+            options.currentNoise = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--gaps") == 0 && i + 1 < argc) {
+            options.gapsPerMonth = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "csv") == 0) {
+                options.format = Format::Csv;
+            } else if (strcmp(argv[i], "binary") == 0) {
+                options.format = Format::Binary;
+            } else if (strcmp(argv[i], "protocol") == 0) {
+                options.format = Format::Protocol;
+            } else {
+                print_usage();
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            options.output = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options.threads = strtoul(argv[++i], NULL, 10);
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    if (options.nodes == 0 || options.periodMilliSec == 0) {
+        print_usage();
+        return 1;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int result;
+    if (options.format == Format::Protocol) {
+        result = write_protocol(options);
+    } else {
+        if (options.output.empty()) options.output = "synthetic";
+        result = write_fleet(options);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    fprintf(stderr, "Generated in %.3f s\n", elapsed.count());
+
+    return result;
+}
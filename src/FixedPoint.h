@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+#include <type_traits>
+
+/**
+ * @brief Signed fixed point number for FPU-less targets, stored as an int32_t in Q(31 - FracBits).FracBits
+ * format. Every operation uses integer arithmetic only, with a 64 bit intermediate, rounds to nearest and
+ * saturates at the int32_t limits instead of wrapping. Construction from double is constexpr so that
+ * constants are converted at compile time.
+ */
+template <uint8_t FracBits>
+class FixedPoint
+{
+    static_assert(FracBits > 0 && FracBits < 31, "at least one integer and one fraction bit are needed");
+
+  public:
+    static const int32_t ONE = (int32_t)1 << FracBits;
+
+    constexpr FixedPoint() :
+        _raw(0)
+    {}
+
+    constexpr FixedPoint(double value) :
+        _raw(saturate((int64_t)(value * ONE + (value < 0 ? -0.5 : 0.5))))
+    {}
+
+    template <typename Integer, typename = typename std::enable_if<std::is_integral<Integer>::value>::type>
+    FixedPoint(Integer value) :
+        _raw(saturate((int64_t)value * ONE))
+    {}
+
+    /**
+     * @brief build a value directly from its raw Q format representation
+     *
+     * @param raw
+     *
+     * @return FixedPoint
+     */
+    static FixedPoint fromRaw(int32_t raw)
+    {
+        FixedPoint result;
+        result._raw = raw;
+        return result;
+    }
+
+    /**
+     * @brief return the raw Q format representation
+     *
+     * @return int32_t raw
+     */
+    int32_t raw() const
+    {
+        return _raw;
+    }
+
+    /**
+     * @brief convert to an integer, truncating towards zero like a float to int cast
+     */
+    explicit operator int32_t() const
+    {
+        return (_raw >= 0) ? (_raw >> FracBits) : -((-(int64_t)_raw) >> FracBits);
+    }
+
+    FixedPoint operator-() const
+    {
+        return fromRaw(saturate(-(int64_t)_raw));
+    }
+
+    FixedPoint operator+(FixedPoint other) const
+    {
+        return fromRaw(saturate((int64_t)_raw + other._raw));
+    }
+
+    FixedPoint operator-(FixedPoint other) const
+    {
+        return fromRaw(saturate((int64_t)_raw - other._raw));
+    }
+
+    FixedPoint operator*(FixedPoint other) const
+    {
+        return fromRaw(saturate(((int64_t)_raw * other._raw + (ONE >> 1)) >> FracBits));
+    }
+
+    FixedPoint operator/(FixedPoint other) const
+    {
+        // division by zero saturates towards the sign of the dividend
+        if (other._raw == 0)
+            return fromRaw(_raw >= 0 ? INT32_MAX : INT32_MIN);
+
+        int64_t numerator = (int64_t)_raw * ONE;
+        int64_t half = (other._raw > 0 ? other._raw : -(int64_t)other._raw) / 2;
+
+        return fromRaw(saturate((numerator + (numerator >= 0 ? half : -half)) / other._raw));
+    }
+
+    bool operator==(FixedPoint other) const
+    {
+        return _raw == other._raw;
+    }
+
+    bool operator!=(FixedPoint other) const
+    {
+        return _raw != other._raw;
+    }
+
+    bool operator<(FixedPoint other) const
+    {
+        return _raw < other._raw;
+    }
+
+    bool operator<=(FixedPoint other) const
+    {
+        return _raw <= other._raw;
+    }
+
+    bool operator>(FixedPoint other) const
+    {
+        return _raw > other._raw;
+    }
+
+    bool operator>=(FixedPoint other) const
+    {
+        return _raw >= other._raw;
+    }
+
+  private:
+    int32_t _raw;
+
+    static constexpr int32_t saturate(int64_t value)
+    {
+        return (value > INT32_MAX) ? INT32_MAX : (value < INT32_MIN) ? INT32_MIN : (int32_t)value;
+    }
+};
+
+// covariance, gain and voltages in Q15.16, 1 lsb = 1.5e-5, range +-32767
+typedef FixedPoint<16> Fixed16;
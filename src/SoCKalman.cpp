@@ -1,55 +1,327 @@
 #include "SoCKalman.h"
+#include "SoCOcvTable.h"
 
-SoCKalman::SoCKalman() :
+#include <string.h>
+
+// add a scaled correction to an integer state, fixed point corrections are added in integer space
+// because the soc state itself exceeds the Q15.16 range
+static inline int32_t correctState(int32_t state, float correction)
+{
+    return (int32_t)(state + correction);
+}
+
+template <uint8_t FracBits>
+static inline int32_t correctState(int32_t state, FixedPoint<FracBits> correction)
+{
+    return state + (int32_t)correction;
+}
+
+// snapshots store scalars as 32 bit patterns, the format byte tells float (0) from Q format (fraction bits)
+static inline uint8_t scalarFormat(float)
+{
+    return 0;
+}
+
+template <uint8_t FracBits>
+static inline uint8_t scalarFormat(FixedPoint<FracBits>)
+{
+    return FracBits;
+}
+
+static inline uint32_t scalarToBits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+template <uint8_t FracBits>
+static inline uint32_t scalarToBits(FixedPoint<FracBits> value)
+{
+    return (uint32_t)value.raw();
+}
+
+static inline void scalarFromBits(uint32_t bits, float& value)
+{
+    memcpy(&value, &bits, sizeof(value));
+}
+
+template <uint8_t FracBits>
+static inline void scalarFromBits(uint32_t bits, FixedPoint<FracBits>& value)
+{
+    value = FixedPoint<FracBits>::fromRaw((int32_t)bits);
+}
+
+// little endian, return the position after the value
+static inline uint8_t* put32(uint8_t* buffer, uint32_t value)
+{
+    buffer[0] = value;
+    buffer[1] = value >> 8;
+    buffer[2] = value >> 16;
+    buffer[3] = value >> 24;
+    return buffer + 4;
+}
+
+static inline const uint8_t* get32(const uint8_t* buffer, uint32_t& value)
+{
+    value = buffer[0] | (uint32_t)buffer[1] << 8 | (uint32_t)buffer[2] << 16 | (uint32_t)buffer[3] << 24;
+    return buffer + 4;
+}
+
+// crc32 (IEEE 802.3), bitwise so no table is needed in flash
+static uint32_t crc32(const uint8_t* buffer, uint32_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (uint32_t i = 0; i < length; i++) {
+        crc ^= buffer[i];
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+
+    return ~crc;
+}
+
+#ifdef SOC_KALMAN_INSTRUMENT
+// time the stages of sample(), each probe ends one stage and starts the next
+#define SOC_KALMAN_PROBE_START()                                 \
+    _counters.samples++;                                         \
+    for (int stage = 0; stage < SOC_KALMAN_STAGES; stage++)      \
+        _counters.cycles[stage] = 0;                             \
+    uint32_t probeStart = _clock ? _clock() : 0
+#define SOC_KALMAN_PROBE(stage) probeStart = probe(SoCKalmanStage::stage, probeStart)
+#define SOC_KALMAN_PROBE_SAMPLE(innovation, pHt) probeSample(innovation, pHt)
+#else
+#define SOC_KALMAN_PROBE_START()
+#define SOC_KALMAN_PROBE(stage)
+#define SOC_KALMAN_PROBE_SAMPLE(innovation, pHt)
+#endif
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+SoCKalmanT<N, M, Scalar, Update>::SoCKalmanT() :
     _previousSoC(0),
     _batteryEff(0),
     _pval(0.1),
     _qval(0.0001),
-    _rval(0.1)
+    _rval(0.1),
+    _h(0),
+    _H { 0, 0, 0 },
+    _steadyState(false),
+    _settled(0),
+    _frozenSamples(0),
+    _validatedAmps(0),
+    _validatedInnovation(0),
+    _preciseIntegration(false),
+    _energyRemainder(0),
+    _chargeRemainder(0),
+    _correctionSamples(0),
+    _pendingSamples(0),
+    _correctionMilliSec(0),
+    _pendingMilliSec(0),
+    _correctedSoC(0)
+{}
 
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+SoCKalmanT<N, M, Scalar, Update>::SoCKalmanT(float pval, float qval, float rval) :
+    _previousSoC(0),
+    _batteryEff(0),
+    _pval(pval),
+    _qval(qval),
+    _rval(rval),
+    _h(0),
+    _H { 0, 0, 0 },
+    _steadyState(false),
+    _settled(0),
+    _frozenSamples(0),
+    _validatedAmps(0),
+    _validatedInnovation(0),
+    _preciseIntegration(false),
+    _energyRemainder(0),
+    _chargeRemainder(0),
+    _correctionSamples(0),
+    _pendingSamples(0),
+    _correctionMilliSec(0),
+    _pendingMilliSec(0),
+    _correctedSoC(0)
 {}
 
-void SoCKalman::init(bool isBattery12V, bool isBatteryLithium, uint32_t batteryEff, uint32_t batteryVoltage, uint32_t initialSoC)
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::init(bool isBattery12V, bool isBatteryLithium, uint32_t batteryEff, uint32_t batteryVoltage, uint32_t initialSoC)
 {
     _batteryEff = batteryEff;
     _isBattery12V = isBattery12V;
     _isBatteryLithium = isBatteryLithium;
 
     // use stored soc, unless it's out of range, in which case calculate new starting point
-    _previousSoC = (initialSoC >= 0 && initialSoC <= SOC_SCALED_MAX)
+    _previousSoC = (initialSoC <= SOC_SCALED_MAX)
         ? initialSoC
         : calculateInitialSoC(batteryVoltage);
 
     _x[0] = _previousSoC;
-    diagonalMatrix(_pval, _pPost);   // identity(n) * pval
-    diagonalMatrix(_qval, _q);       // identity(n) * qval
-    diagonalMatrix(1.0, _a);         // identity
+    initCovariance(UpdateTag());
+    _settled = 0;
+    _energyRemainder = 0;
+    _chargeRemainder = 0;
+    _pendingSamples = 0;
+    _pendingMilliSec = 0;
+    _correctedSoC = _previousSoC;
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::init(bool isBattery12V, bool isBatteryLithium, uint32_t batteryEff, uint32_t batteryVoltage, uint32_t initialSoC,
+    float pval, float qval, float rval)
+{
+    _pval = Scalar(pval);
+    _qval = Scalar(qval);
+    _rval = Scalar(rval);
+    init(isBattery12V, isBatteryLithium, batteryEff, batteryVoltage, initialSoC);
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+uint8_t SoCKalmanT<N, M, Scalar, Update>::snapshot(uint8_t* buffer, uint8_t size)
+{
+    uint8_t* p = buffer + 4;
+    int i;
+
+    if (size < SNAPSHOT_SIZE)
+        return 0;
+
+    buffer[0] = SNAPSHOT_VERSION;
+    buffer[1] = scalarFormat(Scalar());
+    buffer[2] = (_isBattery12V ? 1 : 0) | (_isBatteryLithium ? 2 : 0);
+    buffer[3] = (uint8_t)Update;
+
+    p = put32(p, _previousSoC);
+    p = put32(p, _batteryEff);
+    p = put32(p, _millisecondsInFloat);
+    for (i = 0; i < N; i++)
+        p = put32(p, (uint32_t)_x[i]);
+    for (i = 0; i < COVARIANCE_SIZE; i++)
+        p = put32(p, scalarToBits(_pPost[i]));
+    // the last linearisation is kept while soc is outside the ocv table, so it is state too
+    p = put32(p, scalarToBits(_h));
+    for (i = 0; i < M * N; i++)
+        p = put32(p, scalarToBits(_H[i]));
+
+    put32(p, crc32(buffer, SNAPSHOT_SIZE - 4));
+    return SNAPSHOT_SIZE;
 }
 
-uint32_t SoCKalman::read()
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+bool SoCKalmanT<N, M, Scalar, Update>::restore(const uint8_t* buffer, uint8_t size)
+{
+    const uint8_t* p = buffer + 4;
+    uint32_t bits;
+    int i;
+
+    if (size < SNAPSHOT_SIZE)
+        return false;
+    get32(buffer + SNAPSHOT_SIZE - 4, bits);
+    if (bits != crc32(buffer, SNAPSHOT_SIZE - 4))
+        return false;
+    if (buffer[0] != SNAPSHOT_VERSION || buffer[1] != scalarFormat(Scalar()) || buffer[3] != (uint8_t)Update)
+        return false;
+
+    _isBattery12V = buffer[2] & 1;
+    _isBatteryLithium = buffer[2] & 2;
+
+    p = get32(p, _previousSoC);
+    p = get32(p, _batteryEff);
+    p = get32(p, _millisecondsInFloat);
+    for (i = 0; i < N; i++) {
+        p = get32(p, bits);
+        _x[i] = (int32_t)bits;
+    }
+    for (i = 0; i < COVARIANCE_SIZE; i++) {
+        p = get32(p, bits);
+        scalarFromBits(bits, _pPost[i]);
+    }
+    p = get32(p, bits);
+    scalarFromBits(bits, _h);
+    for (i = 0; i < M * N; i++) {
+        p = get32(p, bits);
+        scalarFromBits(bits, _H[i]);
+    }
+
+    // model matrices, as set up by init
+    if (Update == SoCKalmanUpdate::Textbook) {
+        diagonalMatrix(_qval, _q);
+        diagonalMatrix(Scalar(1), _a);
+    }
+    _settled = 0;
+    _energyRemainder = 0;
+    _chargeRemainder = 0;
+    _pendingSamples = 0;
+    _pendingMilliSec = 0;
+    _correctedSoC = _previousSoC;
+    return true;
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+uint32_t SoCKalmanT<N, M, Scalar, Update>::read()
 {
     // do not excede 0-100% bounds
     return clamp(_previousSoC, 0, SOC_SCALED_HUNDRED_PERCENT);
 }
 
-uint32_t SoCKalman::efficiency()
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+uint32_t SoCKalmanT<N, M, Scalar, Update>::readCorrected()
+{
+    return clamp(_correctedSoC, 0, SOC_SCALED_HUNDRED_PERCENT);
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+uint32_t SoCKalmanT<N, M, Scalar, Update>::efficiency()
 {
     return _batteryEff;
 }
 
-void SoCKalman::f(bool isBatteryInFloat, int32_t batteryMilliWatts, uint32_t samplePeriodMilliSec, uint32_t batteryCapacity)
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::prepare(uint32_t batteryCapacity, SampleConstants& constants)
+{
+    constants.curve = SoCOcvTable::curve(_isBattery12V, _isBatteryLithium);
+    constants.batteryCapacity = batteryCapacity;
+    constants.scaledCapacity = (int64_t)batteryCapacity * 1000;
+
+    // A never changes after init, nor does the I of (I - G H)
+    if (Update == SoCKalmanUpdate::Textbook) {
+        transpose<N, N>(_a, _at);
+        diagonalMatrix(Scalar(1), constants.identity);
+    }
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::f(const SampleConstants& constants, bool isBatteryInFloat, int32_t batteryMilliWatts, uint32_t samplePeriodMilliSec)
 {
     uint32_t milliSecToHours = 3600000;
-    int32_t powerChange = ((batteryMilliWatts / 1000) * _batteryEff * (samplePeriodMilliSec / milliSecToHours));   // scaling should be fine here
-    uint32_t newSoC = (_x[0] * batteryCapacity + powerChange) / batteryCapacity;                                   // scaling should be fine here
 
-    _x[0] = newSoC;
+    if (_preciseIntegration) {
+        // mW ms -> mWh -> soc, each division carries its remainder into the next sample so no energy
+        // is lost however short the period
+        int64_t energy = _energyRemainder + (int64_t)batteryMilliWatts * samplePeriodMilliSec;
+        int64_t milliWattHours = energy / milliSecToHours;
+        int64_t charge = _chargeRemainder + milliWattHours * _batteryEff;
+        int64_t socChange = charge / constants.scaledCapacity;
+        int64_t newSoC = _x[0] + socChange;
+
+        _energyRemainder = energy - milliWattHours * milliSecToHours;
+        _chargeRemainder = charge - socChange * constants.scaledCapacity;
+        _x[0] = (newSoC < 0) ? 0 : newSoC;
+    } else {
+        int32_t powerChange = ((batteryMilliWatts / 1000) * _batteryEff * (samplePeriodMilliSec / milliSecToHours));   // scaling should be fine here
+        uint32_t newSoC = (_x[0] * constants.batteryCapacity + powerChange) / constants.batteryCapacity;               // scaling should be fine here
+
+        _x[0] = newSoC;
+    }
 
     if (isBatteryInFloat) {
         _millisecondsInFloat += samplePeriodMilliSec;
         if (_millisecondsInFloat > _floatResetDuration) {
-            _batteryEff = (uint64_t)_batteryEff * (uint64_t)SOC_SCALED_HUNDRED_PERCENT / _previousSoC;
-            _batteryEff = clamp(_batteryEff, 0, SOC_SCALED_HUNDRED_PERCENT);
+            // an empty battery says nothing about the efficiency, keep it
+            if (_previousSoC > 0) {
+                _batteryEff = (uint64_t)_batteryEff * (uint64_t)SOC_SCALED_HUNDRED_PERCENT / _previousSoC;
+                _batteryEff = clamp(_batteryEff, 0, SOC_SCALED_HUNDRED_PERCENT);
+            }
             _x[0] = SOC_SCALED_HUNDRED_PERCENT;
         }
     } else {
@@ -57,190 +329,539 @@ void SoCKalman::f(bool isBatteryInFloat, int32_t batteryMilliWatts, uint32_t sam
     }
 }
 
-void SoCKalman::h(int32_t batteryMilliAmps)
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::h(const SampleConstants& constants, int32_t batteryMilliAmps)
 {
     // _h is the voltage that most closely matches current soc (a number)
     // _H is an array of form [ocv gradient, measured current, 1] (the last parameter is the offset)
     // x_[0] = SOC, _x[1] = R
 
-    uint32_t dummyLeadAcidVoltage[101] = { 11640, 11653, 11666, 11679, 11692, 11706, 11719, 11732, 11745, 11758, 11772, 11785, 11798, 11811, 11824, 11838, 11851, 11864, 11877, 11890, 11904, 11917, 11930, 11943, 11956, 11970, 11983, 11996, 12009, 12022, 12036, 12049, 12062, 12075, 12088, 12102, 12115, 12128, 12141, 12154, 12168, 12181, 12194, 12207, 12220, 12234, 12247, 12260, 12273, 12286, 12300, 12313, 12326, 12339, 12352, 12366, 12379, 12392, 12405, 12418, 12432, 12445, 12458, 12471, 12484, 12498, 12511, 12524, 12537, 12550, 12564, 12577, 12590, 12603, 12616, 12630, 12643, 12656, 12669, 12682, 12696, 12709, 12722, 12735, 12748, 12762, 12775, 12788, 12801, 12814, 12828, 12841, 12854, 12867, 12880, 12894, 12907, 12920, 12933, 12946, 12960 };
-    uint32_t dummyLithiumVoltage[101] = { 5000, 6266, 7434, 8085, 8531, 8867, 9134, 9355, 9543, 9705, 9847, 9974, 10088, 10191, 10285, 10372, 10451, 10525, 10595, 10659, 10720, 10777, 10831, 10882, 10931, 10977, 11021, 11063, 11104, 11142, 11180, 11216, 11251, 11284, 11317, 11349, 11379, 11409, 11438, 11467, 11495, 11522, 11548, 11574, 11600, 11625, 11650, 11675, 11699, 11723, 11746, 11769, 11793, 11815, 11838, 11861, 11883, 11906, 11928, 11950, 11972, 11994, 12017, 12039, 12061, 12083, 12105, 12127, 12150, 12172, 12195, 12217, 12240, 12263, 12286, 12309, 12333, 12356, 12380, 12404, 12428, 12452, 12477, 12501, 12526, 12552, 12577, 12603, 12629, 12655, 12682, 12708, 12735, 12763, 12790, 12818, 12846, 12875, 12903, 12931, 12960 };
-    uint32_t dummyOcvSoc[101] = { 0, 1000, 2000, 3000, 4000, 5000, 6000, 7000, 8000, 9000, 10000, 11000, 12000, 13000, 14000, 15000, 16000, 17000, 18000, 19000, 20000, 21000, 22000, 23000, 24000, 25000, 26000, 27000, 28000, 29000, 30000, 31000, 32000, 33000, 34000, 35000, 36000, 37000, 38000, 39000, 40000, 41000, 42000, 43000, 44000, 45000, 46000, 47000, 48000, 49000, 50000, 51000, 52000, 53000, 54000, 55000, 56000, 57000, 58000, 59000, 60000, 61000, 62000, 63000, 64000, 65000, 66000, 67000, 68000, 69000, 70000, 71000, 72000, 73000, 74000, 75000, 76000, 77000, 78000, 79000, 80000, 81000, 82000, 83000, 84000, 85000, 86000, 87000, 88000, 89000, 90000, 91000, 92000, 93000, 94000, 95000, 96000, 97000, 98000, 99000, 100000 };
-
     // update voltage closest to current state of charge as well as gradient
-    int i;
-    uint16_t multiplier;
-
-    if (_isBattery12V) {
-        multiplier = 1;
-    } else {
-        multiplier = 2;
-    }
-
-    for (i = 0; i < 101; i++) {
-        if (dummyOcvSoc[i] > (uint32_t)_x[0]) {
-            if (_isBatteryLithium) {
-                _h = (dummyLithiumVoltage[i] + dummyLithiumVoltage[i - 1]) * multiplier / 2 + (batteryMilliAmps / 1000 * _x[1] / 100) + _x[2] / 100;   // units should be good here
-                _H[0] = (dummyLithiumVoltage[i] - dummyLithiumVoltage[i - 1]) * multiplier * 100 / (dummyOcvSoc[i] - dummyOcvSoc[i - 1]);              // units are good here
-            } else {
-                _h = (dummyLeadAcidVoltage[i] + dummyLeadAcidVoltage[i - 1]) * multiplier / 2 + (batteryMilliAmps / 1000 * _x[1] / 100) + _x[2] / 100;
-                _H[0] = (dummyLeadAcidVoltage[i] - dummyLeadAcidVoltage[i - 1]) * multiplier * 100 / (dummyOcvSoc[i] - dummyOcvSoc[i - 1]);
-            }
-            _H[1] = batteryMilliAmps / 1000;   // should be good in Amps
-            _H[2] = 1;                         // offset
-            return;
-        }
+    uint32_t midVoltage;
+    uint32_t gradient;
+
+    if (SoCOcvTable::lookup(constants.curve, _x[0], midVoltage, gradient)) {
+        _h = Scalar(midVoltage + (batteryMilliAmps / 1000 * _x[1] / 100) + _x[2] / 100);   // units should be good here
+        _H[0] = Scalar(gradient);                                                          // units are good here
+        _H[1] = Scalar(batteryMilliAmps / 1000);                                           // should be good in Amps
+        _H[2] = Scalar(1);                                                                 // offset
     }
 }
 
-void SoCKalman::sample(bool isBatteryInFloat, int32_t batteryMilliAmps, uint32_t batteryVoltage, int32_t batteryMilliWatts, uint32_t samplePeriodMilliSec,
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::sample(bool isBatteryInFloat, int32_t batteryMilliAmps, uint32_t batteryVoltage, int32_t batteryMilliWatts, uint32_t samplePeriodMilliSec,
     uint32_t batteryCapacity)
 {
-    float temp0[_n * _n];
-    float temp1[_n * _n];
-    float temp2[_n * _m];
-    float temp3[_n * _m];
-    float temp4[_m * _m];
-    float temp5;
+    SampleConstants constants;
+
+    prepare(batteryCapacity, constants);
+    step(constants, isBatteryInFloat, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec);
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::step(const SampleConstants& constants, bool isBatteryInFloat, int32_t batteryMilliAmps, uint32_t batteryVoltage,
+    int32_t batteryMilliWatts, uint32_t samplePeriodMilliSec)
+{
+    Scalar pHt[N * M];
+    Scalar correction[N * M];
+    Scalar previous[N];
+    Scalar innovation;
+    int32_t amps = batteryMilliAmps / 1000;
+    bool steady;
+    SOC_KALMAN_PROBE_START();
 
     // $\hat{x}_k = f(\hat{x}_{k-1})$
-    f(isBatteryInFloat, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity);
+    f(constants, isBatteryInFloat, batteryMilliWatts, samplePeriodMilliSec);
+    SOC_KALMAN_PROBE(F);
+
+    if (!isCorrectionDue(samplePeriodMilliSec)) {
+        // prediction only, P grows by Q until the next measurement update unless it is frozen
+        if (!isFrozen()) {
+            predictCovariance(UpdateTag());
+            for (int i = 0; i < COVARIANCE_SIZE; i++)
+                _pPost[i] = _pPre[i];
+        }
+        SOC_KALMAN_PROBE(Predict);
+
+        _x[0] = clamp(_x[0] < 0 ? 0 : (uint32_t)_x[0], 0, SOC_SCALED_HUNDRED_PERCENT);
+        _previousSoC = _x[0];
+        if (_trace)
+            trace(isBatteryInFloat);
+        return;
+    }
 
-    // $P_k = A_{k-1} P_{k-1} A^T_{k-1} + Q_{k-1}$ -- updates _pPre
-    matMult(_a, _pPost, temp0, _n, _n, _n);
-    transpose(_a, _at, _n, _n);
-    matMult(temp0, _at, temp1, _n, _n, _n);
-    matAdd(temp1, _q, _pPre, _n * _n);
+    // update measurable (voltage) based on predicted state (SOC), independent of the covariance prediction
+    h(constants, batteryMilliAmps);
+    innovation = Scalar(batteryVoltage) - _h;
+    SOC_KALMAN_PROBE(H);
+
+    steady = isSteady(amps, innovation);
+    if (steady) {
+        // gain from the frozen covariance and the current linearisation
+        gain(pHt, UpdateTag());
+        _frozenSamples++;
+        SOC_KALMAN_PROBE(Gain);
+    } else {
+        for (int i = 0; i < N; i++)
+            previous[i] = _pPost[diagonal(i)];
 
-    // update measurable (voltage) based on predicted state (SOC)
-    h(batteryMilliAmps);
+        // $P_k = A_{k-1} P_{k-1} A^T_{k-1} + Q_{k-1}$ -- updates _pPre
+        predictCovariance(UpdateTag());
+        SOC_KALMAN_PROBE(Predict);
 
-    // $G_k = P_k H^T_k (H_k P_k H^T_k + R)^{-1}$
-    transpose(_H, _Ht, _m, _n);
-    matMult(_pPre, _Ht, temp2, _n, _n, _m);
-    matMult(_H, _pPre, temp3, _m, _n, _n);
-    matMult(temp3, _Ht, temp4, _m, _n, _m);
-    temp5 = 1 / (temp4[0] + _rval);
-    matMultConst(temp2, temp5, _G, _n * _m);
+        // $G_k = P_k H^T_k (H_k P_k H^T_k + R)^{-1}$
+        gain(pHt, UpdateTag());
+        SOC_KALMAN_PROBE(Gain);
+    }
 
     // $\hat{x}_k = \hat{x_k} + G_k(z_k - h(\hat{x}_k))$
-    temp5 = batteryVoltage - _h;
-    matMultConst(_G, temp5, temp3, _n * _m);
-    updateState(temp3, _n * _m);
-    _x[0] = clamp((uint32_t)_x[0], 0, SOC_SCALED_HUNDRED_PERCENT);
-
-    // $P_k = (I - G_k H_k) P_k$
-    matMult(_G, _H, temp0, _n, _m, _n);
-    negate(temp0, _n * _n);
-    diagonalMatrix(1.0, temp1);
-    matAccum(temp0, temp1, _n * _n);
-    matMult(temp0, _pPre, _pPost, _n, _n, _n);
+    matMultConst<N * M>(_G, innovation, correction);
+    updateState(correction);
+    // the correction can take soc below zero, which must not wrap to a large unsigned value
+    _x[0] = clamp(_x[0] < 0 ? 0 : (uint32_t)_x[0], 0, SOC_SCALED_HUNDRED_PERCENT);
+    SOC_KALMAN_PROBE(UpdateState);
+
+    if (!steady) {
+        // $P_k = (I - G_k H_k) P_k$
+        updateCovariance(constants, pHt, UpdateTag());
+        if (_steadyState)
+            settle(previous, amps, innovation);
+        SOC_KALMAN_PROBE(UpdateCovariance);
+    }
 
     _previousSoC = _x[0];
+    _correctedSoC = _x[0];
+    SOC_KALMAN_PROBE_SAMPLE(innovation, pHt);
+
+    if (_trace)
+        trace(isBatteryInFloat);
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::sampleBatch(uint32_t count, const bool* isBatteryInFloat, const int32_t* batteryMilliAmps,
+    const uint32_t* batteryVoltage, const int32_t* batteryMilliWatts, const uint32_t* samplePeriodMilliSec, uint32_t batteryCapacity, uint32_t* soc)
+{
+    SampleConstants constants;
+
+    // the battery and capacity are the same for every row, step() is defined above in this file so it
+    // can be inlined into the loops
+    prepare(batteryCapacity, constants);
+
+    if (soc == NULL) {
+        for (uint32_t i = 0; i < count; i++)
+            step(constants, isBatteryInFloat[i], batteryMilliAmps[i], batteryVoltage[i], batteryMilliWatts[i], samplePeriodMilliSec[i]);
+        return;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        step(constants, isBatteryInFloat[i], batteryMilliAmps[i], batteryVoltage[i], batteryMilliWatts[i], samplePeriodMilliSec[i]);
+        soc[i] = read();
+    }
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::initCovariance(TextbookTag)
+{
+    diagonalMatrix(_pval, _pPost);   // identity(n) * pval
+    diagonalMatrix(_qval, _q);       // identity(n) * qval
+    diagonalMatrix(Scalar(1), _a);   // identity
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+template <typename PackedTag>
+void SoCKalmanT<N, M, Scalar, Update>::initCovariance(PackedTag)
+{
+    // A = I and Q = identity(n) * qval are implied
+    for (int i = 0; i < N; i++)
+        for (int j = i; j < N; j++)
+            _pPost[packed(i, j)] = (i == j) ? _pval : Scalar(0);
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::predictCovariance(TextbookTag)
+{
+    Scalar temp0[N * N];
+    Scalar temp1[N * N];
+
+    matMult<N, N, N>(_a, _pPost, temp0);
+    matMult<N, N, N>(temp0, _at, temp1);
+    matAdd<N * N>(temp1, _q, _pPre);
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+template <typename PackedTag>
+void SoCKalmanT<N, M, Scalar, Update>::predictCovariance(PackedTag)
+{
+    // with A = I the propagation is P + Q, and Q only has a diagonal
+    for (int i = 0; i < COVARIANCE_SIZE; i++)
+        _pPre[i] = _pPost[i];
+    for (int i = 0; i < N; i++)
+        _pPre[packed(i, i)] = _pPre[packed(i, i)] + _qval;
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::gain(Scalar* pHt, TextbookTag)
+{
+    Scalar temp3[M * N];
+    Scalar temp4[M * M];
+
+    transpose<M, N>(_H, _Ht);
+    matMult<N, N, M>(_pPre, _Ht, pHt);
+    matMult<M, N, N>(_H, _pPre, temp3);
+    matMult<M, N, M>(temp3, _Ht, temp4);
+    matMultConst<N * M>(pHt, Scalar(1) / (temp4[0] + _rval), _G);
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+template <typename PackedTag>
+void SoCKalmanT<N, M, Scalar, Update>::gain(Scalar* pHt, PackedTag)
+{
+    // the measurement is a scalar, so H P H^T + R is too and P H^T is the transpose of H P,
+    // summed in the same order as the textbook chain
+    Scalar innovationVariance = Scalar(0);
+
+    for (int i = 0; i < N; i++) {
+        Scalar sum = Scalar(0);
+        for (int k = 0; k < N; k++)
+            sum = sum + _pPre[packed(i, k)] * _H[k];
+        pHt[i] = sum;
+    }
+    for (int k = 0; k < N; k++)
+        innovationVariance = innovationVariance + pHt[k] * _H[k];
+
+    matMultConst<N * M>(pHt, Scalar(1) / (innovationVariance + _rval), _G);
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::updateCovariance(const SampleConstants& constants, const Scalar*, TextbookTag)
+{
+    Scalar temp0[N * N];
+
+    matMult<N, M, N>(_G, _H, temp0);
+    negate<N * N>(temp0);
+    matAccum<N * N>(temp0, constants.identity);
+    matMult<N, N, N>(temp0, _pPre, _pPost);
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::updateCovariance(const SampleConstants&, const Scalar* pHt, SymmetricTag)
+{
+    // (I - G H) P = P - G (P H^T)^T, one multiply per stored entry
+    for (int i = 0; i < N; i++)
+        for (int j = i; j < N; j++)
+            _pPost[packed(i, j)] = _pPre[packed(i, j)] - _G[i] * pHt[j];
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::updateCovariance(const SampleConstants&, const Scalar* pHt, JosephTag)
+{
+    // (I - G H) P (I - G H)^T + G R G^T = P - G (P H^T)^T - (P H^T) G^T + G (H P H^T + R) G^T,
+    // which holds for any gain rather than only the optimal one
+    Scalar innovationVariance = _rval;
+
+    for (int k = 0; k < N; k++)
+        innovationVariance = innovationVariance + _H[k] * pHt[k];
+
+    for (int i = 0; i < N; i++)
+        for (int j = i; j < N; j++)
+            _pPost[packed(i, j)] = _pPre[packed(i, j)] - _G[i] * pHt[j] - pHt[i] * _G[j] + _G[i] * innovationVariance * _G[j];
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::setSteadyStateGain(bool enabled)
+{
+    _steadyState = enabled;
+    _settled = 0;
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::setPreciseIntegration(bool enabled)
+{
+    _preciseIntegration = enabled;
+    _energyRemainder = 0;
+    _chargeRemainder = 0;
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::setCorrectionInterval(uint16_t samples, uint32_t milliSec)
+{
+    _correctionSamples = samples;
+    _correctionMilliSec = milliSec;
+    _pendingSamples = 0;
+    _pendingMilliSec = 0;
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+bool SoCKalmanT<N, M, Scalar, Update>::isCorrectionDue(uint32_t samplePeriodMilliSec)
+{
+    if (_correctionSamples == 0 && _correctionMilliSec == 0)
+        return true;
+
+    _pendingSamples++;
+    _pendingMilliSec += samplePeriodMilliSec;
+    if ((_correctionSamples == 0 || _pendingSamples < _correctionSamples) && (_correctionMilliSec == 0 || _pendingMilliSec < _correctionMilliSec))
+        return false;
+
+    _pendingSamples = 0;
+    _pendingMilliSec = 0;
+    return true;
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+bool SoCKalmanT<N, M, Scalar, Update>::isFrozen()
+{
+    return _steadyState && _settled >= STEADY_SETTLE_SAMPLES;
 }
 
-uint32_t SoCKalman::calculateInitialSoC(uint32_t batteryVoltage)
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+bool SoCKalmanT<N, M, Scalar, Update>::isSteady(int32_t amps, Scalar innovation)
 {
-    // will need to add 24 V compatability
+    if (!isFrozen() || _frozenSamples >= STEADY_REFRESH_SAMPLES)
+        return false;
 
-    const uint8_t VOLTAGES_SIZE = 10;
-    const uint16_t battSoCVoltages[VOLTAGES_SIZE] = { 12720, 12600, 12480, 12360, 12240, 12120, 12000, 11880, 11760, 11640 };
+    // h() keeps the previous linearisation outside the table, which the frozen covariance wasn't validated with
+    if ((uint32_t)_x[0] / SoCOcvTable::SOC_STEP >= SoCOcvTable::SEGMENTS)
+        return false;
 
-    uint8_t index;
-    for (index = 0; index < VOLTAGES_SIZE; index++)
-        if (batteryVoltage > battSoCVoltages[index])
-            break;
+    if (innovation < Scalar(0))
+        innovation = -innovation;
 
-    return (VOLTAGES_SIZE - index) * (SOC_SCALED_HUNDRED_PERCENT / VOLTAGES_SIZE);
+    return (amps < 0 ? -amps : amps) <= _validatedAmps && innovation <= _validatedInnovation;
 }
 
-void SoCKalman::diagonalMatrix(float value, float* result)
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::settle(const Scalar* previous, int32_t amps, Scalar innovation)
+{
+    bool stable = true;
+
+    for (int i = 0; i < N && stable; i++) {
+        Scalar value = _pPost[diagonal(i)];
+        Scalar change = value - previous[i];
+        if (change < Scalar(0))
+            change = -change;
+        if (value < Scalar(0))
+            value = -value;
+        stable = (change * Scalar(STEADY_TOLERANCE) <= value);
+    }
+
+    if (amps < 0)
+        amps = -amps;
+    if (innovation < Scalar(0))
+        innovation = -innovation;
+
+    if (stable) {
+        _settled = (_settled < STEADY_SETTLE_SAMPLES) ? _settled + 1 : _settled;
+        _validatedAmps = (amps > _validatedAmps) ? amps : _validatedAmps;
+        _validatedInnovation = (innovation > _validatedInnovation) ? innovation : _validatedInnovation;
+    } else {
+        _settled = 0;
+        _validatedAmps = amps;
+        _validatedInnovation = innovation;
+    }
+    _frozenSamples = 0;
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::setTrace(TraceRing* trace)
+{
+    _trace = trace;
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::trace(bool isBatteryInFloat)
+{
+    SoCKalmanTraceRecord<N, M> record;
+    int i;
+
+    record.sample = _trace->pushed();
+    // f() recalculates the efficiency on every float sample past the reset duration
+    record.flags = (isBatteryInFloat && _millisecondsInFloat > _floatResetDuration) ? SOC_KALMAN_TRACE_EFFICIENCY : 0;
+    record.batteryEff = _batteryEff;
+    for (i = 0; i < N; i++)
+        record.x[i] = _x[i];
+    record.h = scalarToBits(_h);
+    for (i = 0; i < M * N; i++)
+        record.H[i] = scalarToBits(_H[i]);
+    for (i = 0; i < N * M; i++)
+        record.G[i] = scalarToBits(_G[i]);
+
+    _trace->push(record);
+}
+
+#ifdef SOC_KALMAN_INSTRUMENT
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::setClock(SoCKalmanClock clock)
+{
+    _clock = clock;
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+const SoCKalmanCounters<N, Scalar>& SoCKalmanT<N, M, Scalar, Update>::counters() const
+{
+    return _counters;
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::resetCounters()
+{
+    _counters = SoCKalmanCounters<N, Scalar>();
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+uint32_t SoCKalmanT<N, M, Scalar, Update>::probe(SoCKalmanStage stage, uint32_t start)
+{
+    if (!_clock)
+        return 0;
+
+    uint32_t now = _clock();
+    _counters.cycles[(uint8_t)stage] = now - start;
+    _counters.totalCycles[(uint8_t)stage] += now - start;
+    return now;
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::probeSample(Scalar innovation, const Scalar* pHt)
+{
+    // H P H^T + R from the P H^T the gain was computed with
+    Scalar innovationVariance = _rval;
+
+    for (int k = 0; k < N; k++)
+        innovationVariance = innovationVariance + _H[k] * pHt[k];
+
+    _counters.corrections++;
+    _counters.innovation = innovation;
+    _counters.nis = innovation * innovation / innovationVariance;
+    for (int i = 0; i < N; i++)
+        _counters.pDiagonal[i] = _pPost[diagonal(i)];
+}
+#endif
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+uint8_t SoCKalmanT<N, M, Scalar, Update>::diagonal(uint8_t i)
+{
+    return (Update == SoCKalmanUpdate::Textbook) ? i * (N + 1) : packed(i, i);
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+uint8_t SoCKalmanT<N, M, Scalar, Update>::packed(uint8_t row, uint8_t col)
+{
+    if (row > col) {
+        uint8_t swap = row;
+        row = col;
+        col = swap;
+    }
+    return row * N - row * (row - 1) / 2 + (col - row);
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+uint32_t SoCKalmanT<N, M, Scalar, Update>::calculateInitialSoC(uint32_t batteryVoltage)
+{
+    return SoCOcvTable::estimateSoC(batteryVoltage);
+}
+
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::diagonalMatrix(Scalar value, Scalar* result)
 {
     int i, j;
 
-    for (i = 0; i < _n; i++)
-        for (j = 0; j < _n; j++) {
+    for (i = 0; i < N; i++)
+        for (j = 0; j < N; j++) {
             if (i == j)
-                result[i * _n + j] = value;
+                result[i * N + j] = value;
             else
-                result[i * _n + j] = 0;
+                result[i * N + j] = Scalar(0);
         }
 }
 
-void SoCKalman::matMult(float* a, float* b, float* result, uint8_t arows, uint8_t acols, uint8_t bcols)
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+template <uint8_t ARows, uint8_t ACols, uint8_t BCols>
+void SoCKalmanT<N, M, Scalar, Update>::matMult(const Scalar* a, const Scalar* b, Scalar* result)
 {
     int i, j, k;
 
-    for (i = 0; i < arows; i++)
-        for (j = 0; j < bcols; j++) {
-            result[i * bcols + j] = 0;
-            for (k = 0; k < acols; k++)
-                result[i * bcols + j] += a[i * acols + k] * b[k * bcols + j];
+    for (i = 0; i < ARows; i++)
+        for (j = 0; j < BCols; j++) {
+            Scalar sum = Scalar(0);
+            for (k = 0; k < ACols; k++)
+                sum = sum + a[i * ACols + k] * b[k * BCols + j];
+            result[i * BCols + j] = sum;
         }
 }
 
-void SoCKalman::matMultConst(float* a, float b, float* result, uint8_t length)
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+template <uint8_t Length>
+void SoCKalmanT<N, M, Scalar, Update>::matMultConst(const Scalar* a, Scalar b, Scalar* result)
 {
     int i;
 
-    for (i = 0; i < length; i++) {
+    for (i = 0; i < Length; i++) {
         result[i] = a[i] * b;
     }
 }
 
-void SoCKalman::matAdd(float* a, float* b, float* result, uint8_t length)
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+template <uint8_t Length>
+void SoCKalmanT<N, M, Scalar, Update>::matAdd(const Scalar* a, const Scalar* b, Scalar* result)
 {
     int i;
 
-    for (i = 0; i < length; i++) {
+    for (i = 0; i < Length; i++) {
         result[i] = a[i] + b[i];
     }
 }
 
-void SoCKalman::matAccum(float* a, float* b, uint8_t length)
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+template <uint8_t Length>
+void SoCKalmanT<N, M, Scalar, Update>::matAccum(Scalar* a, const Scalar* b)
 {
     // not tested directly but pretty simple
     int i;
-    for (i = 0; i < length; i++) {
+    for (i = 0; i < Length; i++) {
         a[i] = a[i] + b[i];
     }
 }
 
-void SoCKalman::transpose(float* a, float* result, uint8_t rows, uint8_t cols)
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+template <uint8_t Rows, uint8_t Cols>
+void SoCKalmanT<N, M, Scalar, Update>::transpose(const Scalar* a, Scalar* result)
 {
     int i, j;
 
-    for (i = 0; i < rows; i++)
-        for (j = 0; j < cols; j++) {
-            result[j * rows + i] = a[i * cols + j];
+    for (i = 0; i < Rows; i++)
+        for (j = 0; j < Cols; j++) {
+            result[j * Rows + i] = a[i * Cols + j];
         }
 }
 
-void SoCKalman::negate(float* a, uint8_t length)
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+template <uint8_t Length>
+void SoCKalmanT<N, M, Scalar, Update>::negate(Scalar* a)
 {
-    for (int i = 0; i < _n * _n; i++) {
-        a[i] = -1 * a[i];
+    for (int i = 0; i < Length; i++) {
+        a[i] = -a[i];
     }
 }
 
-void SoCKalman::updateState(float* a, uint8_t length)
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+void SoCKalmanT<N, M, Scalar, Update>::updateState(const Scalar* a)
 {
-    for (int i = 0; i < 3; i++) {
-        _x[i] = _x[i] + a[i] * 100;
+    for (int i = 0; i < N; i++) {
+        _x[i] = correctState(_x[i], a[i] * Scalar(100));
     }
 }
 
-uint8_t SoCKalman::inverse(float* a, float* result)
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+uint8_t SoCKalmanT<N, M, Scalar, Update>::inverse(const Scalar* a, Scalar* result)
 {
     int i, j;
-    float determinant = 0;
+    Scalar determinant = Scalar(0);
 
     // find determinant first
     for (i = 0; i < 3; i++) {
         determinant = determinant + (a[i] * (a[3 + (i + 1) % 3] * a[6 + (i + 2) % 3] - a[3 + (i + 2) % 3] * a[6 + (i + 1) % 3]));
     }
 
-    if (determinant == 0)
+    if (determinant == Scalar(0))
         return 1;
 
     // use cofactors to calculate resulting inverse
@@ -253,7 +874,8 @@ uint8_t SoCKalman::inverse(float* a, float* result)
     return 0;
 }
 
-uint32_t SoCKalman::clamp(uint32_t value, uint32_t min, uint32_t max)
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update>
+uint32_t SoCKalmanT<N, M, Scalar, Update>::clamp(uint32_t value, uint32_t min, uint32_t max)
 {
     if (value > max) {
         return max;
@@ -262,3 +884,10 @@ uint32_t SoCKalman::clamp(uint32_t value, uint32_t min, uint32_t max)
     }
     return value;
 }
+
+template class SoCKalmanT<3, 1, float, SoCKalmanUpdate::Textbook>;
+template class SoCKalmanT<3, 1, float, SoCKalmanUpdate::Symmetric>;
+template class SoCKalmanT<3, 1, float, SoCKalmanUpdate::Joseph>;
+template class SoCKalmanT<3, 1, Fixed16, SoCKalmanUpdate::Textbook>;
+template class SoCKalmanT<3, 1, Fixed16, SoCKalmanUpdate::Symmetric>;
+template class SoCKalmanT<3, 1, Fixed16, SoCKalmanUpdate::Joseph>;
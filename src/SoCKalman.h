@@ -1,16 +1,64 @@
 #pragma once
 
 #include <stdint.h>
+#include <type_traits>
+
+#include "FixedPoint.h"
+#include "SoCKalmanProbe.h"
+#include "SoCKalmanTrace.h"
+
+/**
+ * @brief How sample() propagates and updates the covariance
+ *
+ * Textbook   full 3x3 matrices through A P A^T + Q and (I - G H) P, as written in the literature
+ * Symmetric  upper triangle of P only, A = I propagation skipped and the scalar innovation applied as
+ *            a rank-1 downdate P - G (P H^T)^T
+ * Joseph     as Symmetric, with the Joseph form (I - G H) P (I - G H)^T + G R G^T expanded for a scalar
+ *            measurement, which keeps P positive definite when rounding makes the gain slightly off
+ */
+enum class SoCKalmanUpdate : uint8_t
+{
+    Textbook,
+    Symmetric,
+    Joseph
+};
 
 /**
  * @brief Calculated battery state of charge (SoC) using a extended kalman filter.
- * Math currently uses floating point arithmetic. Can only record diffreences in soc at a 30 min interval
- * or greater.
+ * Math uses floating point arithmetic, or Q15.16 fixed point when built with SOC_KALMAN_FIXED_POINT.
+ * Can only record diffreences in soc at a 30 min interval or greater, unless setPreciseIntegration() is on.
+ *
+ * Dimensions are compile time constants so all storage is fixed size and the matrix kernels unroll:
+ * N states [soc, resistance, offset], M measurements [voltage] and Scalar is the arithmetic type of the
+ * covariance and gain. Worst case stack use of sample() is SAMPLE_SCRATCH_SIZE Scalars. Update selects
+ * the covariance update, SOC_KALMAN_SYMMETRIC or SOC_KALMAN_JOSEPH select it for the SoCKalman typedefs.
  */
-class SoCKalman
+template <uint8_t N, uint8_t M, typename Scalar, SoCKalmanUpdate Update = SoCKalmanUpdate::Textbook>
+class SoCKalmanT
 {
+    static_assert(N == 3 && M == 1, "model is defined for 3 states and 1 measurement");
+
   public:
-    SoCKalman();
+    typedef Scalar ScalarType;
+    typedef SoCKalmanTraceRing<SoCKalmanTraceRecord<N, M> > TraceRing;
+
+    static const uint8_t SAMPLE_SCRATCH_SIZE = 2 * N * N + 2 * N * M + M * M + 1;
+
+    // covariance entries stored, the full matrix for the textbook chain and the upper triangle otherwise
+    static const uint8_t COVARIANCE_SIZE = (Update == SoCKalmanUpdate::Textbook) ? N * N : N * (N + 1) / 2;
+
+    static const uint8_t SNAPSHOT_VERSION = 1;
+    // header, soc, efficiency, float timer, states, covariance, linearisation and crc, 4 bytes each
+    static const uint8_t SNAPSHOT_SIZE = 4 * (1 + 3 + N + COVARIANCE_SIZE + M + M * N + 1);
+
+    SoCKalmanT();
+
+    /**
+     * @brief construct with tuned noise parameters instead of the defaults (0.1, 0.0001, 0.1)
+     *
+     * @param pval initial state covariance, qval process noise, rval measurement noise
+     */
+    SoCKalmanT(float pval, float qval, float rval);
 
     /**
      * @brief initial soc is either passed in after being retrieved from local storage,
@@ -20,6 +68,14 @@ class SoCKalman
      */
     void init(bool isBattery12V, bool isBatteryLithium, uint32_t batteryEff, uint32_t batteryVoltage, uint32_t initialSoC);
 
+    /**
+     * @brief init with new noise parameters, lets one instance be reused across tuning runs
+     *
+     * @param batteryEff, batteryVoltage, initialSoC (optional), pval, qval, rval
+     */
+    void init(bool isBattery12V, bool isBatteryLithium, uint32_t batteryEff, uint32_t batteryVoltage, uint32_t initialSoC, float pval,
+        float qval, float rval);
+
     /**
      * @brief return current state of charge
      *
@@ -27,6 +83,14 @@ class SoCKalman
      */
     uint32_t read();
 
+    /**
+     * @brief return the soc as of the last measurement update, read() also follows the prediction
+     * of the samples since then
+     *
+     * @return uint32_t soc
+     */
+    uint32_t readCorrected();
+
     /**
      * @brief return current battery efficiency
      *
@@ -36,7 +100,7 @@ class SoCKalman
 
     /**
      * @brief calculate new soc based on how much power entered/exited the battery in a given
-     * window as well as the battery voltage, also recalculate battery efficiency and 
+     * window as well as the battery voltage, also recalculate battery efficiency and
      * reset soc = 100% if battery is in float
      *
      * @param isBatteryInFloat, isBatteryLithium, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity
@@ -44,30 +108,160 @@ class SoCKalman
     void sample(bool isBatteryInFloat, int32_t batteryMilliAmps, uint32_t batteryVoltage, int32_t batteryMilliWatts, uint32_t samplePeriodMilliSec,
         uint32_t batteryCapacity);
 
+    /**
+     * @brief sample a buffer of rows in one call, row i of every span is one sample() with the same
+     * batteryCapacity. Spans are read in place, soc (optional, may be NULL) receives read() after each row.
+     * What sample() derives from the battery rather than the row, the ocv curve, the capacity scaling and
+     * the model matrices of the textbook chain, is set up once per call instead of once per row. That
+     * saves most for the textbook chain, the packed forms spend nearly all of a row in its covariance.
+     *
+     * @param count, isBatteryInFloat, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity, soc
+     */
+    void sampleBatch(uint32_t count, const bool* isBatteryInFloat, const int32_t* batteryMilliAmps, const uint32_t* batteryVoltage,
+        const int32_t* batteryMilliWatts, const uint32_t* samplePeriodMilliSec, uint32_t batteryCapacity, uint32_t* soc);
+
+    /**
+     * @brief once the covariance has settled, freeze it and only compute the gain from it and the current
+     * linearisation, skipping covariance propagation and update. A full update still runs every
+     * STEADY_REFRESH_SAMPLES samples, outside the ocv table and for currents or innovations larger than
+     * those seen while settling, and any full update that moves the covariance starts settling again.
+     * Off by default.
+     *
+     * @param enabled
+     */
+    void setSteadyStateGain(bool enabled);
+
+    /**
+     * @brief integrate energy exactly instead of in whole watts and whole hours, so sample periods down
+     * to a second move the soc. Remainders below one soc step are carried between samples, a series of
+     * short samples ends at the same soc as one long sample of the same energy. Off by default, which
+     * keeps the original coulomb counting model.
+     *
+     * @param enabled
+     */
+    void setPreciseIntegration(bool enabled);
+
+    /**
+     * @brief run the measurement update (h(), gain and state and covariance update) at a lower rate
+     * than the prediction. Every sample still integrates energy and grows the covariance by Q, the
+     * update runs once samples samples or milliSec of sample periods have passed since the last one,
+     * whichever comes first. Zero disables either limit, both zero (the default) updates every sample.
+     *
+     * @param samples, milliSec
+     */
+    void setCorrectionInterval(uint16_t samples, uint32_t milliSec);
+
+    /**
+     * @brief serialise the full filter state, little endian whatever the target, followed by a crc32
+     *
+     * @param buffer, size at least SNAPSHOT_SIZE
+     *
+     * @return uint8_t bytes written, 0 if the buffer is too small
+     */
+    uint8_t snapshot(uint8_t* buffer, uint8_t size);
+
+    /**
+     * @brief resume from a snapshot instead of calling init, noise parameters are kept from construction.
+     * The state is left untouched if the snapshot is truncated, corrupt, from another version or was
+     * taken by a filter with a different arithmetic type.
+     *
+     * @param buffer, size
+     *
+     * @return bool true if the state was restored
+     */
+    bool restore(const uint8_t* buffer, uint8_t size);
+
+    /**
+     * @brief push a record of every following sample() into a ring, NULL (the default) stops tracing.
+     * The ring is not owned and is left attached by init and restore.
+     *
+     * @param trace
+     */
+    void setTrace(TraceRing* trace);
+
+#ifdef SOC_KALMAN_INSTRUMENT
+    /**
+     * @brief set the tick source the stages of sample() are timed with, stages aren't timed without one
+     *
+     * @param clock
+     */
+    void setClock(SoCKalmanClock clock);
+
+    /**
+     * @brief return the counters, updated at the end of every sample()
+     *
+     * @return const SoCKalmanCounters<N, Scalar>&
+     */
+    const SoCKalmanCounters<N, Scalar>& counters() const;
+
+    void resetCounters();
+#endif
+
   private:
+    static const uint8_t _n = N;
+    static const uint8_t _m = M;
+    static const uint32_t SOC_SCALED_HUNDRED_PERCENT = 100000;               // 100% charge = 100000
+    static const uint32_t SOC_SCALED_MAX = 2 * SOC_SCALED_HUNDRED_PERCENT;   // allow soc to track up higher than 100% to gauge efficiency
+    // the transition and process noise matrices are only materialised by the textbook chain
+    static const uint8_t MODEL_SIZE = (Update == SoCKalmanUpdate::Textbook) ? N * N : 1;
+
+    static const uint8_t STEADY_SETTLE_SAMPLES = 8;     // consecutive stable full updates before freezing
+    static const uint8_t STEADY_TOLERANCE = 8;          // stable while the P diagonal moves less than 1/8
+    static const uint8_t STEADY_REFRESH_SAMPLES = 32;   // frozen samples between full updates
+
+    typedef std::integral_constant<SoCKalmanUpdate, SoCKalmanUpdate::Textbook> TextbookTag;
+    typedef std::integral_constant<SoCKalmanUpdate, SoCKalmanUpdate::Symmetric> SymmetricTag;
+    typedef std::integral_constant<SoCKalmanUpdate, SoCKalmanUpdate::Joseph> JosephTag;
+    typedef std::integral_constant<SoCKalmanUpdate, Update> UpdateTag;
+
+    /**
+     * @brief what sample() derives from the battery and batteryCapacity rather than from the row,
+     * set up by prepare() once per sample() or sampleBatch()
+     */
+    struct SampleConstants {
+        const uint32_t* curve;          // the battery's segments in SoCOcvTable
+        uint32_t batteryCapacity;       // watt hours
+        int64_t scaledCapacity;         // batteryCapacity in milliwatt hours, precise integration
+        Scalar identity[MODEL_SIZE];    // I of (I - G H), textbook chain only
+    };
+
     uint32_t _previousSoC;
     uint32_t _batteryEff;
-    float _pval;
-    float _qval;
-    float _rval;
-    float _pPre[9];
-    float _pPost[9];
-    float _q[9];
-    float _a[9];
-    float _at[9];
-    float _h;
-    float _H[3];
-    float _Ht[3];
-    float _G[3];
+    Scalar _pval;
+    Scalar _qval;
+    Scalar _rval;
+    Scalar _pPre[COVARIANCE_SIZE];
+    Scalar _pPost[COVARIANCE_SIZE];
+    Scalar _q[MODEL_SIZE];
+    Scalar _a[MODEL_SIZE];
+    Scalar _at[MODEL_SIZE];
+    Scalar _h;
+    Scalar _H[M * N];
+    Scalar _Ht[N * M];
+    Scalar _G[N * M];
+    bool _steadyState;
+    uint8_t _settled;          // consecutive stable full updates
+    uint8_t _frozenSamples;    // samples since the last full update
+    int32_t _validatedAmps;    // largest whole amps seen while settling
+    Scalar _validatedInnovation;   // largest innovation seen while settling
+    bool _preciseIntegration;
+    int32_t _energyRemainder;   // mW ms short of a whole mWh
+    int32_t _chargeRemainder;   // mWh x efficiency short of a whole soc step
+    uint16_t _correctionSamples;
+    uint16_t _pendingSamples;       // samples since the last measurement update
+    uint32_t _correctionMilliSec;
+    uint32_t _pendingMilliSec;      // sample periods since the last measurement update
+    uint32_t _correctedSoC;
     bool _isBattery12V;
     bool _isBatteryLithium;
     uint32_t _millisecondsInFloat = 0;
     uint32_t _floatResetDuration = 600000;  // 10 minutes in milliseconds
-    int32_t _x[3] = { 0, 0, 0 };
-    uint8_t _n = 3;
-    uint8_t _m = 1;
-    const uint32_t SOC_SCALED_HUNDRED_PERCENT = 100000;  // 100% charge = 100000
-    const uint32_t SOC_SCALED_MAX = 2 * SOC_SCALED_HUNDRED_PERCENT;  // allow soc to track up higher than 100% to gauge efficiency
+    int32_t _x[N] = { 0, 0, 0 };
+    TraceRing* _trace = 0;
+#ifdef SOC_KALMAN_INSTRUMENT
+    SoCKalmanClock _clock = 0;
+    SoCKalmanCounters<N, Scalar> _counters = {};
+#endif
 
     /**
      * @brief estimate an initial soc based on battery voltage
@@ -78,38 +272,173 @@ class SoCKalman
      */
     uint32_t calculateInitialSoC(uint32_t batteryVoltage);
 
+    /**
+     * @brief set up the constants of sample() for the battery and batteryCapacity, and A^T of the
+     * textbook chain
+     *
+     * @param batteryCapacity, constants
+     */
+    void prepare(uint32_t batteryCapacity, SampleConstants& constants);
+
+    /**
+     * @brief sample() with its constants already set up
+     *
+     * @param constants, isBatteryInFloat, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec
+     */
+    void step(const SampleConstants& constants, bool isBatteryInFloat, int32_t batteryMilliAmps, uint32_t batteryVoltage, int32_t batteryMilliWatts,
+        uint32_t samplePeriodMilliSec);
+
     /**
      * @brief project the state of charge ahead one step using a Coulomb counting model
-     * 
-     * @param isBatteryinFloat, batteryMilliWatts, samplePeridoMilliSec, batteryCapacity
+     *
+     * @param constants, isBatteryinFloat, batteryMilliWatts, samplePeridoMilliSec
      */
-    void f(bool isBatteryInFloat, int32_t batteryMilliWatts, uint32_t samplePeriodMilliSec, uint32_t batteryCapacity);
+    void f(const SampleConstants& constants, bool isBatteryInFloat, int32_t batteryMilliWatts, uint32_t samplePeriodMilliSec);
 
     /**
      * @brief predict the measurable value (voltage) ahead one step using the newly estimated state of charge
-     * 
-     * @param isBatteryLithium, batteryMilliAmps
+     *
+     * @param constants, batteryMilliAmps
      */
-    void h(int32_t batteryMilliAmps);
+    void h(const SampleConstants& constants, int32_t batteryMilliAmps);
 
-    void diagonalMatrix(float value, float* result);
+    /**
+     * @brief reset the covariance to pval on the diagonal and set up the model matrices
+     */
+    void initCovariance(TextbookTag);
+    template <typename PackedTag>
+    void initCovariance(PackedTag);
 
-    void matMult(float* a, float* b, float* result, uint8_t arows, uint8_t acols, uint8_t bcols);
+    /**
+     * @brief propagate the covariance ahead one step, updates _pPre. The textbook chain uses the A^T
+     * prepare() computed
+     */
+    void predictCovariance(TextbookTag);
+    template <typename PackedTag>
+    void predictCovariance(PackedTag);
 
-    void matMultConst(float* a, float b, float* result, uint8_t length);
+    /**
+     * @brief compute the gain _G from _pPre and the linearisation _H
+     *
+     * @param pHt receives P H^T, reused by the covariance update
+     */
+    void gain(Scalar* pHt, TextbookTag);
+    template <typename PackedTag>
+    void gain(Scalar* pHt, PackedTag);
 
-    void matAdd(float* a, float* b, float* result, uint8_t length);
+    /**
+     * @brief update the covariance with the new gain, updates _pPost
+     *
+     * @param constants, pHt P H^T from gain()
+     */
+    void updateCovariance(const SampleConstants& constants, const Scalar* pHt, TextbookTag);
+    void updateCovariance(const SampleConstants& constants, const Scalar* pHt, SymmetricTag);
+    void updateCovariance(const SampleConstants& constants, const Scalar* pHt, JosephTag);
 
-    void matAccum(float* a, float* b, uint8_t length);
+    /**
+     * @brief count a sample towards the correction interval
+     *
+     * @param samplePeriodMilliSec
+     *
+     * @return bool true if the measurement update is due, which restarts the interval
+     */
+    bool isCorrectionDue(uint32_t samplePeriodMilliSec);
 
-    void transpose(float* a, float* result, uint8_t rows, uint8_t cols);
+    /**
+     * @brief return true if the steady state gain has frozen the covariance
+     */
+    bool isFrozen();
 
-    void negate(float* a, uint8_t length);
+    /**
+     * @brief return true if the frozen covariance may stand in for a full update of this sample
+     *
+     * @param amps, innovation
+     */
+    bool isSteady(int32_t amps, Scalar innovation);
 
-    void updateState(float* a, uint8_t length);
+    /**
+     * @brief count how long the covariance has been stable after a full update
+     *
+     * @param previous P diagonal before the update, amps, innovation
+     */
+    void settle(const Scalar* previous, int32_t amps, Scalar innovation);
+
+    /**
+     * @brief push the diagnostics of a finished sample into _trace
+     *
+     * @param isBatteryInFloat
+     */
+    void trace(bool isBatteryInFloat);
+
+#ifdef SOC_KALMAN_INSTRUMENT
+    /**
+     * @brief record the ticks since start against stage
+     *
+     * @param stage, start
+     *
+     * @return uint32_t start of the next stage
+     */
+    uint32_t probe(SoCKalmanStage stage, uint32_t start);
+
+    /**
+     * @brief record the innovation, nis and P diagonal of a finished measurement update
+     *
+     * @param innovation, pHt P H^T from gain()
+     */
+    void probeSample(Scalar innovation, const Scalar* pHt);
+#endif
+
+    /**
+     * @brief index of diagonal entry i in the covariance storage
+     */
+    static uint8_t diagonal(uint8_t i);
+
+    /**
+     * @brief index of entry (row, col) in the upper triangle storage of a symmetric matrix
+     */
+    static uint8_t packed(uint8_t row, uint8_t col);
+
+    void diagonalMatrix(Scalar value, Scalar* result);
+
+    template <uint8_t ARows, uint8_t ACols, uint8_t BCols>
+    void matMult(const Scalar* a, const Scalar* b, Scalar* result);
+
+    template <uint8_t Length>
+    void matMultConst(const Scalar* a, Scalar b, Scalar* result);
 
-    uint8_t inverse(float* a, float* result);
+    template <uint8_t Length>
+    void matAdd(const Scalar* a, const Scalar* b, Scalar* result);
+
+    template <uint8_t Length>
+    void matAccum(Scalar* a, const Scalar* b);
+
+    template <uint8_t Rows, uint8_t Cols>
+    void transpose(const Scalar* a, Scalar* result);
+
+    template <uint8_t Length>
+    void negate(Scalar* a);
+
+    void updateState(const Scalar* a);
+
+    uint8_t inverse(const Scalar* a, Scalar* result);
 
     uint32_t clamp(uint32_t value, uint32_t min, uint32_t max);
 
-};
\ No newline at end of file
+};
+
+#if defined(SOC_KALMAN_JOSEPH)
+#define SOC_KALMAN_UPDATE SoCKalmanUpdate::Joseph
+#elif defined(SOC_KALMAN_SYMMETRIC)
+#define SOC_KALMAN_UPDATE SoCKalmanUpdate::Symmetric
+#else
+#define SOC_KALMAN_UPDATE SoCKalmanUpdate::Textbook
+#endif
+
+typedef SoCKalmanT<3, 1, float, SOC_KALMAN_UPDATE> SoCKalmanFloat;
+typedef SoCKalmanT<3, 1, Fixed16, SOC_KALMAN_UPDATE> SoCKalmanFixed;
+
+#ifdef SOC_KALMAN_FIXED_POINT
+typedef SoCKalmanFixed SoCKalman;
+#else
+typedef SoCKalmanFloat SoCKalman;
+#endif
@@ -0,0 +1,162 @@
+#include "SoCKalmanCompact.h"
+#include "SoCOcvTable.h"
+
+SoCKalmanCompact::SoCKalmanCompact() :
+    _pval(0.1),
+    _qval(0.0001),
+    _rval(0.1)
+{}
+
+SoCKalmanCompact::SoCKalmanCompact(float pval, float qval, float rval) :
+    _pval(pval),
+    _qval(qval),
+    _rval(rval)
+{}
+
+void SoCKalmanCompact::init(SoCKalmanState& state, bool isBattery12V, bool isBatteryLithium, uint32_t batteryEff, uint32_t batteryVoltage,
+    uint32_t initialSoC)
+{
+    state.batteryEff = clamp(batteryEff, 0, EFFICIENCY_MAX);
+    state.isBattery12V = isBattery12V;
+    state.isBatteryLithium = isBatteryLithium;
+
+    // use stored soc, unless it's out of range, in which case calculate new starting point
+    state.soc = (initialSoC <= SOC_SCALED_MAX)
+        ? initialSoC
+        : SoCOcvTable::estimateSoC(batteryVoltage);
+
+    state.millisecondsInFloat = 0;
+    state.resistance = 0;
+    state.offset = 0;
+    for (int i = 0; i < 6; i++)
+        state.p[i] = (i == 0 || i == 3 || i == 5) ? _pval : 0;   // identity(n) * pval
+    state.segment = NO_SEGMENT;
+    state.h = 0;
+    state.amps = 0;
+}
+
+uint32_t SoCKalmanCompact::read(const SoCKalmanState& state)
+{
+    // do not excede 0-100% bounds
+    return clamp(state.soc, 0, SOC_SCALED_HUNDRED_PERCENT);
+}
+
+uint32_t SoCKalmanCompact::efficiency(const SoCKalmanState& state)
+{
+    return state.batteryEff;
+}
+
+void SoCKalmanCompact::sample(SoCKalmanState& state, bool isBatteryInFloat, int32_t batteryMilliAmps, uint32_t batteryVoltage,
+    int32_t batteryMilliWatts, uint32_t samplePeriodMilliSec, uint32_t batteryCapacity)
+{
+    int32_t x[3];
+    float H[3] = { 0, 0, 0 };
+    float predicted = 0;
+    float p[6];
+    float pHt[3];
+    float G[3];
+    uint32_t midVoltage = 0;
+    uint32_t gradient = 0;
+    int i;
+
+    x[0] = f(state, isBatteryInFloat, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity);
+    x[1] = state.resistance;
+    x[2] = state.offset;
+
+    // rebuild the linearisation from the record, h() only replaces it inside the ocv table
+    h(state, x[0], batteryMilliAmps);
+    if (state.segment != NO_SEGMENT) {
+        SoCOcvTable::lookup(state.isBattery12V, state.isBatteryLithium, state.segment * SoCOcvTable::SOC_STEP, midVoltage, gradient);
+        predicted = state.h;
+        H[0] = gradient;
+        H[1] = state.amps;
+        H[2] = 1;
+    }
+    float innovation = (float)batteryVoltage - predicted;
+
+    // the packed chain of SoCKalmanT with the same order of every float operation, so results are identical
+    // $P_k = P_{k-1} + Q$
+    for (i = 0; i < 6; i++)
+        p[i] = state.p[i];
+    p[0] = p[0] + _qval;
+    p[3] = p[3] + _qval;
+    p[5] = p[5] + _qval;
+
+    // $G_k = P_k H^T_k (H_k P_k H^T_k + R)^{-1}$
+    pHt[0] = p[0] * H[0] + p[1] * H[1] + p[2] * H[2];
+    pHt[1] = p[1] * H[0] + p[3] * H[1] + p[4] * H[2];
+    pHt[2] = p[2] * H[0] + p[4] * H[1] + p[5] * H[2];
+    float inverse = 1 / (pHt[0] * H[0] + pHt[1] * H[1] + pHt[2] * H[2] + _rval);
+    for (i = 0; i < 3; i++)
+        G[i] = pHt[i] * inverse;
+
+    // $\hat{x}_k = \hat{x_k} + G_k(z_k - h(\hat{x}_k))$
+    for (i = 0; i < 3; i++)
+        x[i] = (int32_t)(x[i] + G[i] * innovation * 100);
+    state.soc = clamp(x[0] < 0 ? 0 : (uint32_t)x[0], 0, SOC_SCALED_HUNDRED_PERCENT);
+    state.resistance = x[1];
+    state.offset = x[2];
+
+    // $P_k = P_k - G_k (P_k H^T_k)^T$
+    state.p[0] = p[0] - G[0] * pHt[0];
+    state.p[1] = p[1] - G[0] * pHt[1];
+    state.p[2] = p[2] - G[0] * pHt[2];
+    state.p[3] = p[3] - G[1] * pHt[1];
+    state.p[4] = p[4] - G[1] * pHt[2];
+    state.p[5] = p[5] - G[2] * pHt[2];
+}
+
+int32_t SoCKalmanCompact::f(SoCKalmanState& state, bool isBatteryInFloat, int32_t batteryMilliWatts, uint32_t samplePeriodMilliSec,
+    uint32_t batteryCapacity)
+{
+    uint32_t milliSecToHours = 3600000;
+    uint32_t previousSoC = state.soc;
+    uint32_t batteryEff = state.batteryEff;
+    int32_t soc = previousSoC;
+
+    // same integer expressions as SoCKalman::f() so both engines round identically
+    int32_t powerChange = ((batteryMilliWatts / 1000) * batteryEff * (samplePeriodMilliSec / milliSecToHours));
+    uint32_t newSoC = (soc * batteryCapacity + powerChange) / batteryCapacity;
+
+    soc = newSoC;
+
+    if (isBatteryInFloat) {
+        uint32_t millisecondsInFloat = state.millisecondsInFloat + samplePeriodMilliSec;
+        state.millisecondsInFloat = (millisecondsInFloat > FLOAT_TIMER_MAX) ? FLOAT_TIMER_MAX : millisecondsInFloat;
+        if (millisecondsInFloat > FLOAT_RESET_DURATION) {
+            // an empty battery says nothing about the efficiency, keep it
+            if (previousSoC > 0) {
+                batteryEff = (uint64_t)batteryEff * (uint64_t)SOC_SCALED_HUNDRED_PERCENT / previousSoC;
+                state.batteryEff = clamp(batteryEff, 0, SOC_SCALED_HUNDRED_PERCENT);
+            }
+            soc = SOC_SCALED_HUNDRED_PERCENT;
+        }
+    } else {
+        state.millisecondsInFloat = 0;
+    }
+
+    return soc;
+}
+
+void SoCKalmanCompact::h(SoCKalmanState& state, int32_t soc, int32_t batteryMilliAmps)
+{
+    uint32_t midVoltage;
+    uint32_t gradient;
+    int32_t amps = batteryMilliAmps / 1000;
+
+    if (SoCOcvTable::lookup(state.isBattery12V, state.isBatteryLithium, soc, midVoltage, gradient)) {
+        state.h = midVoltage + (amps * state.resistance / 100) + state.offset / 100;
+        state.amps = (amps > INT16_MAX) ? INT16_MAX : (amps < INT16_MIN) ? INT16_MIN : amps;
+        state.segment = (uint32_t)soc / SoCOcvTable::SOC_STEP;
+    }
+}
+
+uint32_t SoCKalmanCompact::clamp(uint32_t value, uint32_t min, uint32_t max)
+{
+    if (value > max) {
+        return max;
+    } else if (value < min) {
+        return min;
+    }
+    return value;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Persistent state of one filter and nothing else, for servers that keep every node resident.
+ * Noise parameters, model matrices and scratch live in SoCKalmanCompact, constants are not copied per
+ * instance and the soc kept twice by SoCKalman (_previousSoC and _x[0]) is stored once. Fields are
+ * narrowed to the range the filter can reach: the soc is at most SOC_SCALED_MAX, the efficiency is
+ * clamped to 100% by f(), the float timer saturates above the float reset duration and the last
+ * linearisation is kept as the ocv segment it was looked up in.
+ */
+struct SoCKalmanState {
+    uint64_t soc : 18;                   // _x[0]
+    uint64_t batteryEff : 17;            // at most 131071, init saturates larger values
+    uint64_t millisecondsInFloat : 20;   // saturates above the float reset duration
+    uint64_t segment : 7;                // ocv segment of _H[0], SoCKalmanCompact::NO_SEGMENT before the first lookup
+    uint64_t isBattery12V : 1;
+    uint64_t isBatteryLithium : 1;
+    int32_t resistance;   // _x[1]
+    int32_t offset;       // _x[2]
+    float p[6];           // upper triangle of _pPost, row major
+    uint32_t h;           // last predicted voltage, kept while the soc is outside the ocv table
+    int16_t amps;         // _H[1], saturates at 32767 A
+};
+
+// published footprint of SoCKalmanState, checked by the tests
+static const size_t SOC_KALMAN_STATE_SIZE = 48;
+
+/**
+ * @brief Engine that advances SoCKalmanState records owned by the caller, so a million nodes cost a
+ * million states and one engine. Results match SoCKalmanT<3, 1, float, SoCKalmanUpdate::Symmetric>
+ * sample for sample. Steady state gain, precise integration, correction intervals and tracing are
+ * options of SoCKalman only, their state isn't part of the record.
+ */
+class SoCKalmanCompact
+{
+  public:
+    static const uint8_t NO_SEGMENT = 0x7F;
+
+    SoCKalmanCompact();
+
+    /**
+     * @brief construct with tuned noise parameters instead of the defaults (0.1, 0.0001, 0.1),
+     * shared by every state this engine advances
+     *
+     * @param pval initial state covariance, qval process noise, rval measurement noise
+     */
+    SoCKalmanCompact(float pval, float qval, float rval);
+
+    /**
+     * @brief initialise a state, see SoCKalman::init()
+     *
+     * @param state, isBattery12V, isBatteryLithium, batteryEff, batteryVoltage, initialSoC (optional)
+     */
+    void init(SoCKalmanState& state, bool isBattery12V, bool isBatteryLithium, uint32_t batteryEff, uint32_t batteryVoltage,
+        uint32_t initialSoC);
+
+    /**
+     * @brief return current state of charge of a state
+     *
+     * @param state
+     *
+     * @return uint32_t soc
+     */
+    uint32_t read(const SoCKalmanState& state);
+
+    /**
+     * @brief return current battery efficiency of a state
+     *
+     * @param state
+     *
+     * @return uint32_t batteryEff
+     */
+    uint32_t efficiency(const SoCKalmanState& state);
+
+    /**
+     * @brief advance a state by one sample, see SoCKalman::sample()
+     *
+     * @param state, isBatteryInFloat, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity
+     */
+    void sample(SoCKalmanState& state, bool isBatteryInFloat, int32_t batteryMilliAmps, uint32_t batteryVoltage, int32_t batteryMilliWatts,
+        uint32_t samplePeriodMilliSec, uint32_t batteryCapacity);
+
+  private:
+    static const uint32_t SOC_SCALED_HUNDRED_PERCENT = 100000;
+    static const uint32_t SOC_SCALED_MAX = 2 * SOC_SCALED_HUNDRED_PERCENT;
+    static const uint32_t FLOAT_RESET_DURATION = 600000;   // 10 minutes in milliseconds
+    static const uint32_t EFFICIENCY_MAX = (1 << 17) - 1;
+    static const uint32_t FLOAT_TIMER_MAX = (1 << 20) - 1;
+
+    float _pval;
+    float _qval;
+    float _rval;
+
+    /**
+     * @brief project the state of charge ahead one step, see SoCKalman::f()
+     *
+     * @return int32_t predicted soc, may be outside the table until the update clamps it
+     */
+    int32_t f(SoCKalmanState& state, bool isBatteryInFloat, int32_t batteryMilliWatts, uint32_t samplePeriodMilliSec, uint32_t batteryCapacity);
+
+    /**
+     * @brief update the stored linearisation from the predicted soc, see SoCKalman::h()
+     */
+    void h(SoCKalmanState& state, int32_t soc, int32_t batteryMilliAmps);
+
+    uint32_t clamp(uint32_t value, uint32_t min, uint32_t max);
+};
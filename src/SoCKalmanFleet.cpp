@@ -0,0 +1,243 @@
+#include "SoCKalmanFleet.h"
+#include "SoCOcvTable.h"
+
+SoCKalmanFleet::SoCKalmanFleet(uint32_t size) :
+    _size(size),
+    _pval(0.1),
+    _qval(0.0001),
+    _rval(0.1),
+    _blocks((size + LANES - 1) / LANES)
+{
+    uint32_t b, l, i;
+
+    // unused lanes in the last block are advanced with the rest, so give them a harmless state
+    for (b = 0; b < _blocks.size(); b++) {
+        Block& block = _blocks[b];
+        for (l = 0; l < LANES; l++) {
+            block.previousSoC[l] = 0;
+            block.batteryEff[l] = 0;
+            block.millisecondsInFloat[l] = 0;
+            block.curve[l] = 0;
+            block.h[l] = 0;
+            block.pval[l] = _pval;
+            block.qval[l] = _qval;
+            block.rval[l] = _rval;
+            for (i = 0; i < 3; i++) {
+                block.x[i][l] = 0;
+                block.H[i][l] = 0;
+            }
+            for (i = 0; i < 9; i++)
+                block.p[i][l] = (i % 4 == 0) ? _pval : 0;
+        }
+    }
+}
+
+void SoCKalmanFleet::configure(uint32_t node, float pval, float qval, float rval)
+{
+    Block& block = _blocks[node / LANES];
+    uint32_t l = node % LANES;
+
+    block.pval[l] = pval;
+    block.qval[l] = qval;
+    block.rval[l] = rval;
+}
+
+void SoCKalmanFleet::init(uint32_t node, bool isBattery12V, bool isBatteryLithium, uint32_t batteryEff, uint32_t batteryVoltage, uint32_t initialSoC)
+{
+    Block& block = _blocks[node / LANES];
+    uint32_t l = node % LANES;
+    int i;
+
+    block.batteryEff[l] = batteryEff;
+    block.curve[l] = ((uint32_t)isBatteryLithium * 2 + (uint32_t)!isBattery12V) * SoCOcvTable::SEGMENTS;
+
+    // use stored soc, unless it's out of range, in which case calculate new starting point
+    block.previousSoC[l] = (initialSoC <= SOC_SCALED_MAX)
+        ? initialSoC
+        : SoCOcvTable::estimateSoC(batteryVoltage);
+
+    block.x[0][l] = block.previousSoC[l];
+    for (i = 0; i < 9; i++)
+        block.p[i][l] = (i % 4 == 0) ? block.pval[l] : 0;   // identity(n) * pval
+}
+
+uint32_t SoCKalmanFleet::read(uint32_t node)
+{
+    // do not excede 0-100% bounds
+    return clamp(_blocks[node / LANES].previousSoC[node % LANES], 0, SOC_SCALED_HUNDRED_PERCENT);
+}
+
+uint32_t SoCKalmanFleet::efficiency(uint32_t node)
+{
+    return _blocks[node / LANES].batteryEff[node % LANES];
+}
+
+uint32_t SoCKalmanFleet::size()
+{
+    return _size;
+}
+
+void SoCKalmanFleet::sampleAll(const bool* isBatteryInFloat, const int32_t* batteryMilliAmps, const uint32_t* batteryVoltage, const int32_t* batteryMilliWatts,
+    const uint32_t* samplePeriodMilliSec, const uint32_t* batteryCapacity)
+{
+    bool inFloat[LANES];
+    int32_t milliAmps[LANES];
+    uint32_t voltage[LANES];
+    int32_t milliWatts[LANES];
+    uint32_t period[LANES];
+    uint32_t capacity[LANES];
+    uint32_t b, l, node;
+
+    for (b = 0; b < _blocks.size(); b++) {
+        // gather this block's inputs, padding lanes get a zero sample
+        for (l = 0; l < LANES; l++) {
+            node = b * LANES + l;
+            if (node < _size) {
+                inFloat[l] = isBatteryInFloat[node];
+                milliAmps[l] = batteryMilliAmps[node];
+                voltage[l] = batteryVoltage[node];
+                milliWatts[l] = batteryMilliWatts[node];
+                period[l] = samplePeriodMilliSec[node];
+                capacity[l] = batteryCapacity[node];
+            } else {
+                inFloat[l] = false;
+                milliAmps[l] = 0;
+                voltage[l] = 0;
+                milliWatts[l] = 0;
+                period[l] = 0;
+                capacity[l] = 1;
+            }
+        }
+
+        Block& block = _blocks[b];
+        f(block, inFloat, milliWatts, period, capacity);
+        h(block, milliAmps);
+        update(block, voltage);
+    }
+}
+
+void SoCKalmanFleet::f(Block& block, const bool* isBatteryInFloat, const int32_t* batteryMilliWatts, const uint32_t* samplePeriodMilliSec,
+    const uint32_t* batteryCapacity)
+{
+    uint32_t milliSecToHours = 3600000;
+    uint32_t l;
+
+    // same integer expressions as SoCKalman::f() so both engines round identically
+    for (l = 0; l < LANES; l++) {
+        int32_t powerChange = ((batteryMilliWatts[l] / 1000) * block.batteryEff[l] * (samplePeriodMilliSec[l] / milliSecToHours));
+        uint32_t newSoC = (block.x[0][l] * batteryCapacity[l] + powerChange) / batteryCapacity[l];
+
+        block.x[0][l] = newSoC;
+
+        if (isBatteryInFloat[l]) {
+            block.millisecondsInFloat[l] += samplePeriodMilliSec[l];
+            if (block.millisecondsInFloat[l] > FLOAT_RESET_DURATION) {
+                // an empty battery says nothing about the efficiency, keep it
+                if (block.previousSoC[l] > 0) {
+                    block.batteryEff[l] = (uint64_t)block.batteryEff[l] * (uint64_t)SOC_SCALED_HUNDRED_PERCENT / block.previousSoC[l];
+                    block.batteryEff[l] = clamp(block.batteryEff[l], 0, SOC_SCALED_HUNDRED_PERCENT);
+                }
+                block.x[0][l] = SOC_SCALED_HUNDRED_PERCENT;
+            }
+        } else {
+            block.millisecondsInFloat[l] = 0;
+        }
+    }
+}
+
+void SoCKalmanFleet::h(Block& block, const int32_t* batteryMilliAmps)
+{
+    const uint32_t* table = &SoCOcvTable::SEGMENT_TABLE[0][0][0];
+    uint32_t inTable[LANES];
+    float h[LANES];
+    float H0[LANES];
+    float H1[LANES];
+    uint32_t l;
+
+    // SoCOcvTable::lookup() for every lane at once, lanes outside the table read their curve's
+    // first segment and are masked out below
+    for (l = 0; l < LANES; l++) {
+        uint32_t index = (uint32_t)block.x[0][l] / SoCOcvTable::SOC_STEP;
+        inTable[l] = index < SoCOcvTable::SEGMENTS;
+        uint32_t bracket = table[block.curve[l] + (inTable[l] ? index : 0)];
+        uint32_t midVoltage = bracket & 0xFFFF;
+        uint32_t gradient = bracket >> 16;
+
+        h[l] = midVoltage + (batteryMilliAmps[l] / 1000 * block.x[1][l] / 100) + block.x[2][l] / 100;
+        H0[l] = gradient;
+        H1[l] = batteryMilliAmps[l] / 1000;
+    }
+
+    // lanes outside the table keep their previous linearisation, a separate loop so the compiler
+    // doesn't sink the conversions above into a branch
+    for (l = 0; l < LANES; l++) {
+        block.h[l] = inTable[l] ? h[l] : block.h[l];
+        block.H[0][l] = inTable[l] ? H0[l] : block.H[0][l];
+        block.H[1][l] = inTable[l] ? H1[l] : block.H[1][l];
+        block.H[2][l] = inTable[l] ? 1 : block.H[2][l];
+    }
+}
+
+void SoCKalmanFleet::update(Block& block, const uint32_t* batteryVoltage)
+{
+    uint32_t l;
+
+    // SoCKalman::sample() with A = I expanded by hand, the order of every float operation is kept
+    // so results are identical to the generic matrix chain
+    for (l = 0; l < LANES; l++) {
+        float H0 = block.H[0][l];
+        float H1 = block.H[1][l];
+        float H2 = block.H[2][l];
+        float qval = block.qval[l];
+
+        // $P_k = A_{k-1} P_{k-1} A^T_{k-1} + Q_{k-1}$
+        float p00 = block.p[0][l] + qval, p01 = block.p[1][l], p02 = block.p[2][l];
+        float p10 = block.p[3][l], p11 = block.p[4][l] + qval, p12 = block.p[5][l];
+        float p20 = block.p[6][l], p21 = block.p[7][l], p22 = block.p[8][l] + qval;
+
+        // $G_k = P_k H^T_k (H_k P_k H^T_k + R)^{-1}$
+        float ph0 = p00 * H0 + p01 * H1 + p02 * H2;
+        float ph1 = p10 * H0 + p11 * H1 + p12 * H2;
+        float ph2 = p20 * H0 + p21 * H1 + p22 * H2;
+        float hp0 = H0 * p00 + H1 * p10 + H2 * p20;
+        float hp1 = H0 * p01 + H1 * p11 + H2 * p21;
+        float hp2 = H0 * p02 + H1 * p12 + H2 * p22;
+        float inv = 1 / (hp0 * H0 + hp1 * H1 + hp2 * H2 + block.rval[l]);
+        float G0 = ph0 * inv;
+        float G1 = ph1 * inv;
+        float G2 = ph2 * inv;
+
+        // $\hat{x}_k = \hat{x_k} + G_k(z_k - h(\hat{x}_k))$
+        float innovation = batteryVoltage[l] - block.h[l];
+        block.x[0][l] = block.x[0][l] + G0 * innovation * 100;
+        block.x[1][l] = block.x[1][l] + G1 * innovation * 100;
+        block.x[2][l] = block.x[2][l] + G2 * innovation * 100;
+        block.x[0][l] = clamp(block.x[0][l] < 0 ? 0 : (uint32_t)block.x[0][l], 0, SOC_SCALED_HUNDRED_PERCENT);
+
+        // $P_k = (I - G_k H_k) P_k$
+        float i00 = -(G0 * H0) + 1, i01 = -(G0 * H1), i02 = -(G0 * H2);
+        float i10 = -(G1 * H0), i11 = -(G1 * H1) + 1, i12 = -(G1 * H2);
+        float i20 = -(G2 * H0), i21 = -(G2 * H1), i22 = -(G2 * H2) + 1;
+        block.p[0][l] = i00 * p00 + i01 * p10 + i02 * p20;
+        block.p[1][l] = i00 * p01 + i01 * p11 + i02 * p21;
+        block.p[2][l] = i00 * p02 + i01 * p12 + i02 * p22;
+        block.p[3][l] = i10 * p00 + i11 * p10 + i12 * p20;
+        block.p[4][l] = i10 * p01 + i11 * p11 + i12 * p21;
+        block.p[5][l] = i10 * p02 + i11 * p12 + i12 * p22;
+        block.p[6][l] = i20 * p00 + i21 * p10 + i22 * p20;
+        block.p[7][l] = i20 * p01 + i21 * p11 + i22 * p21;
+        block.p[8][l] = i20 * p02 + i21 * p12 + i22 * p22;
+
+        block.previousSoC[l] = block.x[0][l];
+    }
+}
+
+uint32_t SoCKalmanFleet::clamp(uint32_t value, uint32_t min, uint32_t max)
+{
+    if (value > max) {
+        return max;
+    } else if (value < min) {
+        return min;
+    }
+    return value;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * @brief Batch engine that advances many SoCKalman filters with a single call. Nodes are grouped into
+ * blocks of LANES and every state variable is kept in struct-of-arrays form within a block, so the
+ * per-node loops of h() and update() are vectorised by the compiler at -O3, meson's release buildtype,
+ * the OCV lookup with gathers where the target has them (-mavx2). The default debug buildtype does not
+ * vectorise. Results match SoCKalmanFloat::sample() node for node. Intended for server-side replay,
+ * storage is allocated once in the constructor.
+ */
+class SoCKalmanFleet
+{
+  public:
+    SoCKalmanFleet(uint32_t size);
+
+    /**
+     * @brief set the noise parameters of a single node, see SoCKalman(pval, qval, rval). Nodes start
+     * with the SoCKalman defaults, a new pval takes effect at the next init()
+     *
+     * @param node, pval, qval, rval
+     */
+    void configure(uint32_t node, float pval, float qval, float rval);
+
+    /**
+     * @brief initialise a single node, see SoCKalman::init()
+     *
+     * @param node, isBattery12V, isBatteryLithium, batteryEff, batteryVoltage, initialSoC
+     */
+    void init(uint32_t node, bool isBattery12V, bool isBatteryLithium, uint32_t batteryEff, uint32_t batteryVoltage, uint32_t initialSoC);
+
+    /**
+     * @brief return current state of charge of a node
+     *
+     * @param node
+     *
+     * @return uint32_t soc
+     */
+    uint32_t read(uint32_t node);
+
+    /**
+     * @brief return current battery efficiency of a node
+     *
+     * @param node
+     *
+     * @return uint32_t batteryEff
+     */
+    uint32_t efficiency(uint32_t node);
+
+    /**
+     * @brief return the number of nodes in the fleet
+     *
+     * @return uint32_t size
+     */
+    uint32_t size();
+
+    /**
+     * @brief advance every node by one sample, each input array holds one entry per node,
+     * see SoCKalman::sample()
+     *
+     * @param isBatteryInFloat, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity
+     */
+    void sampleAll(const bool* isBatteryInFloat, const int32_t* batteryMilliAmps, const uint32_t* batteryVoltage, const int32_t* batteryMilliWatts,
+        const uint32_t* samplePeriodMilliSec, const uint32_t* batteryCapacity);
+
+  private:
+    static const uint32_t SOC_SCALED_HUNDRED_PERCENT = 100000;
+    static const uint32_t SOC_SCALED_MAX = 2 * SOC_SCALED_HUNDRED_PERCENT;
+    static const uint32_t FLOAT_RESET_DURATION = 600000;   // 10 minutes in milliseconds
+
+    static const uint32_t LANES = 8;   // nodes per block, one 256 bit float vector
+
+    /**
+     * @brief state of LANES consecutive nodes, each element is stored lane-contiguous so the kernels
+     * operate on whole vectors
+     */
+    struct Block {
+        uint32_t previousSoC[LANES];
+        uint32_t batteryEff[LANES];
+        uint32_t millisecondsInFloat[LANES];
+        uint32_t curve[LANES];   // first entry of the node's curve in the flattened SoCOcvTable::SEGMENT_TABLE
+        int32_t x[3][LANES];
+        float p[9][LANES];   // _pPost, row major
+        float h[LANES];
+        float H[3][LANES];
+        float pval[LANES];
+        float qval[LANES];
+        float rval[LANES];
+    };
+
+    uint32_t _size;
+    float _pval;
+    float _qval;
+    float _rval;
+    std::vector<Block> _blocks;
+
+    /**
+     * @brief project a block's soc ahead one step, see SoCKalman::f()
+     */
+    void f(Block& block, const bool* isBatteryInFloat, const int32_t* batteryMilliWatts, const uint32_t* samplePeriodMilliSec,
+        const uint32_t* batteryCapacity);
+
+    /**
+     * @brief update a block's predicted voltage and measurement jacobian, see SoCKalman::h(). The
+     * segment lookup is done inline per lane so this loop vectorises along with update()
+     */
+    void h(Block& block, const int32_t* batteryMilliAmps);
+
+    /**
+     * @brief covariance prediction, gain, state and covariance update for a whole block
+     */
+    void update(Block& block, const uint32_t* batteryVoltage);
+
+    uint32_t clamp(uint32_t value, uint32_t min, uint32_t max);
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Hot path instrumentation of SoCKalmanT::sample(), only compiled in with SOC_KALMAN_INSTRUMENT
+ * (meson option instrument) so the default build carries neither the counters nor the clock reads.
+ * Every stage of a sample is timed with a pluggable clock and the last sample's innovation, normalised
+ * innovation squared and P diagonal are kept next to the timings for the host to poll.
+ */
+
+/**
+ * @brief free running tick source, e.g. the DWT cycle counter on target or rdtsc / steady_clock on the
+ * host. Only differences are used, so it may wrap.
+ */
+typedef uint32_t (*SoCKalmanClock)();
+
+/**
+ * @brief timed stages of sample(), Predict and UpdateCovariance are skipped while the steady state gain
+ * has frozen the covariance and samples without a measurement update stop after Predict
+ */
+enum class SoCKalmanStage : uint8_t
+{
+    F,
+    Predict,
+    H,
+    Gain,
+    UpdateState,
+    UpdateCovariance
+};
+
+static const uint8_t SOC_KALMAN_STAGES = 6;
+
+template <uint8_t N, typename Scalar>
+struct SoCKalmanCounters
+{
+    uint32_t samples;                           // samples since the last reset
+    uint32_t corrections;                       // samples with a measurement update since the last reset
+    uint32_t cycles[SOC_KALMAN_STAGES];         // ticks per stage of the last sample, 0 if it was skipped
+    uint64_t totalCycles[SOC_KALMAN_STAGES];    // ticks per stage since the last reset
+    Scalar innovation;                          // batteryVoltage - _h of the last measurement update
+    Scalar nis;                                 // innovation^2 / (H P H^T + R), saturates in fixed point
+    Scalar pDiagonal[N];                        // P diagonal after the last measurement update
+};
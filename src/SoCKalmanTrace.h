@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+static const uint32_t SOC_KALMAN_TRACE_EFFICIENCY = 1;   // f() recalculated the efficiency at the end of a float period
+
+/**
+ * @brief Diagnostics of one sample(), taken after the update. Scalars are stored as 32 bit patterns,
+ * float bits or the raw Q format value as in snapshots, so every arithmetic type shares the layout.
+ */
+template <uint8_t N, uint8_t M>
+struct SoCKalmanTraceRecord
+{
+    uint32_t sample;       // pushes since the ring was created, a gap means records were dropped
+    uint32_t flags;        // SOC_KALMAN_TRACE_*
+    uint32_t batteryEff;
+    int32_t x[N];
+    uint32_t h;
+    uint32_t H[M * N];
+    uint32_t G[N * M];
+};
+
+/**
+ * @brief Lock free single producer single consumer ring over caller owned storage. The producer (the
+ * filter) never blocks or allocates, a push into a full ring drops the record and counts it. Only
+ * loads and stores are used on the indices, so it also works on cores without atomic read-modify-write.
+ */
+template <typename Record>
+class SoCKalmanTraceRing
+{
+  public:
+    /**
+     * @param records storage for size records, size must be a power of two
+     */
+    SoCKalmanTraceRing(Record* records, uint32_t size) :
+        _records(records),
+        _mask(size - 1),
+        _head(0),
+        _tail(0),
+        _dropped(0)
+    {}
+
+    /**
+     * @brief producer side, copy a record in
+     *
+     * @return bool false if the ring was full and the record was dropped
+     */
+    bool push(const Record& record)
+    {
+        uint32_t head = _head.load(std::memory_order_relaxed);
+
+        if (head - _tail.load(std::memory_order_acquire) > _mask) {
+            _dropped.store(_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        _records[head & _mask] = record;
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief consumer side, copy the oldest record out
+     *
+     * @return bool false if the ring was empty
+     */
+    bool pop(Record& record)
+    {
+        uint32_t tail = _tail.load(std::memory_order_relaxed);
+
+        if (tail == _head.load(std::memory_order_acquire))
+            return false;
+        record = _records[tail & _mask];
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief producer side, number of push() calls so far including dropped ones
+     */
+    uint32_t pushed() const
+    {
+        return _head.load(std::memory_order_relaxed) + _dropped.load(std::memory_order_relaxed);
+    }
+
+    uint32_t dropped() const
+    {
+        return _dropped.load(std::memory_order_relaxed);
+    }
+
+  private:
+    Record* _records;
+    uint32_t _mask;
+    std::atomic<uint32_t> _head;
+    std::atomic<uint32_t> _tail;
+    std::atomic<uint32_t> _dropped;
+
+    SoCKalmanTraceRing(const SoCKalmanTraceRing&);
+    SoCKalmanTraceRing& operator=(const SoCKalmanTraceRing&);
+};
@@ -0,0 +1,52 @@
+#include "SoCOcvTable.h"
+
+// open circuit voltage at every 1% of soc for a 12 V battery
+static constexpr uint32_t dummyLeadAcidVoltage[SoCOcvTable::SIZE] = { 11640, 11653, 11666, 11679, 11692, 11706, 11719, 11732, 11745, 11758, 11772, 11785, 11798, 11811, 11824, 11838, 11851, 11864, 11877, 11890, 11904, 11917, 11930, 11943, 11956, 11970, 11983, 11996, 12009, 12022, 12036, 12049, 12062, 12075, 12088, 12102, 12115, 12128, 12141, 12154, 12168, 12181, 12194, 12207, 12220, 12234, 12247, 12260, 12273, 12286, 12300, 12313, 12326, 12339, 12352, 12366, 12379, 12392, 12405, 12418, 12432, 12445, 12458, 12471, 12484, 12498, 12511, 12524, 12537, 12550, 12564, 12577, 12590, 12603, 12616, 12630, 12643, 12656, 12669, 12682, 12696, 12709, 12722, 12735, 12748, 12762, 12775, 12788, 12801, 12814, 12828, 12841, 12854, 12867, 12880, 12894, 12907, 12920, 12933, 12946, 12960 };
+static constexpr uint32_t dummyLithiumVoltage[SoCOcvTable::SIZE] = { 5000, 6266, 7434, 8085, 8531, 8867, 9134, 9355, 9543, 9705, 9847, 9974, 10088, 10191, 10285, 10372, 10451, 10525, 10595, 10659, 10720, 10777, 10831, 10882, 10931, 10977, 11021, 11063, 11104, 11142, 11180, 11216, 11251, 11284, 11317, 11349, 11379, 11409, 11438, 11467, 11495, 11522, 11548, 11574, 11600, 11625, 11650, 11675, 11699, 11723, 11746, 11769, 11793, 11815, 11838, 11861, 11883, 11906, 11928, 11950, 11972, 11994, 12017, 12039, 12061, 12083, 12105, 12127, 12150, 12172, 12195, 12217, 12240, 12263, 12286, 12309, 12333, 12356, 12380, 12404, 12428, 12452, 12477, 12501, 12526, 12552, 12577, 12603, 12629, 12655, 12682, 12708, 12735, 12763, 12790, 12818, 12846, 12875, 12903, 12931, 12960 };
+
+// midpoint voltage in the low half, gradient in the high half, see SoCOcvTable::SEGMENT_TABLE
+static constexpr uint32_t segment(const uint32_t* voltage, uint8_t i, uint8_t multiplier)
+{
+    return (uint32_t)(uint16_t)((voltage[i + 1] + voltage[i]) * multiplier / 2)
+        | (uint32_t)(uint16_t)((voltage[i + 1] - voltage[i]) * multiplier * 100 / SoCOcvTable::SOC_STEP) << 16;
+}
+
+// expand every segment of a curve at compile time
+#define SEGMENT_ROW(voltage, multiplier, i) \
+    segment(voltage, i, multiplier), segment(voltage, i + 1, multiplier), segment(voltage, i + 2, multiplier), \
+    segment(voltage, i + 3, multiplier), segment(voltage, i + 4, multiplier), segment(voltage, i + 5, multiplier), \
+    segment(voltage, i + 6, multiplier), segment(voltage, i + 7, multiplier), segment(voltage, i + 8, multiplier), \
+    segment(voltage, i + 9, multiplier)
+#define SEGMENT_CURVE(voltage, multiplier) { \
+    SEGMENT_ROW(voltage, multiplier, 0), \
+    SEGMENT_ROW(voltage, multiplier, 10), \
+    SEGMENT_ROW(voltage, multiplier, 20), \
+    SEGMENT_ROW(voltage, multiplier, 30), \
+    SEGMENT_ROW(voltage, multiplier, 40), \
+    SEGMENT_ROW(voltage, multiplier, 50), \
+    SEGMENT_ROW(voltage, multiplier, 60), \
+    SEGMENT_ROW(voltage, multiplier, 70), \
+    SEGMENT_ROW(voltage, multiplier, 80), \
+    SEGMENT_ROW(voltage, multiplier, 90) }
+
+// indexed by [isBatteryLithium][!isBattery12V][segment]
+const uint32_t SoCOcvTable::SEGMENT_TABLE[2][2][SoCOcvTable::SEGMENTS] = {
+    { SEGMENT_CURVE(dummyLeadAcidVoltage, 1), SEGMENT_CURVE(dummyLeadAcidVoltage, 2) },
+    { SEGMENT_CURVE(dummyLithiumVoltage, 1), SEGMENT_CURVE(dummyLithiumVoltage, 2) }
+};
+
+uint32_t SoCOcvTable::estimateSoC(uint32_t batteryVoltage)
+{
+    // will need to add 24 V compatability
+
+    const uint8_t VOLTAGES_SIZE = 10;
+    const uint16_t battSoCVoltages[VOLTAGES_SIZE] = { 12720, 12600, 12480, 12360, 12240, 12120, 12000, 11880, 11760, 11640 };
+    const uint32_t SOC_SCALED_HUNDRED_PERCENT = 100000;
+
+    uint8_t index;
+    for (index = 0; index < VOLTAGES_SIZE; index++)
+        if (batteryVoltage > battSoCVoltages[index])
+            break;
+
+    return (VOLTAGES_SIZE - index) * (SOC_SCALED_HUNDRED_PERCENT / VOLTAGES_SIZE);
+}
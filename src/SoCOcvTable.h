@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Open circuit voltage (OCV) to state of charge tables shared by every filter engine.
+ * Voltages are for a 12 V battery in millivolts, soc is scaled so that 100% = 100000. The midpoint
+ * voltage and gradient of every segment are precomputed at compile time for 12 V and 24 V batteries.
+ */
+class SoCOcvTable
+{
+  public:
+    static const uint8_t SIZE = 101;   // table points, one per 1% of soc
+    static const uint8_t SEGMENTS = SIZE - 1;
+    static const uint32_t SOC_STEP = 1000;   // soc between neighbouring points
+
+    /**
+     * @brief every segment between two neighbouring table points, indexed by
+     * [isBatteryLithium][!isBattery12V][segment]. Each entry packs the midpoint voltage h() needs in
+     * the low 16 bits and the gradient in the high 16 bits, one 32 bit word so batch engines can load
+     * a segment per lane with a single gather, see SoCKalmanFleet::h()
+     */
+    static const uint32_t SEGMENT_TABLE[2][2][SEGMENTS];
+
+    /**
+     * @brief return the segments of one battery's curve, for callers that look up many socs of it
+     *
+     * @param isBattery12V, isBatteryLithium
+     *
+     * @return const uint32_t* SEGMENTS packed segments
+     */
+    static inline const uint32_t* curve(bool isBattery12V, bool isBatteryLithium)
+    {
+        return SEGMENT_TABLE[isBatteryLithium][!isBattery12V];
+    }
+
+    /**
+     * @brief find the segment of a curve that brackets soc and return its midpoint voltage and the
+     * ocv gradient used as _H[0]. Socs outside the table leave midVoltage and gradient untouched.
+     *
+     * @param curve from curve(), soc, midVoltage, gradient
+     *
+     * @return bool true if a segment was found
+     */
+    static inline bool lookup(const uint32_t* curve, int32_t soc, uint32_t& midVoltage, uint32_t& gradient)
+    {
+        // table points are evenly spaced so the bracketing segment is a direct index,
+        // negative socs wrap to large values and fall outside the table
+        uint32_t index = (uint32_t)soc / SOC_STEP;
+
+        if (index >= SEGMENTS)
+            return false;
+
+        midVoltage = curve[index] & 0xFFFF;
+        gradient = curve[index] >> 16;
+        return true;
+    }
+
+    /**
+     * @brief lookup() on the curve of a battery
+     *
+     * @param isBattery12V, isBatteryLithium, soc, midVoltage, gradient
+     *
+     * @return bool true if a segment was found
+     */
+    static inline bool lookup(bool isBattery12V, bool isBatteryLithium, int32_t soc, uint32_t& midVoltage, uint32_t& gradient)
+    {
+        return lookup(curve(isBattery12V, isBatteryLithium), soc, midVoltage, gradient);
+    }
+
+    /**
+     * @brief estimate a soc based on resting battery voltage
+     *
+     * @param batteryVoltage
+     *
+     * @return uint32_t soc
+     */
+    static uint32_t estimateSoC(uint32_t batteryVoltage);
+};
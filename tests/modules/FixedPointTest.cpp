@@ -0,0 +1,44 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+
+#include "FixedPoint.h"
+
+TEST_GROUP(FixedPointTest){};
+
+TEST(FixedPointTest, ShouldConvertConstants)
+{
+    CHECK_EQUAL(65536, Fixed16(1).raw());
+    CHECK_EQUAL(6554, Fixed16(0.1).raw());
+    CHECK_EQUAL(7, Fixed16(0.0001).raw());
+    CHECK_EQUAL(-6554, Fixed16(-0.1).raw());
+}
+
+TEST(FixedPointTest, ShouldTruncateTowardsZeroLikeFloat)
+{
+    CHECK_EQUAL(2, (int32_t)Fixed16(2.75));
+    CHECK_EQUAL(-2, (int32_t)Fixed16(-2.75));
+}
+
+TEST(FixedPointTest, ShouldMultiplyAndDivide)
+{
+    CHECK_EQUAL(Fixed16(1.5).raw(), (Fixed16(0.5) * Fixed16(3)).raw());
+    CHECK_EQUAL(Fixed16(-1.25).raw(), (Fixed16(5) / Fixed16(-4)).raw());
+    CHECK_EQUAL(Fixed16(8).raw(), (Fixed16(1) / Fixed16(0.125)).raw());
+}
+
+TEST(FixedPointTest, ShouldSaturateInsteadOfWrapping)
+{
+    CHECK_EQUAL(INT32_MAX, (Fixed16(30000) + Fixed16(30000)).raw());
+    CHECK_EQUAL(INT32_MIN, (Fixed16(-30000) - Fixed16(30000)).raw());
+    CHECK_EQUAL(INT32_MAX, (Fixed16(300) * Fixed16(300)).raw());
+    CHECK_EQUAL(INT32_MAX, Fixed16((uint32_t)100000).raw());
+    CHECK_EQUAL(INT32_MIN, (Fixed16(-1) / Fixed16(0)).raw());
+}
+
+TEST(FixedPointTest, ShouldOrderLikeFloat)
+{
+    CHECK(Fixed16(-0.5) < Fixed16(0.25));
+    CHECK(Fixed16(0.25) <= Fixed16(0.25));
+    CHECK(Fixed16(3) > Fixed16(-3));
+    CHECK_FALSE(Fixed16(-3) >= Fixed16(3));
+}
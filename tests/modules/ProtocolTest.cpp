@@ -0,0 +1,149 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+
+#include <string.h>
+
+#include "Protocol.h"
+
+static bool parse(const char* line, Message& message)
+{
+    return parse_message(line, strlen(line), message);
+}
+
+TEST_GROUP(ProtocolTest){};
+
+TEST(ProtocolTest, ShouldParseInitWithoutSoC)
+{
+    Message message = Message();
+
+    CHECK_TRUE(parse("I 7 1 24 100000 26000", message));
+    CHECK(message.type == MessageType::Init);
+    CHECK_EQUAL(7, message.node);
+    CHECK_TRUE(message.isBatteryLithium);
+    CHECK_FALSE(message.isBattery12V);
+    CHECK_EQUAL(100000, message.batteryCapacity);
+    CHECK_EQUAL(26000, message.batteryVoltage);
+    CHECK_EQUAL(0xFFFFFFFF, message.initialSoC);   // estimated from the voltage
+}
+
+TEST(ProtocolTest, ShouldParseInitWithSoC)
+{
+    Message message = Message();
+
+    CHECK_TRUE(parse("I 8 0 12 50000 12600 42000", message));
+    CHECK(message.type == MessageType::Init);
+    CHECK_FALSE(message.isBatteryLithium);
+    CHECK_TRUE(message.isBattery12V);
+    CHECK_EQUAL(42000, message.initialSoC);
+}
+
+TEST(ProtocolTest, ShouldParseSample)
+{
+    Message message = Message();
+
+    CHECK_TRUE(parse("S 3 -1500 -19800 3 13200 60000", message));
+    CHECK(message.type == MessageType::Sample);
+    CHECK_EQUAL(3, message.node);
+    CHECK_EQUAL(-1500, message.batteryMilliAmps);
+    CHECK_EQUAL(-19800, message.batteryMilliWatts);
+    CHECK_TRUE(message.isBatteryInFloat);
+    CHECK_EQUAL(13200, message.batteryVoltage);
+    CHECK_EQUAL(60000, message.samplePeriodMilliSec);
+
+    CHECK_TRUE(parse("S 3 1500 19800 2 13200 60000", message));
+    CHECK_FALSE(message.isBatteryInFloat);
+}
+
+TEST(ProtocolTest, ShouldParseQueryAndBarrier)
+{
+    Message message = Message();
+
+    CHECK_TRUE(parse("Q 4294967295", message));
+    CHECK(message.type == MessageType::Query);
+    CHECK_EQUAL(0xFFFFFFFF, message.node);
+
+    CHECK_TRUE(parse("F", message));
+    CHECK(message.type == MessageType::Flush);
+}
+
+TEST(ProtocolTest, ShouldTolerateCarriageReturn)
+{
+    Message message = Message();
+
+    CHECK_TRUE(parse("Q 9\r", message));
+    CHECK_EQUAL(9, message.node);
+    CHECK_TRUE(parse("F\r", message));
+    CHECK_TRUE(parse("I 8 0 12 50000 12600 42000\r", message));
+    CHECK_EQUAL(42000, message.initialSoC);
+
+    // only one
+    CHECK_FALSE(parse("Q 9\r\r", message));
+    CHECK_FALSE(parse("\r", message));
+}
+
+TEST(ProtocolTest, ShouldRejectMalformedLines)
+{
+    Message message = Message();
+
+    CHECK_FALSE(parse_message("", 0, message));
+    CHECK_FALSE(parse("X 1", message));
+    CHECK_FALSE(parse("Q", message));
+    CHECK_FALSE(parse("Q1", message));
+    CHECK_FALSE(parse("Q  1", message));
+    CHECK_FALSE(parse("Q 1 ", message));
+    CHECK_FALSE(parse("Q a", message));
+    CHECK_FALSE(parse("Q -", message));
+    CHECK_FALSE(parse("Q -1", message));
+    CHECK_FALSE(parse("Q 1 2", message));
+    CHECK_FALSE(parse("F 1", message));
+    CHECK_FALSE(parse("S 1 2 3 4 5", message));          // no sample period
+    CHECK_FALSE(parse("S 1 2 3 4 5 -6", message));       // negative period
+    CHECK_FALSE(parse("I 1 2 12 100000 13000", message));   // lithium is 0 or 1
+    CHECK_FALSE(parse("I 1 1 48 100000 13000", message));   // 12 or 24 volts
+    CHECK_FALSE(parse("I 1 1 12 0 13000", message));        // no capacity
+    CHECK_FALSE(parse("I 1 1 12 100000 13000 ", message));
+    CHECK_FALSE(parse("I 1 1 12 100000 13000 5 6", message));
+}
+
+TEST(ProtocolTest, ShouldRejectOverflow)
+{
+    Message message = Message();
+
+    CHECK_FALSE(parse("Q 4294967296", message));
+    CHECK_FALSE(parse("Q 99999999999999999999999", message));
+    CHECK_FALSE(parse("I 1 1 12 4294967296 13000", message));
+
+    // milliamps and milliwatts are 32 bit signed
+    CHECK_TRUE(parse("S 1 2147483647 -2147483648 0 13000 1000", message));
+    CHECK_EQUAL(2147483647, message.batteryMilliAmps);
+    CHECK_EQUAL(-2147483647 - 1, message.batteryMilliWatts);
+    CHECK_FALSE(parse("S 1 2147483648 0 0 13000 1000", message));
+    CHECK_FALSE(parse("S 1 0 -2147483649 0 13000 1000", message));
+}
+
+TEST(ProtocolTest, ShouldFormatResponses)
+{
+    Response response = Response();
+    char line[RESPONSE_SIZE];
+
+    response.type = MessageType::Query;
+    response.known = true;
+    response.node = 4294967295u;
+    response.soc = 100000;
+    response.efficiency = 85000;
+    CHECK_EQUAL(26, format_response(response, line));
+    STRCMP_EQUAL("Q 4294967295 100000 85000\n", line);
+
+    response.known = false;
+    CHECK_EQUAL(15, format_response(response, line));
+    STRCMP_EQUAL("Q 4294967295 ?\n", line);
+
+    response.type = MessageType::Init;   // rejected
+    CHECK_EQUAL(26, format_response(response, line));
+    STRCMP_EQUAL("E 4294967295 out of range\n", line);
+
+    response.type = MessageType::Flush;
+    response.samples = 18446744073709551615ull;
+    CHECK_EQUAL(23, format_response(response, line));
+    STRCMP_EQUAL("F 18446744073709551615\n", line);
+}
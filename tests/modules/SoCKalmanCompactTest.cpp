@@ -0,0 +1,90 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+
+#include "SoCKalman.h"
+#include "SoCKalmanCompact.h"
+
+static_assert(sizeof(SoCKalmanState) <= SOC_KALMAN_STATE_SIZE, "SoCKalmanState grew past its published size");
+
+TEST_GROUP(SoCKalmanCompactTest){};
+
+TEST(SoCKalmanCompactTest, ShouldInitLikeSoCKalman)
+{
+    SoCKalmanCompact kalman;
+    SoCKalmanState state[3];
+
+    kalman.init(state[0], true, false, 10, 12000, 10);
+    kalman.init(state[1], true, false, 10, 12000, 0xFFFFFFFF);
+    kalman.init(state[2], false, true, 85000, 24000, 250000);
+
+    CHECK_EQUAL(10, kalman.read(state[0]));
+    CHECK_EQUAL(30000, kalman.read(state[1]));
+    CHECK_EQUAL(85000, kalman.efficiency(state[2]));
+}
+
+TEST(SoCKalmanCompactTest, ShouldSaturateEfficiencyOutOfRange)
+{
+    SoCKalmanCompact kalman;
+    SoCKalmanState state;
+
+    kalman.init(state, true, false, 0xFFFFFFFF, 12000, 50000);
+
+    CHECK_EQUAL((1 << 17) - 1, kalman.efficiency(state));
+}
+
+TEST(SoCKalmanCompactTest, ShouldFloatFromEmptyLikeSoCKalman)
+{
+    SoCKalmanCompact compact;
+    SoCKalmanState state;
+    SoCKalmanT<3, 1, float, SoCKalmanUpdate::Symmetric> kalman;
+
+    compact.init(state, true, false, 85000, 11640, 0);
+    kalman.init(true, false, 85000, 11640, 0);
+
+    // past the float reset duration, an empty battery keeps its efficiency
+    compact.sample(state, true, 1000, 13500, 13500, 700000, 50 * 12);
+    kalman.sample(true, 1000, 13500, 13500, 700000, 50 * 12);
+
+    CHECK_EQUAL(85000, compact.efficiency(state));
+    CHECK_EQUAL(kalman.read(), compact.read(state));
+}
+
+TEST(SoCKalmanCompactTest, ShouldMatchSymmetricSoCKalmanSampleForSample)
+{
+    const uint32_t NODES = 13;
+    SoCKalmanCompact compact;
+    SoCKalmanState state[NODES];
+    SoCKalmanT<3, 1, float, SoCKalmanUpdate::Symmetric> kalman[NODES];
+    uint32_t node, step;
+
+    for (node = 0; node < NODES; node++) {
+        bool isBattery12V = (node % 2) == 0;
+        bool isBatteryLithium = (node % 3) == 0;
+        uint32_t initialSoC = (node % 4 == 0) ? 0xFFFFFFFF : 20000 + node * 5000;
+        uint32_t voltage = isBattery12V ? 12200 : 24400;
+
+        compact.init(state[node], isBattery12V, isBatteryLithium, 100000 - node * 1000, voltage, initialSoC);
+        kalman[node].init(isBattery12V, isBatteryLithium, 100000 - node * 1000, voltage, initialSoC);
+    }
+
+    // long float periods take the soc out of the ocv table, which exercises the kept linearisation
+    for (step = 0; step < 96; step++) {
+        for (node = 0; node < NODES; node++) {
+            uint32_t multiplier = (node % 2 == 0) ? 1 : 2;
+            bool charging = ((step + node) % 24) < 10;
+            bool isBatteryInFloat = charging && (step % 24) > 7;
+            int32_t batteryMilliAmps = charging ? 2000 + node * 100 : -1500;
+            uint32_t batteryVoltage = (charging ? 12600 : 12100) * multiplier + step;
+            int32_t batteryMilliWatts = batteryMilliAmps * (int32_t)batteryVoltage / 1000;
+            uint32_t samplePeriodMilliSec = (step % 3 == 0) ? 60000 : 3600000;
+            uint32_t batteryCapacity = 50 * 12 * multiplier;
+
+            compact.sample(state[node], isBatteryInFloat, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec,
+                batteryCapacity);
+            kalman[node].sample(isBatteryInFloat, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity);
+
+            CHECK_EQUAL(kalman[node].read(), compact.read(state[node]));
+            CHECK_EQUAL(kalman[node].efficiency(), compact.efficiency(state[node]));
+        }
+    }
+}
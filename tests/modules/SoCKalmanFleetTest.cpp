@@ -0,0 +1,147 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+
+#include "SoCKalman.h"
+#include "SoCKalmanFleet.h"
+
+TEST_GROUP(SoCKalmanFleetTest){};
+
+TEST(SoCKalmanFleetTest, ShouldInitLikeSoCKalman)
+{
+    SoCKalmanFleet fleet(3);
+
+    fleet.init(0, true, false, 10, 12000, 10);
+    fleet.init(1, true, false, 10, 12000, 0xFFFFFFFF);
+    fleet.init(2, false, true, 85000, 24000, 250000);
+
+    CHECK_EQUAL(3, fleet.size());
+    CHECK_EQUAL(10, fleet.read(0));
+    CHECK_EQUAL(30000, fleet.read(1));
+    CHECK_EQUAL(85000, fleet.efficiency(2));
+}
+
+TEST(SoCKalmanFleetTest, ShouldFloatFromEmptyLikeSoCKalman)
+{
+    SoCKalmanFleet fleet(2);
+    SoCKalmanT<3, 1, float, SoCKalmanUpdate::Textbook> kalman;
+    bool isBatteryInFloat[2] = { true, true };
+    int32_t batteryMilliAmps[2] = { 1000, 1000 };
+    uint32_t batteryVoltage[2] = { 13500, 13500 };
+    int32_t batteryMilliWatts[2] = { 13500, 13500 };
+    uint32_t samplePeriodMilliSec[2] = { 700000, 700000 };
+    uint32_t batteryCapacity[2] = { 50 * 12, 50 * 12 };
+
+    // an empty lane next to a half full one, past the float reset duration
+    fleet.init(0, true, false, 85000, 11640, 0);
+    fleet.init(1, true, false, 85000, 12200, 50000);
+    kalman.init(true, false, 85000, 11640, 0);
+
+    fleet.sampleAll(isBatteryInFloat, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity);
+    kalman.sample(true, 1000, 13500, 13500, 700000, 50 * 12);
+
+    CHECK_EQUAL(85000, fleet.efficiency(0));
+    CHECK_EQUAL(kalman.read(), fleet.read(0));
+    CHECK(fleet.efficiency(1) > 85000);
+}
+
+TEST(SoCKalmanFleetTest, ShouldMatchSoCKalmanSampleForSample)
+{
+    // more nodes than a single block so the padded tail is exercised too
+    const uint32_t NODES = 13;
+    SoCKalmanFleet fleet(NODES);
+    SoCKalmanT<3, 1, float, SoCKalmanUpdate::Textbook> kalman[NODES];
+
+    bool isBatteryInFloat[NODES];
+    int32_t batteryMilliAmps[NODES];
+    uint32_t batteryVoltage[NODES];
+    int32_t batteryMilliWatts[NODES];
+    uint32_t samplePeriodMilliSec[NODES];
+    uint32_t batteryCapacity[NODES];
+    uint32_t node, step;
+
+    for (node = 0; node < NODES; node++) {
+        bool isBattery12V = (node % 2) == 0;
+        bool isBatteryLithium = (node % 3) == 0;
+        uint32_t initialSoC = (node % 4 == 0) ? 0xFFFFFFFF : 20000 + node * 5000;
+        uint32_t voltage = isBattery12V ? 12200 : 24400;
+
+        fleet.init(node, isBattery12V, isBatteryLithium, 100000 - node * 1000, voltage, initialSoC);
+        kalman[node].init(isBattery12V, isBatteryLithium, 100000 - node * 1000, voltage, initialSoC);
+    }
+
+    for (step = 0; step < 48; step++) {
+        for (node = 0; node < NODES; node++) {
+            uint32_t multiplier = (node % 2 == 0) ? 1 : 2;
+            bool charging = ((step + node) % 24) < 10;
+
+            isBatteryInFloat[node] = charging && (step % 24) > 7;
+            batteryMilliAmps[node] = charging ? 2000 + node * 100 : -1500;
+            batteryVoltage[node] = (charging ? 12600 : 12100) * multiplier + step;
+            batteryMilliWatts[node] = batteryMilliAmps[node] * (int32_t)batteryVoltage[node] / 1000;
+            samplePeriodMilliSec[node] = 3600000;
+            batteryCapacity[node] = 50 * 12 * multiplier;
+        }
+
+        fleet.sampleAll(isBatteryInFloat, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity);
+
+        for (node = 0; node < NODES; node++) {
+            kalman[node].sample(isBatteryInFloat[node], batteryMilliAmps[node], batteryVoltage[node], batteryMilliWatts[node],
+                samplePeriodMilliSec[node], batteryCapacity[node]);
+
+            CHECK_EQUAL(kalman[node].read(), fleet.read(node));
+            CHECK_EQUAL(kalman[node].efficiency(), fleet.efficiency(node));
+        }
+    }
+}
+
+TEST(SoCKalmanFleetTest, ShouldMatchConfiguredSoCKalman)
+{
+    // the same input through differently configured nodes, as the backtest ensemble runs them
+    const uint32_t NODES = 9;
+    const float PVAL[NODES] = { 0.1, 1, 0.01, 0.1, 0.1, 2, 0.5, 0.1, 0.05 };
+    const float QVAL[NODES] = { 0.0001, 0.0001, 0.001, 0.00001, 0.0001, 0.01, 0.0000001, 0.001, 0.0005 };
+    const float RVAL[NODES] = { 0.1, 0.1, 0.1, 1, 0.01, 0.5, 0.1, 5, 0.2 };
+    SoCKalmanFleet fleet(NODES);
+    SoCKalmanT<3, 1, float, SoCKalmanUpdate::Textbook>* kalman[NODES];
+
+    bool isBatteryInFloat[NODES];
+    int32_t batteryMilliAmps[NODES];
+    uint32_t batteryVoltage[NODES];
+    int32_t batteryMilliWatts[NODES];
+    uint32_t samplePeriodMilliSec[NODES];
+    uint32_t batteryCapacity[NODES];
+    uint32_t node, step;
+
+    for (node = 0; node < NODES; node++) {
+        kalman[node] = new SoCKalmanT<3, 1, float, SoCKalmanUpdate::Textbook>(PVAL[node], QVAL[node], RVAL[node]);
+        kalman[node]->init(true, false, 85000, 12200, 0xFFFFFFFF);
+        fleet.configure(node, PVAL[node], QVAL[node], RVAL[node]);
+        fleet.init(node, true, false, 85000, 12200, 0xFFFFFFFF);
+    }
+
+    for (step = 0; step < 48; step++) {
+        bool charging = (step % 24) < 10;
+
+        for (node = 0; node < NODES; node++) {
+            isBatteryInFloat[node] = charging && (step % 24) > 7;
+            batteryMilliAmps[node] = charging ? 2500 : -1500;
+            batteryVoltage[node] = (charging ? 12600 : 12100) + step;
+            batteryMilliWatts[node] = batteryMilliAmps[node] * (int32_t)batteryVoltage[node] / 1000;
+            samplePeriodMilliSec[node] = 3600000;
+            batteryCapacity[node] = 600;
+        }
+
+        fleet.sampleAll(isBatteryInFloat, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity);
+
+        for (node = 0; node < NODES; node++) {
+            kalman[node]->sample(isBatteryInFloat[node], batteryMilliAmps[node], batteryVoltage[node], batteryMilliWatts[node],
+                samplePeriodMilliSec[node], batteryCapacity[node]);
+
+            CHECK_EQUAL(kalman[node]->read(), fleet.read(node));
+            CHECK_EQUAL(kalman[node]->efficiency(), fleet.efficiency(node));
+        }
+    }
+
+    for (node = 0; node < NODES; node++)
+        delete kalman[node];
+}
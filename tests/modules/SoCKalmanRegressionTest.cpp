@@ -0,0 +1,354 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+
+#include <chrono> // std::chrono::steady_clock
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "SoCKalman.h"
+#include "SoCKalmanFleet.h"
+
+// Replays the recorded datasets in tests/data (listed in corpus.csv, rows in the backtest's raw sensor
+// format) through the float textbook reference and every alternative engine. Each engine must stay
+// within a per-sample soc and efficiency tolerance of the reference, set to the drift observed on the
+// corpus plus a margin, and above a floor of the reference's throughput in the same run. The floors
+// sit well below the observed ratios, in optimised and debug builds alike, so they only catch an
+// engine that got several times slower, the bench measures speed precisely. A drift report line with
+// the throughput of both is printed per engine and dataset.
+
+#ifndef SOC_KALMAN_TEST_DATA
+#define SOC_KALMAN_TEST_DATA "tests/data"
+#endif
+
+typedef SoCKalmanT<3, 1, float, SoCKalmanUpdate::Textbook> Reference;
+
+static const uint32_t REPEATS = 20;    // replays per timing, the datasets are short
+static const uint32_t ROUNDS = 5;      // timings per engine and dataset, the fastest counts
+
+struct Row {
+    bool isBatteryInFloat;
+    int32_t batteryMilliAmps;
+    uint32_t batteryVoltage;
+    int32_t batteryMilliWatts;
+    uint32_t samplePeriodMilliSec;
+};
+
+struct Dataset {
+    std::string name;
+    bool isBattery12V;
+    bool isBatteryLithium;
+    uint32_t batteryCapacity;
+    std::vector<Row> rows;
+};
+
+// soc and efficiency after every row, the first row initialises the filter like the backtest
+struct Replay {
+    std::vector<uint32_t> soc;
+    std::vector<uint32_t> efficiency;
+    double rowsPerSecond;
+};
+
+static bool readDataset(const std::string& filename, Dataset& dataset)
+{
+    FILE* file = fopen(filename.c_str(), "r");
+    char line[256];
+    Row row;
+    int chargeState;
+
+    if (file == NULL)
+        return false;
+
+    // header
+    if (fgets(line, sizeof(line), file) == NULL) {
+        fclose(file);
+        return false;
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (sscanf(line, "%d,%d,%d,%u,%u", &row.batteryMilliAmps, &row.batteryMilliWatts, &chargeState, &row.batteryVoltage,
+                &row.samplePeriodMilliSec) != 5)
+            continue;
+        row.isBatteryInFloat = (chargeState == 3);
+        dataset.rows.push_back(row);
+    }
+
+    fclose(file);
+    return !dataset.rows.empty();
+}
+
+static const std::vector<Dataset>& corpus()
+{
+    static std::vector<Dataset> datasets;
+    char line[256];
+    char name[128];
+    int isBatteryLithium, nominalVoltage;
+    unsigned batteryCapacity;
+
+    if (!datasets.empty())
+        return datasets;
+
+    FILE* file = fopen(SOC_KALMAN_TEST_DATA "/corpus.csv", "r");
+    if (file == NULL)
+        return datasets;
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        Dataset dataset;
+        if (sscanf(line, "%127[^,],%d,%d,%u", name, &isBatteryLithium, &nominalVoltage, &batteryCapacity) != 4)
+            continue;
+        dataset.name = name;
+        dataset.isBattery12V = (nominalVoltage == 12);
+        dataset.isBatteryLithium = isBatteryLithium;
+        dataset.batteryCapacity = batteryCapacity;
+        if (readDataset(std::string(SOC_KALMAN_TEST_DATA "/") + name, dataset))
+            datasets.push_back(dataset);
+    }
+
+    fclose(file);
+    return datasets;
+}
+
+template <typename Kalman, typename Configure>
+static void replayOnce(const Dataset& dataset, Configure configure, Replay* replay)
+{
+    Kalman kalman;
+
+    configure(kalman);
+    for (size_t i = 0; i < dataset.rows.size(); i++) {
+        const Row& row = dataset.rows[i];
+        if (i == 0)
+            kalman.init(dataset.isBattery12V, dataset.isBatteryLithium, 85000, row.batteryVoltage, 0xFFFFFFFF);
+        else
+            kalman.sample(row.isBatteryInFloat, row.batteryMilliAmps, row.batteryVoltage, row.batteryMilliWatts, row.samplePeriodMilliSec,
+                dataset.batteryCapacity);
+        if (replay) {
+            replay->soc.push_back(kalman.read());
+            replay->efficiency.push_back(kalman.efficiency());
+        }
+    }
+}
+
+// seconds for REPEATS runs, the fastest of ROUNDS timings so a round the scheduler preempted doesn't count
+template <typename Run>
+static double bestSeconds(Run run)
+{
+    double best = 0;
+
+    for (uint32_t round = 0; round < ROUNDS; round++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < REPEATS; i++)
+            run();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (round == 0 || elapsed.count() < best)
+            best = elapsed.count();
+    }
+    return best;
+}
+
+template <typename Kalman, typename Configure>
+static Replay replay(const Dataset& dataset, Configure configure)
+{
+    Replay result;
+
+    replayOnce<Kalman>(dataset, configure, &result);
+    result.rowsPerSecond = REPEATS * dataset.rows.size() / bestSeconds([&]() { replayOnce<Kalman>(dataset, configure, NULL); });
+    return result;
+}
+
+template <typename Kalman>
+static Replay replay(const Dataset& dataset)
+{
+    return replay<Kalman>(dataset, [](Kalman&) {});
+}
+
+// check every row against the reference and print the drift report line, minSpeed is the slowest the
+// candidate may run as a fraction of the reference's rows per second
+static void checkDrift(const char* engine, const Dataset& dataset, const Replay& reference, const Replay& candidate, uint32_t socTolerance,
+    uint32_t efficiencyTolerance, double minSpeed)
+{
+    uint32_t maxSoc = 0;
+    uint32_t maxEfficiency = 0;
+    double sumSoc = 0;
+
+    CHECK_EQUAL(reference.soc.size(), candidate.soc.size());
+    for (size_t i = 0; i < reference.soc.size(); i++) {
+        uint32_t soc = (reference.soc[i] > candidate.soc[i]) ? reference.soc[i] - candidate.soc[i] : candidate.soc[i] - reference.soc[i];
+        uint32_t efficiency = (reference.efficiency[i] > candidate.efficiency[i]) ? reference.efficiency[i] - candidate.efficiency[i]
+                                                                                  : candidate.efficiency[i] - reference.efficiency[i];
+        maxSoc = (soc > maxSoc) ? soc : maxSoc;
+        maxEfficiency = (efficiency > maxEfficiency) ? efficiency : maxEfficiency;
+        sumSoc += soc;
+    }
+
+    printf("\ndrift %-16s %-18s soc max %6u mean %8.1f  efficiency max %6u  %10.0f rows/s (reference %10.0f)", engine, dataset.name.c_str(),
+        maxSoc, reference.soc.empty() ? 0.0 : sumSoc / reference.soc.size(), maxEfficiency, candidate.rowsPerSecond, reference.rowsPerSecond);
+
+    CHECK(maxSoc <= socTolerance);
+    CHECK(maxEfficiency <= efficiencyTolerance);
+    CHECK(candidate.rowsPerSecond >= minSpeed * reference.rowsPerSecond);
+}
+
+template <typename Kalman>
+static void checkEngine(const char* engine, uint32_t socTolerance, uint32_t efficiencyTolerance, double minSpeed)
+{
+    const std::vector<Dataset>& datasets = corpus();
+
+    CHECK(!datasets.empty());
+    for (size_t i = 0; i < datasets.size(); i++)
+        checkDrift(engine, datasets[i], replay<Reference>(datasets[i]), replay<Kalman>(datasets[i]), socTolerance, efficiencyTolerance, minSpeed);
+}
+
+TEST_GROUP(SoCKalmanRegressionTest){};
+
+TEST(SoCKalmanRegressionTest, ShouldReadCorpus)
+{
+    const std::vector<Dataset>& datasets = corpus();
+
+    CHECK_EQUAL(3, datasets.size());
+    for (size_t i = 0; i < datasets.size(); i++)
+        CHECK(datasets[i].rows.size() > 1000);
+}
+
+TEST(SoCKalmanRegressionTest, ShouldTrackReferenceWithSymmetricUpdate)
+{
+    // the update forms are algebraically equal, they only round differently, 0.2% soc observed. Both
+    // skip work the textbook form does and run about twice as fast.
+    checkEngine<SoCKalmanT<3, 1, float, SoCKalmanUpdate::Symmetric> >("float-symmetric", 300, 0, 0.75);
+}
+
+TEST(SoCKalmanRegressionTest, ShouldTrackReferenceWithJosephUpdate)
+{
+    checkEngine<SoCKalmanT<3, 1, float, SoCKalmanUpdate::Joseph> >("float-joseph", 300, 0, 0.75);
+}
+
+TEST(SoCKalmanRegressionTest, ShouldTrackReferenceWithFixedPoint)
+{
+    // Q15.16 loses the small covariance terms, 2.8% soc and 0.4% efficiency observed. The host emulates
+    // its division in software, a third to two thirds of the reference's speed.
+    checkEngine<SoCKalmanT<3, 1, Fixed16, SoCKalmanUpdate::Textbook> >("fixed", 3500, 600, 0.15);
+}
+
+TEST(SoCKalmanRegressionTest, ShouldTrackReferenceWithFixedPointSymmetricUpdate)
+{
+    checkEngine<SoCKalmanT<3, 1, Fixed16, SoCKalmanUpdate::Symmetric> >("fixed-symmetric", 3500, 600, 0.4);
+}
+
+TEST(SoCKalmanRegressionTest, ShouldTrackReferenceWithSteadyStateGain)
+{
+    const std::vector<Dataset>& datasets = corpus();
+
+    CHECK(!datasets.empty());
+    for (size_t i = 0; i < datasets.size(); i++) {
+        // the frozen gain lags the reference while the operating point moves, 5% soc and 3.6% efficiency
+        // observed, and skips the covariance update
+        Replay steady = replay<Reference>(datasets[i], [](Reference& kalman) { kalman.setSteadyStateGain(true); });
+        checkDrift("steady-state", datasets[i], replay<Reference>(datasets[i]), steady, 6000, 4500, 0.75);
+    }
+}
+
+TEST(SoCKalmanRegressionTest, ShouldMatchReferenceWithSampleBatch)
+{
+    const std::vector<Dataset>& datasets = corpus();
+
+    CHECK(!datasets.empty());
+    for (size_t d = 0; d < datasets.size(); d++) {
+        const Dataset& dataset = datasets[d];
+        uint32_t count = dataset.rows.size() - 1;
+        std::vector<uint8_t> isBatteryInFloat(count);
+        std::vector<int32_t> batteryMilliAmps(count);
+        std::vector<uint32_t> batteryVoltage(count);
+        std::vector<int32_t> batteryMilliWatts(count);
+        std::vector<uint32_t> samplePeriodMilliSec(count);
+        Replay batch;
+        uint32_t efficiency = 0;
+
+        // the rows after the first as columns
+        for (uint32_t i = 0; i < count; i++) {
+            const Row& row = dataset.rows[i + 1];
+            isBatteryInFloat[i] = row.isBatteryInFloat;
+            batteryMilliAmps[i] = row.batteryMilliAmps;
+            batteryVoltage[i] = row.batteryVoltage;
+            batteryMilliWatts[i] = row.batteryMilliWatts;
+            samplePeriodMilliSec[i] = row.samplePeriodMilliSec;
+        }
+
+        batch.soc.resize(count + 1);
+        auto run = [&]() {
+            // a fresh filter every time like replay(), init() keeps the other states
+            Reference kalman;
+            kalman.init(dataset.isBattery12V, dataset.isBatteryLithium, 85000, dataset.rows[0].batteryVoltage, 0xFFFFFFFF);
+            batch.soc[0] = kalman.read();
+            kalman.sampleBatch(count, (const bool*)isBatteryInFloat.data(), batteryMilliAmps.data(), batteryVoltage.data(), batteryMilliWatts.data(),
+                samplePeriodMilliSec.data(), dataset.batteryCapacity, &batch.soc[1]);
+            efficiency = kalman.efficiency();
+        };
+        run();
+        batch.rowsPerSecond = REPEATS * dataset.rows.size() / bestSeconds(run);
+
+        // sampleBatch doesn't report the efficiency per row, only the final one is compared
+        Replay reference = replay<Reference>(dataset);
+        batch.efficiency = reference.efficiency;
+        CHECK_EQUAL(reference.efficiency.back(), efficiency);
+        checkDrift("sample-batch", dataset, reference, batch, 0, 0, 0.5);
+    }
+}
+
+TEST(SoCKalmanRegressionTest, ShouldMatchReferenceWithFleet)
+{
+    // every dataset is one node, advanced together for as many rows as the shortest has
+    const std::vector<Dataset>& datasets = corpus();
+    uint32_t nodes = datasets.size();
+    size_t rows = 0;
+    Dataset combined;
+
+    CHECK(!datasets.empty());
+    for (uint32_t node = 0; node < nodes; node++)
+        rows = (node == 0 || datasets[node].rows.size() < rows) ? datasets[node].rows.size() : rows;
+
+    std::vector<Replay> results(nodes);
+    std::vector<uint8_t> isBatteryInFloat(nodes);
+    std::vector<int32_t> batteryMilliAmps(nodes);
+    std::vector<uint32_t> batteryVoltage(nodes);
+    std::vector<int32_t> batteryMilliWatts(nodes);
+    std::vector<uint32_t> samplePeriodMilliSec(nodes);
+    std::vector<uint32_t> batteryCapacity(nodes);
+
+    auto run = [&](bool record) {
+        SoCKalmanFleet fleet(nodes);
+        for (uint32_t node = 0; node < nodes; node++) {
+            const Dataset& dataset = datasets[node];
+            fleet.init(node, dataset.isBattery12V, dataset.isBatteryLithium, 85000, dataset.rows[0].batteryVoltage, 0xFFFFFFFF);
+            batteryCapacity[node] = dataset.batteryCapacity;
+            if (record) {
+                results[node].soc.push_back(fleet.read(node));
+                results[node].efficiency.push_back(fleet.efficiency(node));
+            }
+        }
+        for (size_t i = 1; i < rows; i++) {
+            for (uint32_t node = 0; node < nodes; node++) {
+                const Row& row = datasets[node].rows[i];
+                isBatteryInFloat[node] = row.isBatteryInFloat;
+                batteryMilliAmps[node] = row.batteryMilliAmps;
+                batteryVoltage[node] = row.batteryVoltage;
+                batteryMilliWatts[node] = row.batteryMilliWatts;
+                samplePeriodMilliSec[node] = row.samplePeriodMilliSec;
+            }
+            fleet.sampleAll((const bool*)isBatteryInFloat.data(), batteryMilliAmps.data(), batteryVoltage.data(), batteryMilliWatts.data(),
+                samplePeriodMilliSec.data(), batteryCapacity.data());
+            for (uint32_t node = 0; node < nodes && record; node++) {
+                results[node].soc.push_back(fleet.read(node));
+                results[node].efficiency.push_back(fleet.efficiency(node));
+            }
+        }
+    };
+    run(true);
+    double seconds = bestSeconds([&]() { run(false); });
+
+    for (uint32_t node = 0; node < nodes; node++) {
+        Replay reference = replay<Reference>(datasets[node]);
+        reference.soc.resize(rows);
+        reference.efficiency.resize(rows);
+        // one fleet step samples every node
+        results[node].rowsPerSecond = REPEATS * rows * nodes / seconds;
+        checkDrift("fleet", datasets[node], reference, results[node], 0, 0, 0.75);
+    }
+}
@@ -2,6 +2,19 @@
 #include "CppUTestExt/MockSupport.h"
 
 #include "SoCKalman.h"
+#include "SoCOcvTable.h"
+
+#ifdef SOC_KALMAN_INSTRUMENT
+#include <chrono> // std::chrono::steady_clock
+#endif
+
+// The Q15.16 build rounds the gain and state correction differently from float, so with
+// -Dfixed_point=true the SoCKalman results below may be one off the float values
+#ifdef SOC_KALMAN_FIXED_POINT
+static const double SOC_TOLERANCE = 1;
+#else
+static const double SOC_TOLERANCE = 0;
+#endif
 
 TEST_GROUP(SoCKalmanTest){};
 
@@ -51,7 +64,7 @@ TEST(SoCKalmanTest, ShouldIncreaseSoCNoFloatLeadAcid12V)
     kalman.sample(false, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity);
     uint32_t result = kalman.read();
 
-    CHECK_EQUAL(expectedResult, result);
+    DOUBLES_EQUAL(expectedResult, result, SOC_TOLERANCE);
 }
 
 TEST(SoCKalmanTest, ShouldDecreaseSoCNoFloatLeadAcid12V)
@@ -71,7 +84,7 @@ TEST(SoCKalmanTest, ShouldDecreaseSoCNoFloatLeadAcid12V)
     kalman.sample(false, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity);
     uint32_t result = kalman.read();
 
-    CHECK_EQUAL(expectedResult, result);
+    DOUBLES_EQUAL(expectedResult, result, SOC_TOLERANCE);
 }
 
 TEST(SoCKalmanTest, ShouldIncreaseSoCTwiceNoFloatLeadAcid12V)
@@ -92,7 +105,7 @@ TEST(SoCKalmanTest, ShouldIncreaseSoCTwiceNoFloatLeadAcid12V)
     kalman.sample(false, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity);
     uint32_t result = kalman.read();
 
-    CHECK_EQUAL(expectedResult, result);
+    DOUBLES_EQUAL(expectedResult, result, SOC_TOLERANCE);
 }
 
 // TEST(SoCKalmanTest, ShouldFloatTimerTriggerLeadAcid12V)
@@ -138,7 +151,7 @@ TEST(SoCKalmanTest, ShouldIncreaseSoCNoFloatLithium12V)
     kalman.sample(false, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity);
     uint32_t result = kalman.read();
 
-    CHECK_EQUAL(expectedResult, result);
+    DOUBLES_EQUAL(expectedResult, result, SOC_TOLERANCE);
 }
 
 TEST(SoCKalmanTest, ShouldDecreaseSoCNoFloatLithium12V)
@@ -158,7 +171,7 @@ TEST(SoCKalmanTest, ShouldDecreaseSoCNoFloatLithium12V)
     kalman.sample(false, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity);
     uint32_t result = kalman.read();
 
-    CHECK_EQUAL(expectedResult, result);
+    DOUBLES_EQUAL(expectedResult, result, SOC_TOLERANCE);
 }
 
 TEST(SoCKalmanTest, ShouldIncreaseSoCNoFloatLeadAcid24V)
@@ -178,7 +191,7 @@ TEST(SoCKalmanTest, ShouldIncreaseSoCNoFloatLeadAcid24V)
     kalman.sample(false, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity);
     uint32_t result = kalman.read();
 
-    CHECK_EQUAL(expectedResult, result);
+    DOUBLES_EQUAL(expectedResult, result, SOC_TOLERANCE);
 }
 
 TEST(SoCKalmanTest, ShouldNotOverflowMaxCalcs)
@@ -200,3 +213,505 @@ TEST(SoCKalmanTest, ShouldNotOverflowMaxCalcs)
 
     CHECK_EQUAL(expectedResult, result);
 }
+
+TEST(SoCKalmanTest, ShouldTrackFloatWithFixedPoint)
+{
+    SoCKalmanFloat reference;
+    SoCKalmanFixed kalman;
+
+    uint32_t batteryEff = 100000;   // 100 %
+    uint32_t batteryVoltage = 12300;
+    uint32_t initialSoC = 30000;
+    int32_t batteryMilliAmps = 500;
+    int32_t batteryMilliWatts = 6000;
+    uint32_t samplePeriodMilliSec = 3600000;
+    uint32_t batteryCapacity = 50 * 12;   // 50 Ah, 12 V
+    int32_t tolerance = 10;               // 0.01 %
+
+    reference.init(true, false, batteryEff, batteryVoltage, initialSoC);
+    kalman.init(true, false, batteryEff, batteryVoltage, initialSoC);
+
+    for (int i = 0; i < 24; i++) {
+        batteryVoltage += (i < 12) ? 20 : -20;
+        batteryMilliAmps = (i < 12) ? 500 : -500;
+        batteryMilliWatts = batteryMilliAmps * (int32_t)batteryVoltage / 1000;
+
+        reference.sample(false, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity);
+        kalman.sample(false, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity);
+
+        CHECK((int32_t)reference.read() - (int32_t)kalman.read() <= tolerance);
+        CHECK((int32_t)kalman.read() - (int32_t)reference.read() <= tolerance);
+    }
+}
+
+TEST(SoCKalmanTest, ShouldMatchDefaultsWithInjectedNoise)
+{
+    SoCKalman defaults;
+    SoCKalman constructed(0.1, 0.0001, 0.1);
+    SoCKalman reinitialised(1, 1, 1);
+
+    uint32_t batteryVoltage = 12500;
+    uint32_t batteryCapacity = 50 * 12;   // 50 Ah, 12 V
+
+    defaults.init(true, false, 100000, batteryVoltage, 50000);
+    constructed.init(true, false, 100000, batteryVoltage, 50000);
+    reinitialised.init(true, false, 100000, batteryVoltage, 50000, 0.1, 0.0001, 0.1);
+
+    defaults.sample(false, 1000, batteryVoltage, 12500, 3600000, batteryCapacity);
+    constructed.sample(false, 1000, batteryVoltage, 12500, 3600000, batteryCapacity);
+    reinitialised.sample(false, 1000, batteryVoltage, 12500, 3600000, batteryCapacity);
+
+    CHECK_EQUAL(defaults.read(), constructed.read());
+    CHECK_EQUAL(defaults.read(), reinitialised.read());
+}
+
+TEST(SoCKalmanTest, ShouldTrustVoltageMoreWithLowMeasurementNoise)
+{
+    SoCKalman defaults;
+    SoCKalman tuned(0.1, 0.0001, 0.001);
+
+    uint32_t batteryVoltage = 12500;
+    uint32_t batteryCapacity = 50 * 12;   // 50 Ah, 12 V
+
+    defaults.init(true, false, 100000, batteryVoltage, 50000);
+    tuned.init(true, false, 100000, batteryVoltage, 50000);
+
+    defaults.sample(false, 1000, batteryVoltage, 12500, 3600000, batteryCapacity);
+    tuned.sample(false, 1000, batteryVoltage, 12500, 3600000, batteryCapacity);
+
+    CHECK(defaults.read() != tuned.read());
+}
+
+TEST(SoCKalmanTest, ShouldResumeFromSnapshot)
+{
+    SoCKalman kalman;
+    SoCKalman resumed;
+    uint8_t buffer[SoCKalman::SNAPSHOT_SIZE];
+
+    uint32_t batteryCapacity = 50 * 12;   // 50 Ah, 12 V
+
+    kalman.init(true, false, 85000, 12500, 50000);
+    kalman.sample(false, 1000, 12500, 12500, 3600000, batteryCapacity);
+    kalman.sample(true, 1500, 13800, 20700, 300000, batteryCapacity);
+
+    CHECK_EQUAL(SoCKalman::SNAPSHOT_SIZE, kalman.snapshot(buffer, sizeof(buffer)));
+    CHECK(resumed.restore(buffer, sizeof(buffer)));
+    CHECK_EQUAL(kalman.read(), resumed.read());
+    CHECK_EQUAL(kalman.efficiency(), resumed.efficiency());
+
+    // the float timer carries over, so both reset soc to 100% on the same sample
+    kalman.sample(true, 1500, 13800, 20700, 400000, batteryCapacity);
+    resumed.sample(true, 1500, 13800, 20700, 400000, batteryCapacity);
+    kalman.sample(false, -2000, 12200, -24400, 3600000, batteryCapacity);
+    resumed.sample(false, -2000, 12200, -24400, 3600000, batteryCapacity);
+
+    CHECK_EQUAL(kalman.read(), resumed.read());
+    CHECK_EQUAL(kalman.efficiency(), resumed.efficiency());
+}
+
+TEST(SoCKalmanTest, ShouldRejectCorruptSnapshot)
+{
+    SoCKalman kalman;
+    SoCKalman resumed;
+    uint8_t buffer[SoCKalman::SNAPSHOT_SIZE];
+
+    kalman.init(true, false, 85000, 12500, 50000);
+    resumed.init(true, false, 85000, 12500, 20000);
+
+    CHECK_EQUAL(0, kalman.snapshot(buffer, sizeof(buffer) - 1));
+    kalman.snapshot(buffer, sizeof(buffer));
+    CHECK_FALSE(resumed.restore(buffer, sizeof(buffer) - 1));
+
+    buffer[8] ^= 0x01;
+    CHECK_FALSE(resumed.restore(buffer, sizeof(buffer)));
+    CHECK_EQUAL(20000, resumed.read());
+}
+
+TEST(SoCKalmanTest, ShouldRejectSnapshotOfOtherArithmetic)
+{
+    SoCKalmanFloat kalman;
+    SoCKalmanFixed resumed;
+    uint8_t buffer[SoCKalmanFloat::SNAPSHOT_SIZE];
+
+    kalman.init(true, false, 85000, 12500, 50000);
+    kalman.snapshot(buffer, sizeof(buffer));
+
+    CHECK_FALSE(resumed.restore(buffer, sizeof(buffer)));
+}
+
+typedef SoCKalmanT<3, 1, float, SoCKalmanUpdate::Textbook> SoCKalmanTextbook;
+typedef SoCKalmanT<3, 1, float, SoCKalmanUpdate::Symmetric> SoCKalmanSymmetric;
+typedef SoCKalmanT<3, 1, float, SoCKalmanUpdate::Joseph> SoCKalmanJoseph;
+typedef SoCKalmanT<3, 1, Fixed16, SoCKalmanUpdate::Textbook> SoCKalmanFixedTextbook;
+typedef SoCKalmanT<3, 1, Fixed16, SoCKalmanUpdate::Symmetric> SoCKalmanFixedSymmetric;
+
+// a day of hourly samples shaped like the backtest data: one hour of charge, two of discharge
+template <typename Reference, typename Kalman>
+static void checkTracksReference(int32_t tolerance)
+{
+    Reference reference;
+    Kalman kalman;
+
+    uint32_t batteryCapacity = 50 * 12;   // 50 Ah, 12 V
+
+    reference.init(true, false, 85000, 12288, 0xFFFFFFFF);
+    kalman.init(true, false, 85000, 12288, 0xFFFFFFFF);
+
+    for (int i = 0; i < 72; i++) {
+        bool isCharging = (i % 3) == 0;
+        int32_t batteryMilliAmps = isCharging ? 3000 : -800;
+        uint32_t batteryVoltage = (isCharging ? 12450 : 12250) + (i % 5) * 20;
+        int32_t batteryMilliWatts = batteryMilliAmps * (int32_t)batteryVoltage / 1000;
+
+        reference.sample(false, batteryMilliAmps, batteryVoltage, batteryMilliWatts, 3600000, batteryCapacity);
+        kalman.sample(false, batteryMilliAmps, batteryVoltage, batteryMilliWatts, 3600000, batteryCapacity);
+
+        // the gain only differs once the covariance has been updated once
+        if (i == 0) CHECK_EQUAL(reference.read(), kalman.read());
+        CHECK((int32_t)reference.read() - (int32_t)kalman.read() <= tolerance);
+        CHECK((int32_t)kalman.read() - (int32_t)reference.read() <= tolerance);
+    }
+}
+
+TEST(SoCKalmanTest, ShouldMatchTextbookWithSymmetricUpdate)
+{
+    checkTracksReference<SoCKalmanTextbook, SoCKalmanSymmetric>(10);
+}
+
+TEST(SoCKalmanTest, ShouldMatchTextbookWithJosephUpdate)
+{
+    checkTracksReference<SoCKalmanTextbook, SoCKalmanJoseph>(10);
+}
+
+TEST(SoCKalmanTest, ShouldMatchTextbookWithSymmetricFixedPointUpdate)
+{
+    checkTracksReference<SoCKalmanFixedTextbook, SoCKalmanFixedSymmetric>(100);
+}
+
+TEST(SoCKalmanTest, ShouldShrinkStateWithSymmetricUpdate)
+{
+    CHECK(sizeof(SoCKalmanSymmetric) < sizeof(SoCKalmanTextbook));
+    CHECK(SoCKalmanSymmetric::SNAPSHOT_SIZE < SoCKalmanTextbook::SNAPSHOT_SIZE);
+}
+
+TEST(SoCKalmanTest, ShouldSampleBatchLikeSingleSamples)
+{
+    const uint32_t ROWS = 12;
+    SoCKalman single;
+    SoCKalman batch;
+    SoCKalman batchNoOutput;
+
+    bool isBatteryInFloat[ROWS];
+    int32_t batteryMilliAmps[ROWS];
+    uint32_t batteryVoltage[ROWS];
+    int32_t batteryMilliWatts[ROWS];
+    uint32_t samplePeriodMilliSec[ROWS];
+    uint32_t soc[ROWS];
+    uint32_t batteryCapacity = 50 * 12;   // 50 Ah, 12 V
+
+    for (uint32_t i = 0; i < ROWS; i++) {
+        isBatteryInFloat[i] = (i >= 10);
+        batteryMilliAmps[i] = (i % 3 == 0) ? 3000 : -800;
+        batteryVoltage[i] = (i >= 10) ? 13800 : 12300 + i * 10;
+        batteryMilliWatts[i] = batteryMilliAmps[i] * (int32_t)batteryVoltage[i] / 1000;
+        samplePeriodMilliSec[i] = (i >= 10) ? 400000 : 3600000;
+    }
+
+    single.init(true, false, 85000, 12300, 50000);
+    batch.init(true, false, 85000, 12300, 50000);
+    batchNoOutput.init(true, false, 85000, 12300, 50000);
+
+    batch.sampleBatch(ROWS, isBatteryInFloat, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity, soc);
+    batchNoOutput.sampleBatch(ROWS, isBatteryInFloat, batteryMilliAmps, batteryVoltage, batteryMilliWatts, samplePeriodMilliSec, batteryCapacity,
+        NULL);
+
+    for (uint32_t i = 0; i < ROWS; i++) {
+        single.sample(isBatteryInFloat[i], batteryMilliAmps[i], batteryVoltage[i], batteryMilliWatts[i], samplePeriodMilliSec[i], batteryCapacity);
+        CHECK_EQUAL(single.read(), soc[i]);
+    }
+    CHECK_EQUAL(single.read(), batchNoOutput.read());
+    CHECK_EQUAL(single.efficiency(), batch.efficiency());
+}
+
+TEST(SoCKalmanTest, ShouldTrackFullUpdateWithSteadyStateGain)
+{
+    SoCKalman reference;
+    SoCKalman kalman;
+    uint32_t batteryCapacity = 50 * 12;   // 50 Ah, 12 V
+
+    kalman.setSteadyStateGain(true);
+    reference.init(true, false, 85000, 12288, 0xFFFFFFFF);
+    kalman.init(true, false, 85000, 12288, 0xFFFFFFFF);
+
+    // a month of the hourly charge and discharge pattern, the covariance settles within the first days
+    for (int i = 0; i < 720; i++) {
+        bool isCharging = (i % 3) == 0;
+        int32_t batteryMilliAmps = isCharging ? 3000 : -800;
+        uint32_t batteryVoltage = (isCharging ? 12450 : 12250) + (i % 5) * 20;
+        int32_t batteryMilliWatts = batteryMilliAmps * (int32_t)batteryVoltage / 1000;
+
+        reference.sample(false, batteryMilliAmps, batteryVoltage, batteryMilliWatts, 3600000, batteryCapacity);
+        kalman.sample(false, batteryMilliAmps, batteryVoltage, batteryMilliWatts, 3600000, batteryCapacity);
+
+        // nothing is frozen before the covariance has settled
+        if (i < 8) CHECK_EQUAL(reference.read(), kalman.read());
+        CHECK((int32_t)reference.read() - (int32_t)kalman.read() <= 2000);
+        CHECK((int32_t)kalman.read() - (int32_t)reference.read() <= 2000);
+    }
+}
+
+#ifdef SOC_KALMAN_INSTRUMENT
+static uint32_t ticks;
+
+// advances one tick per read, so every timed stage takes exactly one tick
+static uint32_t countingClock()
+{
+    return ++ticks;
+}
+
+static uint32_t steadyClock()
+{
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TEST(SoCKalmanTest, ShouldCountStagesOfSample)
+{
+    SoCKalman kalman;
+    SoCKalman reference;
+
+    kalman.setClock(countingClock);
+    kalman.init(true, false, 85000, 12300, 50000);
+    reference.init(true, false, 85000, 12300, 50000);
+
+    kalman.sample(false, 3000, 12450, 37350, 3600000, 600);
+    reference.sample(false, 3000, 12450, 37350, 3600000, 600);
+
+    // instrumentation doesn't change the result
+    CHECK_EQUAL(reference.read(), kalman.read());
+    CHECK_EQUAL(1, kalman.counters().samples);
+    CHECK_EQUAL(1, kalman.counters().corrections);
+    for (int stage = 0; stage < SOC_KALMAN_STAGES; stage++) {
+        CHECK_EQUAL(1, kalman.counters().cycles[stage]);
+        CHECK_EQUAL(1, kalman.counters().totalCycles[stage]);
+    }
+    CHECK(kalman.counters().nis >= 0);
+    CHECK(kalman.counters().pDiagonal[0] > 0);
+
+    kalman.resetCounters();
+    CHECK_EQUAL(0, kalman.counters().samples);
+    CHECK_EQUAL(0, kalman.counters().corrections);
+    CHECK_EQUAL(0, kalman.counters().totalCycles[0]);
+}
+
+TEST(SoCKalmanTest, ShouldSkipCovarianceStagesWithSteadyStateGain)
+{
+    SoCKalman kalman;
+    uint32_t frozen = 0;
+
+    kalman.setClock(countingClock);
+    kalman.setSteadyStateGain(true);
+    kalman.init(true, false, 85000, 12288, 0xFFFFFFFF);
+
+    for (int i = 0; i < 720; i++) {
+        bool isCharging = (i % 3) == 0;
+        int32_t batteryMilliAmps = isCharging ? 3000 : -800;
+        uint32_t batteryVoltage = (isCharging ? 12450 : 12250) + (i % 5) * 20;
+
+        kalman.sample(false, batteryMilliAmps, batteryVoltage, batteryMilliAmps * (int32_t)batteryVoltage / 1000, 3600000, 600);
+        if (kalman.counters().cycles[(uint8_t)SoCKalmanStage::Predict] == 0) {
+            CHECK_EQUAL(0, kalman.counters().cycles[(uint8_t)SoCKalmanStage::UpdateCovariance]);
+            frozen++;
+        }
+    }
+
+    CHECK(frozen > 0);
+    CHECK_EQUAL(720 - frozen, kalman.counters().totalCycles[(uint8_t)SoCKalmanStage::Predict]);
+}
+
+TEST(SoCKalmanTest, ShouldTimeStagesWithSteadyClock)
+{
+    SoCKalman kalman;
+    uint64_t total = 0;
+
+    kalman.setClock(steadyClock);
+    kalman.init(true, false, 85000, 12300, 50000);
+    for (int i = 0; i < 100; i++)
+        kalman.sample(false, 3000, 12450, 37350, 3600000, 600);
+
+    for (int stage = 0; stage < SOC_KALMAN_STAGES; stage++)
+        total += kalman.counters().totalCycles[stage];
+    CHECK_EQUAL(100, kalman.counters().samples);
+    CHECK(total > 0);
+}
+
+TEST(SoCKalmanTest, ShouldCountSamplesWithoutMeasurementUpdate)
+{
+    SoCKalman kalman;
+
+    kalman.setClock(countingClock);
+    kalman.setCorrectionInterval(4, 0);
+    kalman.init(true, false, 85000, 12300, 50000);
+    for (int i = 0; i < 100; i++)
+        kalman.sample(false, 3000, 12450, 37350, 3600000, 600);
+
+    // every sample is timed from f, only the corrections get past predict
+    CHECK_EQUAL(100, kalman.counters().samples);
+    CHECK_EQUAL(25, kalman.counters().corrections);
+    CHECK_EQUAL(100, kalman.counters().totalCycles[(uint8_t)SoCKalmanStage::F]);
+    CHECK_EQUAL(100, kalman.counters().totalCycles[(uint8_t)SoCKalmanStage::Predict]);
+    CHECK_EQUAL(25, kalman.counters().totalCycles[(uint8_t)SoCKalmanStage::H]);
+}
+#endif
+
+TEST(SoCKalmanTest, ShouldTraceSamplesIntoRing)
+{
+    SoCKalman kalman;
+    SoCKalmanTraceRecord<3, 1> records[4];
+    SoCKalman::TraceRing ring(records, 4);
+    SoCKalmanTraceRecord<3, 1> record;
+    uint32_t soc[6];
+
+    kalman.init(true, false, 85000, 13800, 95000);
+    kalman.setTrace(&ring);
+
+    // the last two samples are past the float reset duration
+    for (int i = 0; i < 6; i++) {
+        kalman.sample(true, 500, 13800, 6900, 150000, 600);
+        soc[i] = kalman.read();
+    }
+
+    // the ring holds four records, the rest were dropped
+    CHECK_EQUAL(2, ring.dropped());
+    for (uint32_t i = 0; i < 4; i++) {
+        CHECK_TRUE(ring.pop(record));
+        CHECK_EQUAL(i, record.sample);
+        CHECK_EQUAL(soc[i], (uint32_t)record.x[0]);
+        CHECK_EQUAL(0, record.flags);
+    }
+    CHECK_FALSE(ring.pop(record));
+
+    // with room again the sequence shows the gap
+    kalman.sample(true, 500, 13800, 6900, 150000, 600);
+    CHECK_TRUE(ring.pop(record));
+    CHECK_EQUAL(6, record.sample);
+    CHECK_EQUAL(SOC_KALMAN_TRACE_EFFICIENCY, record.flags);
+    CHECK_EQUAL(kalman.efficiency(), record.batteryEff);
+
+    kalman.setTrace(NULL);
+    kalman.sample(true, 500, 13800, 6900, 150000, 600);
+    CHECK_FALSE(ring.pop(record));
+}
+
+// one sample of samplePeriodMilliSec split into count equal samples, at the ocv of the starting soc so
+// the measurement update doesn't correct anything and only the coulomb counting moves the soc
+static uint32_t sampleSplit(bool isPrecise, int32_t batteryMilliWatts, uint32_t samplePeriodMilliSec, uint32_t count)
+{
+    SoCKalman kalman;
+    uint32_t midVoltage;
+    uint32_t gradient;
+
+    SoCOcvTable::lookup(true, false, 50500, midVoltage, gradient);
+    kalman.setPreciseIntegration(isPrecise);
+    kalman.init(true, false, 85000, midVoltage, 50500);
+    for (uint32_t i = 0; i < count; i++)
+        kalman.sample(false, 900, midVoltage, batteryMilliWatts, samplePeriodMilliSec / count, 600);
+    return kalman.read();
+}
+
+TEST(SoCKalmanTest, ShouldIntegrateShortSamplesPrecisely)
+{
+    // 10.8 W for 10 minutes is 1800 mWh, 1800 * 85000 / 600000 = 255
+    CHECK_EQUAL(50755, sampleSplit(true, 10800, 600000, 1));
+    CHECK_EQUAL(50755, sampleSplit(true, 10800, 600000, 10));
+    CHECK_EQUAL(50755, sampleSplit(true, 10800, 600000, 600));
+
+    // and the same charge out again
+    CHECK_EQUAL(50245, sampleSplit(true, -10800, 600000, 1));
+    CHECK_EQUAL(50245, sampleSplit(true, -10800, 600000, 600));
+
+    // whole watts and whole hours lose every sub-hour sample
+    CHECK_EQUAL(50500, sampleSplit(false, 10800, 600000, 10));
+}
+
+TEST(SoCKalmanTest, ShouldClampAtZeroWhenDischargingPastEmpty)
+{
+    SoCKalman kalman;
+    uint32_t batteryVoltage = 11640;      // ocv of 0% for a 12 V lead-acid battery
+    uint32_t batteryCapacity = 50 * 12;   // 50 Ah, 12 V
+
+    // 58 W out in 10 minute samples drives the measurement update below zero from 2%
+    kalman.setPreciseIntegration(true);
+    kalman.init(true, false, 85000, batteryVoltage, 2000);
+
+    for (int i = 0; i < 12; i++) {
+        kalman.sample(false, -5000, batteryVoltage, -58000, 600000, batteryCapacity);
+        CHECK(kalman.read() <= 2000);
+    }
+    CHECK_EQUAL(0, kalman.read());
+}
+
+TEST(SoCKalmanTest, ShouldKeepEfficiencyWhenFloatingFromEmpty)
+{
+    SoCKalman kalman;
+    uint32_t batteryVoltage = 11640;      // ocv of 0% for a 12 V lead-acid battery
+    uint32_t batteryCapacity = 50 * 12;   // 50 Ah, 12 V
+
+    kalman.setPreciseIntegration(true);
+    kalman.init(true, false, 85000, batteryVoltage, 2000);
+    for (int i = 0; i < 12; i++)
+        kalman.sample(false, -5000, batteryVoltage, -58000, 600000, batteryCapacity);
+    CHECK_EQUAL(0, kalman.read());
+
+    // a float period past the reset duration recalculates the efficiency relative to the soc before it
+    kalman.sample(true, 1000, 13500, 13500, 700000, batteryCapacity);
+    CHECK_EQUAL(85000, kalman.efficiency());
+    CHECK(kalman.read() > 0);
+}
+
+TEST(SoCKalmanTest, ShouldPredictEverySampleAndCorrectEveryFourth)
+{
+    SoCKalman reference;
+    SoCKalman kalman;
+    SoCKalman budget;
+    uint32_t batteryCapacity = 50 * 12;   // 50 Ah, 12 V
+
+    reference.setPreciseIntegration(true);
+    kalman.setPreciseIntegration(true);
+    budget.setPreciseIntegration(true);
+    kalman.setCorrectionInterval(4, 0);
+    budget.setCorrectionInterval(0, 4 * 60000);
+    reference.init(true, false, 85000, 12288, 0xFFFFFFFF);
+    kalman.init(true, false, 85000, 12288, 0xFFFFFFFF);
+    budget.init(true, false, 85000, 12288, 0xFFFFFFFF);
+
+    // half a day of one minute samples, an hour of charge and two of discharge
+    for (int i = 0; i < 720; i++) {
+        bool isCharging = (i / 60 % 3) == 0;
+        int32_t batteryMilliAmps = isCharging ? 3000 : -800;
+        uint32_t batteryVoltage = (isCharging ? 12450 : 12250) + (i / 60 % 5) * 20;
+        int32_t batteryMilliWatts = batteryMilliAmps * (int32_t)batteryVoltage / 1000;
+        uint32_t corrected = kalman.readCorrected();
+        uint32_t live = kalman.read();
+
+        reference.sample(false, batteryMilliAmps, batteryVoltage, batteryMilliWatts, 60000, batteryCapacity);
+        kalman.sample(false, batteryMilliAmps, batteryVoltage, batteryMilliWatts, 60000, batteryCapacity);
+        budget.sample(false, batteryMilliAmps, batteryVoltage, batteryMilliWatts, 60000, batteryCapacity);
+
+        // the prediction follows the current on every sample, the correction only lands on every fourth
+        if (i % 4 == 3) {
+            CHECK_EQUAL(kalman.read(), kalman.readCorrected());
+        } else {
+            CHECK_EQUAL(corrected, kalman.readCorrected());
+            CHECK(isCharging ? kalman.read() > live : kalman.read() < live);
+        }
+
+        // a time budget of four sample periods is the same interval
+        CHECK_EQUAL(kalman.read(), budget.read());
+
+        // fewer updates converge slower, afterwards the estimates stay close
+        if (i >= 240) {
+            CHECK((int32_t)reference.read() - (int32_t)kalman.read() <= 2500);
+            CHECK((int32_t)kalman.read() - (int32_t)reference.read() <= 2500);
+        }
+    }
+}
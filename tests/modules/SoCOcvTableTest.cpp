@@ -0,0 +1,57 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+
+#include "SoCOcvTable.h"
+
+TEST_GROUP(SoCOcvTableTest){};
+
+TEST(SoCOcvTableTest, ShouldFindFirstSegmentLeadAcid12V)
+{
+    uint32_t midVoltage = 0;
+    uint32_t gradient = 0;
+
+    CHECK_TRUE(SoCOcvTable::lookup(true, false, 0, midVoltage, gradient));
+    CHECK_EQUAL(11646, midVoltage);   // (11640 + 11653) / 2
+    CHECK_EQUAL(1, gradient);
+}
+
+TEST(SoCOcvTableTest, ShouldFindLastSegmentLeadAcid12V)
+{
+    uint32_t midVoltage = 0;
+    uint32_t gradient = 0;
+
+    CHECK_TRUE(SoCOcvTable::lookup(true, false, 99999, midVoltage, gradient));
+    CHECK_EQUAL(12953, midVoltage);   // (12946 + 12960) / 2
+    CHECK_EQUAL(1, gradient);
+}
+
+TEST(SoCOcvTableTest, ShouldScaleSegmentLithium24V)
+{
+    uint32_t midVoltage = 0;
+    uint32_t gradient = 0;
+
+    CHECK_TRUE(SoCOcvTable::lookup(false, true, 999, midVoltage, gradient));
+    CHECK_EQUAL(11266, midVoltage);   // (5000 + 6266) * 2 / 2
+    CHECK_EQUAL(253, gradient);       // 1266 * 2 * 100 / 1000
+}
+
+TEST(SoCOcvTableTest, ShouldBracketOnSegmentBoundary)
+{
+    uint32_t midVoltage = 0;
+    uint32_t gradient = 0;
+
+    CHECK_TRUE(SoCOcvTable::lookup(true, true, 1000, midVoltage, gradient));
+    CHECK_EQUAL(6850, midVoltage);   // (6266 + 7434) / 2
+    CHECK_EQUAL(116, gradient);      // 1168 * 100 / 1000
+}
+
+TEST(SoCOcvTableTest, ShouldLeaveOutputsOutsideTable)
+{
+    uint32_t midVoltage = 7;
+    uint32_t gradient = 8;
+
+    CHECK_FALSE(SoCOcvTable::lookup(true, false, 100000, midVoltage, gradient));
+    CHECK_FALSE(SoCOcvTable::lookup(true, false, -1, midVoltage, gradient));
+    CHECK_EQUAL(7, midVoltage);
+    CHECK_EQUAL(8, gradient);
+}
@@ -0,0 +1,72 @@
+// std::thread before CppUTest's new macros
+#include <thread>
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+
+#include "SpscQueue.h"
+
+TEST_GROUP(SpscQueueTest){};
+
+TEST(SpscQueueTest, ShouldRoundCapacityUpToPowerOfTwo)
+{
+    SpscQueue<uint32_t> queue(5);
+    uint32_t item = 0;
+    uint32_t pushed = 0;
+
+    while (queue.push(pushed))
+        pushed++;
+    CHECK_EQUAL(8, pushed);
+
+    // a pop frees exactly one slot
+    CHECK_TRUE(queue.pop(item));
+    CHECK_EQUAL(0, item);
+    CHECK_TRUE(queue.push(pushed));
+    CHECK_FALSE(queue.push(pushed + 1));
+}
+
+TEST(SpscQueueTest, ShouldRefusePopWhenEmpty)
+{
+    SpscQueue<uint32_t> queue(4);
+    uint32_t item = 7;
+
+    CHECK_FALSE(queue.pop(item));
+    CHECK_EQUAL(7, item);
+    CHECK_TRUE(queue.push(1));
+    CHECK_TRUE(queue.pop(item));
+    CHECK_EQUAL(1, item);
+    CHECK_FALSE(queue.pop(item));
+}
+
+TEST(SpscQueueTest, ShouldKeepOrderBetweenThreads)
+{
+    // a small queue so both sides keep finding it full or empty and wrap around it many times
+    static const uint32_t COUNT = 1000000;
+    SpscQueue<uint64_t> queue(16);
+    uint64_t expected = 0;
+    uint64_t item;
+    uint32_t outOfOrder = 0;
+
+    std::thread producer([&queue]() {
+        for (uint64_t i = 0; i < COUNT; i++) {
+            // both halves depend on i so a torn copy shows up
+            uint64_t value = (i << 32) | (i ^ 0xA5A5A5A5u);
+            while (!queue.push(value))
+                std::this_thread::yield();
+        }
+    });
+
+    while (expected < COUNT) {
+        if (!queue.pop(item)) {
+            std::this_thread::yield();
+            continue;
+        }
+        if (item != ((expected << 32) | (expected ^ 0xA5A5A5A5u)))
+            outOfOrder++;
+        expected++;
+    }
+    producer.join();
+
+    CHECK_EQUAL(0, outOfOrder);
+    CHECK_FALSE(queue.pop(item));
+}
@@ -0,0 +1,228 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+
+#include <stdexcept> // std::runtime_error
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "StateArena.h"
+
+// an empty file that StateArena creates an arena in, removed again at the end of the test
+struct ArenaFile {
+    char path[32];
+
+    ArenaFile()
+    {
+        strcpy(path, "/tmp/state-arena-XXXXXX");
+        close(mkstemp(path));
+    }
+
+    ~ArenaFile()
+    {
+        unlink(path);
+    }
+};
+
+static SoCKalmanState make_state(uint32_t soc)
+{
+    SoCKalmanState state;
+
+    memset(&state, 0, sizeof(state));
+    state.soc = soc;
+    state.batteryEff = 85000;
+    return state;
+}
+
+static size_t record_offset(uint32_t node, int index)
+{
+    return StateArena::HEADER_SIZE + (2 * (size_t)node + index) * sizeof(ArenaRecord);
+}
+
+static void read_record(const char* path, uint32_t node, int index, ArenaRecord& record)
+{
+    FILE* file = fopen(path, "rb");
+
+    fseek(file, record_offset(node, index), SEEK_SET);
+    CHECK_EQUAL(1, fread(&record, sizeof(record), 1, file));
+    fclose(file);
+}
+
+static void write_record(const char* path, uint32_t node, int index, const ArenaRecord& record)
+{
+    FILE* file = fopen(path, "r+b");
+
+    fseek(file, record_offset(node, index), SEEK_SET);
+    CHECK_EQUAL(1, fwrite(&record, sizeof(record), 1, file));
+    fclose(file);
+}
+
+// crc32 (IEEE 802.3) of the fields before the crc, like StateArena
+static uint32_t record_crc(const ArenaRecord& record)
+{
+    const uint8_t* buffer = (const uint8_t*)&record;
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (size_t i = 0; i < offsetof(ArenaRecord, crc); i++) {
+        crc ^= buffer[i];
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+TEST_GROUP(StateArenaTest){};
+
+TEST(StateArenaTest, ShouldResumeStatesAfterReopening)
+{
+    ArenaFile file;
+
+    {
+        StateArena arena(file.path, 8);
+        CHECK(arena.read(3) == NULL);
+        CHECK_TRUE(arena.write(3, make_state(40000), 100000));
+        CHECK_TRUE(arena.write(3, make_state(41000), 100000));
+        CHECK_EQUAL(1, arena.nodes());
+    }
+
+    StateArena arena(file.path, 16);   // an existing arena keeps its capacity
+    CHECK_EQUAL(8, arena.capacity());
+    CHECK_EQUAL(0, arena.nodes());
+
+    const ArenaRecord* record = arena.read(3);
+    CHECK(record != NULL);
+    CHECK_EQUAL(41000, record->state.soc);
+    CHECK_EQUAL(100000, record->batteryCapacity);
+    CHECK_EQUAL(2, record->sequence);
+    CHECK(arena.read(2) == NULL);
+    CHECK_EQUAL(0, arena.recovered());
+
+    // resumed nodes count once touched, like initialised ones
+    CHECK_EQUAL(1, arena.nodes());
+}
+
+TEST(StateArenaTest, ShouldFallBackWhenNewestRecordIsDamaged)
+{
+    ArenaFile file;
+    ArenaRecord record;
+
+    {
+        StateArena arena(file.path, 4);
+        arena.write(2, make_state(30000), 100000);   // first record, sequence 1
+        arena.write(2, make_state(31000), 100000);   // second record, sequence 2
+    }
+
+    // a write that didn't finish, the crc doesn't match the state any more
+    read_record(file.path, 2, 1, record);
+    CHECK_EQUAL(2, record.sequence);
+    record.state.soc = 32000;
+    write_record(file.path, 2, 1, record);
+
+    StateArena arena(file.path, 4);
+    const ArenaRecord* current = arena.read(2);
+    CHECK(current != NULL);
+    CHECK_EQUAL(1, current->sequence);
+    CHECK_EQUAL(30000, current->state.soc);
+    CHECK_EQUAL(1, arena.recovered());
+
+    // checked once, a second read doesn't count again
+    arena.read(2);
+    CHECK_EQUAL(1, arena.recovered());
+
+    // the next write replaces the damaged record
+    CHECK_TRUE(arena.write(2, make_state(33000), 100000));
+    CHECK_EQUAL(2, arena.read(2)->sequence);
+    CHECK_EQUAL(33000, arena.read(2)->state.soc);
+}
+
+TEST(StateArenaTest, ShouldNotCountNeverWrittenRecordAsRecovered)
+{
+    ArenaFile file;
+    StateArena arena(file.path, 4);
+
+    arena.write(1, make_state(30000), 100000);
+    CHECK_EQUAL(1, arena.read(1)->sequence);
+    CHECK(arena.read(0) == NULL);
+    CHECK_EQUAL(0, arena.recovered());
+}
+
+TEST(StateArenaTest, ShouldPickNewerRecordAcrossSequenceWrap)
+{
+    ArenaFile file;
+    ArenaRecord older;
+    ArenaRecord newer;
+
+    {
+        StateArena arena(file.path, 4);
+        arena.write(1, make_state(20000), 100000);
+        arena.write(1, make_state(21000), 100000);
+    }
+
+    // the last two versions before and after the sequence wraps, 0 is skipped
+    read_record(file.path, 1, 0, older);
+    read_record(file.path, 1, 1, newer);
+    older.sequence = 0xFFFFFFFF;
+    older.crc = record_crc(older);
+    newer.sequence = 1;
+    newer.crc = record_crc(newer);
+    write_record(file.path, 1, 0, older);
+    write_record(file.path, 1, 1, newer);
+
+    StateArena arena(file.path, 4);
+    const ArenaRecord* current = arena.read(1);
+    CHECK(current != NULL);
+    CHECK_EQUAL(1, current->sequence);
+    CHECK_EQUAL(21000, current->state.soc);
+    CHECK_EQUAL(0, arena.recovered());
+
+    // and keeps counting from there into the older record
+    CHECK_TRUE(arena.write(1, make_state(22000), 100000));
+    CHECK_EQUAL(2, arena.read(1)->sequence);
+    CHECK_EQUAL(22000, arena.read(1)->state.soc);
+}
+
+TEST(StateArenaTest, ShouldSkipZeroWhenSequenceWraps)
+{
+    ArenaFile file;
+    ArenaRecord record;
+
+    {
+        StateArena arena(file.path, 4);
+        arena.write(0, make_state(20000), 100000);
+    }
+
+    read_record(file.path, 0, 0, record);
+    record.sequence = 0xFFFFFFFF;
+    record.crc = record_crc(record);
+    write_record(file.path, 0, 0, record);
+
+    StateArena arena(file.path, 4);
+    CHECK_TRUE(arena.write(0, make_state(21000), 100000));
+    CHECK_EQUAL(1, arena.read(0)->sequence);
+    CHECK_EQUAL(21000, arena.read(0)->state.soc);
+}
+
+TEST(StateArenaTest, ShouldRejectNodeAtOrAboveCapacity)
+{
+    ArenaFile file;
+    StateArena arena(file.path, 4);
+
+    CHECK_TRUE(arena.write(3, make_state(50000), 100000));
+    CHECK_FALSE(arena.write(4, make_state(50000), 100000));
+    CHECK_FALSE(arena.write(0xFFFFFFFF, make_state(50000), 100000));
+    CHECK(arena.read(4) == NULL);
+    CHECK(arena.read(0xFFFFFFFF) == NULL);
+    CHECK_EQUAL(1, arena.nodes());
+}
+
+TEST(StateArenaTest, ShouldRejectFileThatIsNotAnArena)
+{
+    ArenaFile file;
+    FILE* other = fopen(file.path, "wb");
+
+    fputs("timestamp,battery_milliamps\n", other);
+    fclose(other);
+
+    CHECK_THROWS(std::runtime_error, StateArena(file.path, 4));
+}